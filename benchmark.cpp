@@ -0,0 +1,466 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Benchmarks for the distance transforms and Fuzzy Kappa on synthetic
+// categorical rasters. The results are written to standard output as JSON,
+// progress goes to standard error. Run with --help for the options.
+//
+// The time per phase is recorded by phase_stats. The peak resident set size
+// is that of the whole process, it is reset before each case where the
+// operating system allows it (Linux).
+
+#include <blink/raster_tools/distance_transform.h>
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster_tools/phase_stats.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace rt = blink::raster_tools;
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory use
+//
+std::uint64_t peak_rss_bytes()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return static_cast<std::uint64_t>(usage.ru_maxrss); // bytes
+#else
+  return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+// Linux resets the peak RSS when "5" is written to clear_refs. Elsewhere the
+// peak is that of the process so far.
+bool reset_peak_rss()
+{
+#if defined(__linux__)
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  return static_cast<bool>(clear_refs);
+#else
+  return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Synthetic inputs. The same seed, size and number of classes give the same
+// raster.
+//  random    : each cell an independent uniform category
+//  clustered : square patches of uniform category, with 5% noise
+//  sparse    : category 0, with 0.1% of the cells in one of the others
+//
+rt::memory_raster<int> make_input(const std::string& kind, int size,
+  int classes, unsigned seed)
+{
+  rt::memory_raster<int> raster(size, size);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> category(0, classes - 1);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  int* cell = raster.data();
+  if (kind == "random") {
+    for (std::size_t i = 0; i < raster.size(); ++i) {
+      cell[i] = category(rng);
+    }
+  }
+  else if (kind == "clustered") {
+    const int patch = 32;
+    const int patches = (size + patch - 1) / patch;
+    std::vector<int> coarse(static_cast<std::size_t>(patches) * patches);
+    for (auto&& i : coarse) {
+      i = category(rng);
+    }
+    for (int r = 0; r < size; ++r) {
+      for (int c = 0; c < size; ++c) {
+        *cell++ = uniform(rng) < 0.05 ? category(rng)
+          : coarse[static_cast<std::size_t>(r / patch) * patches + c / patch];
+      }
+    }
+  }
+  else if (kind == "sparse") {
+    std::uniform_int_distribution<int> target(1, std::max(1, classes - 1));
+    for (std::size_t i = 0; i < raster.size(); ++i) {
+      cell[i] = classes > 1 && uniform(rng) < 0.001 ? target(rng) : 0;
+    }
+  }
+  else {
+    throw std::invalid_argument("unknown input kind: " + kind);
+  }
+  return raster;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Options
+//
+struct options
+{
+  options()
+    : sizes{ 1000, 2000, 5000, 10000, 20000 }
+    , classes{ 2, 8, 16, 64 }
+    , inputs{ "random", "clustered", "sparse" }
+    , threads(0), max_memory_gb(8), repeat(1), seed(2016)
+    , distance_transform(true), fuzzy_kappa(true)
+  {
+  }
+
+  std::vector<int> sizes;
+  std::vector<int> classes;
+  std::vector<std::string> inputs;
+  int threads;          // for the parallel runs, 0 is all hardware threads
+  double max_memory_gb; // cases estimated to need more are skipped
+  int repeat;           // the fastest of repeated runs is reported
+  unsigned seed;
+  bool distance_transform;
+  bool fuzzy_kappa;
+};
+
+template<class T>
+std::vector<T> parse_list(const std::string& text)
+{
+  std::vector<T> result;
+  std::istringstream in(text);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    std::istringstream item_in(item);
+    T value;
+    if (!(item_in >> value)) {
+      throw std::invalid_argument("invalid list: " + text);
+    }
+    result.push_back(value);
+  }
+  return result;
+}
+
+void print_usage()
+{
+  std::cerr <<
+    "benchmark [options] > results.json\n"
+    "  --sizes 1000,2000    rows = columns of the rasters\n"
+    "  --classes 2,8        number of categories\n"
+    "  --inputs random,clustered,sparse\n"
+    "  --threads N          threads for the parallel runs, 0 is all\n"
+    "  --max-memory-gb X    skip cases estimated to need more memory\n"
+    "  --repeat N           report the fastest of N runs\n"
+    "  --seed N             seed of the synthetic inputs\n"
+    "  --only distance_transform | fuzzy_kappa\n";
+}
+
+bool parse_options(int argc, char* argv[], options& opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--help") {
+      print_usage();
+      return false;
+    }
+    if (i + 1 == argc) {
+      throw std::invalid_argument("missing value for " + arg);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--sizes") opts.sizes = parse_list<int>(value);
+    else if (arg == "--classes") opts.classes = parse_list<int>(value);
+    else if (arg == "--inputs") opts.inputs = parse_list<std::string>(value);
+    else if (arg == "--threads") opts.threads = std::stoi(value);
+    else if (arg == "--max-memory-gb") opts.max_memory_gb = std::stod(value);
+    else if (arg == "--repeat") opts.repeat = std::max(1, std::stoi(value));
+    else if (arg == "--seed") opts.seed = static_cast<unsigned>(std::stoul(value));
+    else if (arg == "--only") {
+      if (value != "distance_transform" && value != "fuzzy_kappa") {
+        throw std::invalid_argument("invalid value for --only: " + value);
+      }
+      opts.distance_transform = value == "distance_transform";
+      opts.fuzzy_kappa = value == "fuzzy_kappa";
+    }
+    else {
+      throw std::invalid_argument("unknown option " + arg);
+    }
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON output, one object per case
+//
+class json_writer
+{
+public:
+  json_writer(std::ostream& out) : m_out(out), m_first(true)
+  {
+  }
+
+  void begin(const options& opts)
+  {
+    m_out << "{\n  \"hardware_threads\": "
+      << rt::parallel_execution().threads()
+      << ",\n  \"parallel_threads\": "
+      << rt::parallel_execution(opts.threads).threads()
+      << ",\n  \"seed\": " << opts.seed
+      << ",\n  \"repeat\": " << opts.repeat
+      << ",\n  \"cases\": [";
+  }
+
+  void add(const std::string& record)
+  {
+    m_out << (m_first ? "\n    " : ",\n    ") << record;
+    m_out.flush();
+    m_first = false;
+  }
+
+  void end()
+  {
+    m_out << "\n  ]\n}\n";
+  }
+
+private:
+  std::ostream& m_out;
+  bool m_first;
+};
+
+struct phase
+{
+  std::string name;
+  double seconds;
+};
+
+std::string case_record(const std::string& benchmark, const std::string&
+  variant, const std::string& execution, const std::string& input, int size,
+  int classes, const std::vector<phase>& phases, double result,
+  std::uint64_t rss)
+{
+  double total = 0;
+  for (auto&& p : phases) total += p.seconds;
+  const double cells = static_cast<double>(size) * size;
+  std::ostringstream out;
+  out.precision(9);
+  out << "{\"benchmark\": \"" << benchmark << "\", \"variant\": \"" << variant
+    << "\", \"execution\": \"" << execution << "\", \"input\": \"" << input
+    << "\", \"size\": " << size << ", \"cells\": " << cells
+    << ", \"classes\": " << classes << ", \"seconds\": " << total
+    << ", \"cells_per_second\": " << (total > 0 ? cells / total : 0)
+    << ", \"peak_rss_bytes\": " << rss << ", \"phases\": {";
+  for (std::size_t i = 0; i < phases.size(); ++i) {
+    out << (i ? ", \"" : "\"") << phases[i].name << "\": "
+      << phases[i].seconds;
+  }
+  out << "}, \"result\": " << result << "}";
+  return out.str();
+}
+
+std::string skipped_record(const std::string& benchmark,
+  const std::string& input, int size, int classes, double gb)
+{
+  std::ostringstream out;
+  out << "{\"benchmark\": \"" << benchmark << "\", \"input\": \"" << input
+    << "\", \"size\": " << size << ", \"classes\": " << classes
+    << ", \"skipped\": \"estimated " << gb << " GB\"}";
+  return out.str();
+}
+
+// Keep the fastest run of each phase
+void keep_fastest(std::vector<phase>& best, const std::vector<phase>& run)
+{
+  if (best.empty()) {
+    best = run;
+    return;
+  }
+  for (std::size_t i = 0; i < best.size(); ++i) {
+    best[i].seconds = std::min(best[i].seconds, run[i].seconds);
+  }
+}
+
+// The phases recorded in stats
+std::vector<phase> recorded_phases(const rt::phase_stats& stats)
+{
+  std::vector<phase> phases;
+  for (int p = 0; p < rt::number_of_phases; ++p) {
+    const rt::phase id = static_cast<rt::phase>(p);
+    if (stats[id].m_calls > 0) {
+      phases.push_back({ rt::phase_name(id), stats[id].m_seconds });
+    }
+  }
+  return phases;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Distance transform to category 1, in the two phases of the method
+//
+template<class Out, class Method, class Execution>
+std::vector<phase> time_distance_transform(const rt::memory_raster<int>& in,
+  Out& out, const Method&, const Execution& exec, double& result)
+{
+  rt::phase_stats stats;
+  rt::distance_transform(in, out, 1, Method{}, exec, stats);
+  result = static_cast<double>(out.data()[out.size() / 2]);
+  return recorded_phases(stats);
+}
+
+template<class Out, class Method>
+void run_distance_transform(json_writer& json, const options& opts,
+  const std::string& variant, const Method& method,
+  const rt::memory_raster<int>& in, const std::string& input, int classes)
+{
+  const int size = static_cast<int>(in.size1());
+  const rt::parallel_execution parallel(opts.threads);
+  for (int t = 0; t < 2; ++t) {
+    if (t == 1 && parallel.threads() == 1) break;
+    reset_peak_rss();
+    std::vector<phase> best;
+    double result = 0;
+    for (int rep = 0; rep < opts.repeat; ++rep) {
+      Out out(size, size);
+      keep_fastest(best, t == 0
+        ? time_distance_transform(in, out, method, rt::serial_execution{},
+          result)
+        : time_distance_transform(in, out, method, parallel, result));
+    }
+    json.add(case_record("distance_transform", variant,
+      t == 0 ? "serial" : "parallel", input, size, classes, best, result,
+      peak_rss_bytes()));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Fuzzy Kappa with the identity similarity matrix and exponential decay
+//
+template<class... Execution>
+std::vector<phase> time_fuzzy_kappa(const rt::memory_raster<int>& mapA,
+  const rt::memory_raster<int>& mapB, const rt::memory_raster<int>& mask,
+  int classes, double& result, const Execution&... exec)
+{
+  rt::matrix<double> m(classes, std::vector<double>(classes, 0));
+  for (int i = 0; i < classes; ++i) {
+    m[i][i] = 1;
+  }
+  rt::memory_raster<double> comparison(static_cast<int>(mapA.size1()),
+    static_cast<int>(mapA.size2()));
+  rt::phase_stats stats;
+  rt::fuzzy_kappa_2009(mapA, mapB, mask, classes, classes, m,
+    rt::exponential_decay(2.0, 0.001), comparison, rt::memory_raster_maker{},
+    exec..., stats, result);
+  return recorded_phases(stats);
+}
+
+void run_fuzzy_kappa(json_writer& json, const options& opts,
+  const rt::memory_raster<int>& mapA, const rt::memory_raster<int>& mapB,
+  const rt::memory_raster<int>& mask, const std::string& input, int classes)
+{
+  const int size = static_cast<int>(mapA.size1());
+  const rt::parallel_execution parallel(opts.threads);
+  for (int t = 0; t < 2; ++t) {
+    if (t == 1 && parallel.threads() == 1) break;
+    reset_peak_rss();
+    std::vector<phase> best;
+    double result = 0;
+    for (int rep = 0; rep < opts.repeat; ++rep) {
+      keep_fastest(best, t == 0
+        ? time_fuzzy_kappa(mapA, mapB, mask, classes, result)
+        : time_fuzzy_kappa(mapA, mapB, mask, classes, result, parallel));
+    }
+    json.add(case_record("fuzzy_kappa_2009", "exponential_decay",
+      t == 0 ? "serial" : "parallel", input, size, classes, best, result,
+      peak_rss_bytes()));
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  options opts;
+  try {
+    if (!parse_options(argc, argv, opts)) return 0;
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    print_usage();
+    return 1;
+  }
+
+  json_writer json(std::cout);
+  json.begin(opts);
+  const double gb = 1024.0 * 1024.0 * 1024.0;
+  for (auto&& input : opts.inputs) {
+    for (auto&& size : opts.sizes) {
+      for (auto&& classes : opts.classes) {
+        const double cells = static_cast<double>(size) * size;
+        std::cerr << input << " " << size << "^2 " << classes << " classes"
+          << std::endl;
+
+        // Estimated memory: the input maps as int, the distance transform
+        // output as double and the Fuzzy Kappa layers and comparison map.
+        const double dt_gb = cells * (sizeof(int) + sizeof(double)) / gb;
+        const double fk_gb = cells * (3 * sizeof(int)
+          + (2 * classes + 1) * sizeof(double)) / gb;
+        const bool run_dt = opts.distance_transform
+          && dt_gb <= opts.max_memory_gb;
+        const bool run_fk = opts.fuzzy_kappa && fk_gb <= opts.max_memory_gb;
+        if (opts.distance_transform && !run_dt) {
+          json.add(skipped_record("distance_transform", input, size, classes,
+            dt_gb));
+        }
+        if (opts.fuzzy_kappa && !run_fk) {
+          json.add(skipped_record("fuzzy_kappa_2009", input, size, classes,
+            fk_gb));
+        }
+        if (!run_dt && !run_fk) continue;
+
+        const rt::memory_raster<int> mapA = make_input(input, size, classes,
+          opts.seed);
+        if (run_dt) {
+          run_distance_transform<rt::memory_raster<double> >(json, opts,
+            "euclidean", rt::euclidean_non_squared{}, mapA, input, classes);
+          run_distance_transform<rt::memory_raster<double> >(json, opts,
+            "euclidean_squared", rt::euclidean_squared{}, mapA, input,
+            classes);
+          run_distance_transform<rt::memory_raster<double> >(json, opts,
+            "manhattan", rt::manhattan{}, mapA, input, classes);
+          run_distance_transform<rt::memory_raster<double> >(json, opts,
+            "chessboard", rt::chessboard{}, mapA, input, classes);
+        }
+        if (run_fk) {
+          const rt::memory_raster<int> mapB = make_input(input, size,
+            classes, opts.seed + 1);
+          rt::memory_raster<int> mask(size, size);
+          std::fill(mask.begin(), mask.end(), 1);
+          run_fuzzy_kappa(json, opts, mapA, mapB, mask, input, classes);
+        }
+      }
+    }
+  }
+  json.end();
+  return 0;
+}
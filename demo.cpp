@@ -65,7 +65,7 @@ int demo_fuzzy_kappa()
     m,    // parameter: categorical similarity matrix
     blink::raster_tools::exponential_decay{ 2.0 },    // parameter: distance decay function
     out, // result: similarity map
-    blink::raster_tools::gdal_raster_maker{}, // RasterMaker::raster<T> r = maker.create<T>(model)
+    blink::raster_tools::memory_raster_maker{}, // RasterMaker::raster<T> r = maker.create<T>(model)
     fuzzykappa);
 
   std::cout << "Fuzzy Kappa " << fuzzykappa << std::endl;
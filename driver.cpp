@@ -0,0 +1,648 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Batch driver for Fuzzy Kappa comparisons. The jobs are read from a
+// manifest and run concurrently by a fixed number of workers in a single
+// process, so that GDAL is initialized once and each input raster is read
+// once, however many jobs use it. The Fuzzy Kappa and timings of each job
+// are written to a summary file. Run with --help for the options.
+//
+// The manifest has a section per job, keys in the [defaults] section apply
+// to all jobs that do not set them. Relative paths are relative to the
+// manifest. Lines starting with # or ; are comments.
+//
+//   [defaults]
+//   categories = 4
+//   decay = exponential 2.0
+//
+//   [map1_vs_map3]
+//   map1 = map1.rst
+//   map2 = map3.rst
+//   mask = region.rst          (optional, all cells by default)
+//   categories1 = 4            (categories sets both legends)
+//   categories2 = 4
+//   matrix = similarity.txt    (optional, identity by default)
+//   decay = exponential 2.0 0.001  (halving distance, optional threshold)
+//   decay = one_neighbour 0.5      (similarity at distance 1)
+//   output = fk.tif            (optional, the similarity map)
+//
+// A matrix file holds categories1 rows of categories2 values, separated by
+// white space.
+//
+// Inputs are copied into memory when first needed and kept until the last
+// job that uses them has finished. Calls into GDAL are serialized, the
+// comparisons themselves run in parallel.
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster/utility.h>
+
+#include <gdal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+
+////////////////////////////////////////////////////////////////////////////////
+// Jobs
+//
+struct decay_spec
+{
+  std::string kind; // exponential or one_neighbour
+  double first;     // halving distance, or value at distance 1
+  double second;    // threshold of exponential decay
+};
+
+struct job
+{
+  std::string name;
+  std::string map1;
+  std::string map2;
+  std::string mask;   // empty for all cells
+  int categories1;
+  int categories2;
+  std::string matrix; // empty for the identity matrix
+  decay_spec decay;
+  std::string output; // empty for no similarity map
+};
+
+std::string trim(const std::string& s)
+{
+  const std::size_t first = s.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) return "";
+  const std::size_t last = s.find_last_not_of(" \t\r\n");
+  return s.substr(first, last - first + 1);
+}
+
+bool is_absolute(const std::string& path)
+{
+  return (!path.empty() && (path[0] == '/' || path[0] == '\\'))
+    || (path.size() > 1 && path[1] == ':');
+}
+
+std::string resolve(const std::string& directory, const std::string& path)
+{
+  if (path.empty() || directory.empty() || is_absolute(path)) return path;
+  return directory + "/" + path;
+}
+
+decay_spec parse_decay(const std::string& text)
+{
+  std::istringstream in(text);
+  decay_spec decay{ "", 0, 0 };
+  if (!(in >> decay.kind >> decay.first)) {
+    throw std::invalid_argument("invalid decay: " + text);
+  }
+  if (decay.kind == "exponential") {
+    in >> decay.second; // the threshold is optional
+  }
+  else if (decay.kind != "one_neighbour") {
+    throw std::invalid_argument("unknown decay: " + decay.kind);
+  }
+  return decay;
+}
+
+int parse_categories(const std::string& key, const std::string& text)
+{
+  std::istringstream in(text);
+  int n;
+  if (!(in >> n) || n < 1) {
+    throw std::invalid_argument("invalid " + key + ": " + text);
+  }
+  return n;
+}
+
+// The job from the keys of its section, completed by the defaults
+job make_job(const std::string& name,
+  const std::map<std::string, std::string>& keys,
+  const std::map<std::string, std::string>& defaults,
+  const std::string& directory)
+{
+  auto get = [&](const std::string& key) {
+    auto i = keys.find(key);
+    if (i != keys.end()) return i->second;
+    i = defaults.find(key);
+    return i != defaults.end() ? i->second : std::string();
+  };
+  auto require = [&](const std::string& key) {
+    const std::string value = get(key);
+    if (value.empty()) {
+      throw std::invalid_argument("job " + name + ": missing " + key);
+    }
+    return value;
+  };
+
+  job j;
+  j.name = name;
+  j.map1 = resolve(directory, require("map1"));
+  j.map2 = resolve(directory, require("map2"));
+  j.mask = resolve(directory, get("mask"));
+  const std::string categories = get("categories");
+  const std::string categories1 = get("categories1");
+  const std::string categories2 = get("categories2");
+  j.categories1 = parse_categories("categories1",
+    categories1.empty() ? categories : categories1);
+  j.categories2 = parse_categories("categories2",
+    categories2.empty() ? categories : categories2);
+  j.matrix = resolve(directory, get("matrix"));
+  j.decay = parse_decay(require("decay"));
+  j.output = resolve(directory, get("output"));
+  return j;
+}
+
+std::vector<job> read_manifest(const std::string& path)
+{
+  std::ifstream in(path.c_str());
+  if (!in) {
+    throw std::runtime_error("Cannot open manifest " + path);
+  }
+  const std::size_t slash = path.find_last_of("/\\");
+  const std::string directory = slash == std::string::npos ? ""
+    : path.substr(0, slash);
+
+  std::vector<std::pair<std::string, std::map<std::string, std::string> > >
+    sections;
+  std::map<std::string, std::string> defaults;
+  std::map<std::string, std::string>* current = nullptr;
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+    if (line[0] == '[') {
+      if (line.back() != ']') {
+        throw std::invalid_argument(path + ":" + std::to_string(number)
+          + ": invalid section");
+      }
+      const std::string name = trim(line.substr(1, line.size() - 2));
+      if (name == "defaults") {
+        current = &defaults;
+      }
+      else {
+        sections.emplace_back(name, std::map<std::string, std::string>());
+        current = &sections.back().second;
+      }
+      continue;
+    }
+    const std::size_t equals = line.find('=');
+    if (equals == std::string::npos || current == nullptr) {
+      throw std::invalid_argument(path + ":" + std::to_string(number)
+        + ": expected key = value in a section");
+    }
+    (*current)[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+  }
+
+  std::vector<job> jobs;
+  for (auto&& section : sections) {
+    jobs.push_back(make_job(section.first, section.second, defaults,
+      directory));
+  }
+  return jobs;
+}
+
+rt::matrix<double> read_matrix(const std::string& path, int rows, int cols)
+{
+  rt::matrix<double> m(rows, std::vector<double>(cols, 0));
+  if (path.empty()) {
+    for (int i = 0; i < std::min(rows, cols); ++i) {
+      m[i][i] = 1;
+    }
+    return m;
+  }
+  std::ifstream in(path.c_str());
+  if (!in) {
+    throw std::runtime_error("Cannot open matrix " + path);
+  }
+  for (auto&& row : m) {
+    for (auto&& value : row) {
+      if (!(in >> value)) {
+        throw std::runtime_error("Matrix " + path + " has fewer than "
+          + std::to_string(rows) + " x " + std::to_string(cols) + " values");
+      }
+    }
+  }
+  return m;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Inputs shared between jobs. The first job to ask for a raster reads it,
+// others wait for it. A raster that fails to load fails all its jobs.
+// Only the cells are kept: the dataset is closed under the GDAL mutex 
+// after reading, as GDAL objects must not be destroyed by whichever thread 
+// happens to drop the last reference.
+//
+struct input
+{
+  rt::memory_raster<int> cells;
+  int min_value;
+  int max_value;
+};
+
+class input_cache
+{
+public:
+  explicit input_cache(std::mutex& gdal_mutex) : m_gdal_mutex(gdal_mutex)
+  {
+  }
+
+  // Count the jobs that will use the raster, before running them
+  void expect(const std::string& path)
+  {
+    ++m_uses[path];
+  }
+
+  std::shared_ptr<const input> acquire(const std::string& path)
+  {
+    std::shared_ptr<std::promise<std::shared_ptr<const input> > > loader;
+    std::shared_future<std::shared_ptr<const input> > result;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto i = m_entries.find(path);
+      if (i == m_entries.end()) {
+        loader = std::make_shared<std::promise<std::shared_ptr<const input> > >();
+        i = m_entries.emplace(path, loader->get_future().share()).first;
+      }
+      result = i->second;
+    }
+    if (loader) {
+      try {
+        loader->set_value(load(path));
+      }
+      catch (...) {
+        loader->set_exception(std::current_exception());
+      }
+    }
+    return result.get();
+  }
+
+  // The raster is dropped after the last expected job released it
+  void release(const std::string& path)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_uses[path] == 0) {
+      m_entries.erase(path);
+    }
+  }
+
+private:
+  std::shared_ptr<const input> load(const std::string& path)
+  {
+    auto result = std::make_shared<input>();
+    {
+      std::lock_guard<std::mutex> lock(m_gdal_mutex);
+      auto raster = blink::raster::open_gdal_raster<int>(path, GA_ReadOnly);
+      const int rows = static_cast<int>(raster.size1());
+      const int cols = static_cast<int>(raster.size2());
+      if (rows == 0 || cols == 0) {
+        throw std::runtime_error("Cannot open raster " + path);
+      }
+      result->cells = rt::memory_raster<int>(rows, cols);
+      int* cell = result->cells.data();
+      for (auto&& i : raster) {
+        *cell++ = i;
+      }
+    } // closes the dataset while holding the lock
+    const auto range = std::minmax_element(result->cells.begin(),
+      result->cells.end());
+    result->min_value = *range.first;
+    result->max_value = *range.second;
+    return result;
+  }
+
+  std::mutex& m_gdal_mutex;
+  std::mutex m_mutex;
+  std::map<std::string, int> m_uses;
+  std::map<std::string, std::shared_future<std::shared_ptr<const input> > >
+    m_entries;
+};
+
+// A use of an input by a job, expected by the cache. The input is read when
+// first asked for and the use is released when the job is done, also if it
+// fails before it got to the input.
+class input_lease
+{
+public:
+  input_lease(input_cache& cache, const std::string& path)
+    : m_cache(cache), m_path(path)
+  {
+  }
+
+  input_lease(const input_lease&) = delete;
+  input_lease& operator=(const input_lease&) = delete;
+
+  ~input_lease()
+  {
+    if (!m_path.empty()) m_cache.release(m_path);
+  }
+
+  const input& get()
+  {
+    if (!m_input) m_input = m_cache.acquire(m_path);
+    return *m_input;
+  }
+
+private:
+  input_cache& m_cache;
+  std::string m_path;
+  std::shared_ptr<const input> m_input;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Running a job
+//
+struct job_result
+{
+  job_result() : status("error"), fuzzy_kappa(0), load_seconds(0),
+    run_seconds(0), write_seconds(0)
+  {
+  }
+
+  std::string status; // ok, undefined (no cells or identical maps) or error
+  double fuzzy_kappa;
+  double load_seconds;
+  double run_seconds;
+  double write_seconds;
+  std::string message;
+};
+
+struct options
+{
+  options() : workers(0), threads(1), summary("summary.csv")
+  {
+  }
+
+  std::string manifest;
+  int workers;         // concurrent jobs, 0 is all hardware threads
+  int threads;         // threads per job
+  std::string summary;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+void check_categories(const input& map, const std::string& path,
+  int categories)
+{
+  if (map.min_value < 0 || map.max_value >= categories) {
+    throw std::runtime_error(path + " has values outside 0 .. "
+      + std::to_string(categories - 1));
+  }
+}
+
+template<class DistanceDecay>
+bool compare(const input& mapA, const input& mapB,
+  rt::memory_raster<int>& mask, const job& j, const rt::matrix<double>& m,
+  const DistanceDecay& f, rt::memory_raster<double>& comparison,
+  int threads, double& fuzzy_kappa)
+{
+  rt::memory_raster<int> a = mapA.cells; // shares the cells
+  rt::memory_raster<int> b = mapB.cells;
+  if (threads > 1) {
+    return rt::fuzzy_kappa_2009(a, b, mask, j.categories1, j.categories2, m,
+      f, comparison, rt::memory_raster_maker{},
+      rt::parallel_execution(threads), fuzzy_kappa);
+  }
+  return rt::fuzzy_kappa_2009(a, b, mask, j.categories1, j.categories2, m, f,
+    comparison, rt::memory_raster_maker{}, fuzzy_kappa);
+}
+
+job_result run_job(const job& j, input_cache& cache, std::mutex& gdal_mutex,
+  int threads)
+{
+  job_result result;
+  try {
+    input_lease lease_a(cache, j.map1);
+    input_lease lease_b(cache, j.map2);
+    input_lease lease_mask(cache, j.mask);
+    auto start = std::chrono::steady_clock::now();
+    const input& mapA = lease_a.get();
+    const input& mapB = lease_b.get();
+    const int rows = static_cast<int>(mapA.cells.size1());
+    const int cols = static_cast<int>(mapA.cells.size2());
+    if (mapB.cells.size1() != mapA.cells.size1()
+      || mapB.cells.size2() != mapA.cells.size2()) {
+      throw std::runtime_error(j.map1 + " and " + j.map2
+        + " differ in size");
+    }
+    check_categories(mapA, j.map1, j.categories1);
+    check_categories(mapB, j.map2, j.categories2);
+    rt::memory_raster<int> mask;
+    if (j.mask.empty()) {
+      mask = rt::memory_raster<int>(rows, cols);
+      std::fill(mask.begin(), mask.end(), 1);
+    }
+    else {
+      mask = lease_mask.get().cells; // shares the cells
+      if (mask.size1() != mapA.cells.size1()
+        || mask.size2() != mapA.cells.size2()) {
+        throw std::runtime_error(j.mask + " differs in size from " + j.map1);
+      }
+    }
+    const rt::matrix<double> m = read_matrix(j.matrix, j.categories1,
+      j.categories2);
+    result.load_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    rt::memory_raster<double> comparison(rows, cols);
+    const bool defined = j.decay.kind == "exponential"
+      ? compare(mapA, mapB, mask, j, m,
+        j.decay.second > 0
+          ? rt::exponential_decay(j.decay.first, j.decay.second)
+          : rt::exponential_decay(j.decay.first),
+        comparison, threads, result.fuzzy_kappa)
+      : compare(mapA, mapB, mask, j, m, rt::one_neighbour(j.decay.first),
+        comparison, threads, result.fuzzy_kappa);
+    result.run_seconds = seconds_since(start);
+
+    if (!j.output.empty()) {
+      start = std::chrono::steady_clock::now();
+      {
+        // map1 is opened again for its georeference; both datasets are
+        // closed before the lock is released
+        std::lock_guard<std::mutex> lock(gdal_mutex);
+        auto model = blink::raster::open_gdal_raster<int>(j.map1,
+          GA_ReadOnly);
+        auto out = blink::raster::create_gdal_raster_from_model<double>(
+          j.output, model);
+        std::copy(comparison.begin(), comparison.end(), out.begin());
+      }
+      result.write_seconds = seconds_since(start);
+    }
+    result.status = defined ? "ok" : "undefined";
+  }
+  catch (const std::exception& e) {
+    result.status = "error";
+    result.message = e.what();
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Summary, one CSV line per job in the order in which they finish
+//
+std::string csv_field(const std::string& text)
+{
+  std::string result = "\"";
+  for (auto&& c : text) {
+    if (c == '"') result += '"';
+    result += c == '\n' ? ' ' : c;
+  }
+  return result + "\"";
+}
+
+class summary_writer
+{
+public:
+  explicit summary_writer(const std::string& path) : m_out(path.c_str())
+  {
+    if (!m_out) {
+      throw std::runtime_error("Cannot create summary " + path);
+    }
+    m_out.precision(10);
+    m_out << "index,job,status,fuzzy_kappa,load_seconds,run_seconds,"
+      "write_seconds,message\n";
+  }
+
+  void add(int index, const job& j, const job_result& result)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_out << index << "," << csv_field(j.name) << "," << result.status << ","
+      << result.fuzzy_kappa << "," << result.load_seconds << ","
+      << result.run_seconds << "," << result.write_seconds << ","
+      << csv_field(result.message) << "\n";
+    m_out.flush(); // keep the finished jobs if the batch is interrupted
+  }
+
+private:
+  std::ofstream m_out;
+  std::mutex m_mutex;
+};
+
+void print_usage()
+{
+  std::cerr <<
+    "driver manifest [options]\n"
+    "  --workers N    jobs that run at the same time, 0 is all hardware "
+    "threads\n"
+    "  --threads N    threads per job\n"
+    "  --summary path summary file, summary.csv by default\n";
+}
+
+bool parse_options(int argc, char* argv[], options& opts)
+{
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--help") {
+      print_usage();
+      return false;
+    }
+    if (arg.compare(0, 2, "--") != 0) {
+      opts.manifest = arg;
+      continue;
+    }
+    if (i + 1 == argc) {
+      throw std::invalid_argument("missing value for " + arg);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--workers") opts.workers = std::stoi(value);
+    else if (arg == "--threads") opts.threads = std::max(1, std::stoi(value));
+    else if (arg == "--summary") opts.summary = value;
+    else {
+      throw std::invalid_argument("unknown option " + arg);
+    }
+  }
+  if (opts.manifest.empty()) {
+    throw std::invalid_argument("no manifest");
+  }
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  options opts;
+  std::vector<job> jobs;
+  try {
+    if (!parse_options(argc, argv, opts)) return 0;
+    jobs = read_manifest(opts.manifest);
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    print_usage();
+    return 1;
+  }
+
+  GDALAllRegister(); // once for all jobs
+
+  std::mutex gdal_mutex;
+  input_cache cache(gdal_mutex);
+  for (auto&& j : jobs) {
+    cache.expect(j.map1);
+    cache.expect(j.map2);
+    if (!j.mask.empty()) cache.expect(j.mask);
+  }
+
+  std::unique_ptr<summary_writer> summary;
+  try {
+    summary.reset(new summary_writer(opts.summary));
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  const int n = static_cast<int>(jobs.size());
+  const int workers = std::max(1, std::min(n,
+    rt::parallel_execution(opts.workers).threads()));
+  std::atomic<int> next(0);
+  std::atomic<int> failed(0);
+  std::mutex log_mutex;
+  auto worker = [&]() {
+    for (int i = next++; i < n; i = next++) {
+      const job_result result = run_job(jobs[i], cache, gdal_mutex,
+        opts.threads);
+      summary->add(i, jobs[i], result);
+      if (result.status == "error") ++failed;
+      std::lock_guard<std::mutex> lock(log_mutex);
+      std::cerr << jobs[i].name << ": " << result.status << " "
+        << result.fuzzy_kappa << " (" << result.load_seconds
+        + result.run_seconds + result.write_seconds << " s)"
+        << (result.message.empty() ? "" : " " + result.message) << std::endl;
+    }
+  };
+
+  // The jobs are handed out one at a time, so that a long job does not
+  // hold up others
+  std::vector<std::thread> pool;
+  for (int i = 1; i < workers; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker(); // the main thread is one of the workers
+  for (auto&& t : pool) {
+    t.join();
+  }
+  std::cerr << n - failed << " of " << n << " jobs completed" << std::endl;
+  return failed > 0 ? 2 : 0;
+}
@@ -0,0 +1,296 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// The distance transform for rasters that are stored in blocks, such as
+// tiled GeoTIFFs. The plain transform goes through the raster by rows and
+// then back, and each row touches all blocks of a row of blocks. With a
+// block cache smaller than a row of blocks, blocks are read and written
+// many times. Here the column phase goes by strips of one block wide and
+// the row phase by rows of blocks. Between the phases, the column distances
+// are kept in a column store, by strips. They are transposed into rows of
+// blocks for the row phase. Every block of the input is read once and
+// every block of the output is written once.
+//
+// The column store holds an int per cell. It is kept in memory, or in a
+// temporary file for rasters that do not fit. Apart from the store, the
+// transform needs memory for one block and for a row of blocks.
+
+#ifndef BLINK_RASTER_TOOLS_BLOCKED_DISTANCE_TRANSFORM_H_AHZ
+#define BLINK_RASTER_TOOLS_BLOCKED_DISTANCE_TRANSFORM_H_AHZ
+
+#include <blink/raster_tools/distance_transform.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The size of the blocks of a raster, as given by GDALGetBlockSize.
+    //
+    struct block_layout
+    {
+      block_layout(int rows = 256, int cols = 256) : m_rows(rows), m_cols(cols)
+      {
+      }
+
+      int m_rows;
+      int m_cols;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Execution policy for the distance transform of rasters in blocks. The
+    // blocks should be those of the input and output rasters. With
+    // out_of_core the column distances are kept in a temporary file.
+    //
+    class blocked_execution
+    {
+    public:
+      blocked_execution(block_layout blocks = block_layout(),
+        bool out_of_core = false)
+        : m_blocks(blocks), m_out_of_core(out_of_core)
+      {
+      }
+
+      block_layout m_blocks;
+      bool m_out_of_core;
+    };
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // The column distances between the two phases. Strip s holds the
+      // columns [s * strip_width, (s + 1) * strip_width) of all rows, row by
+      // row, so a range of rows of a strip is contiguous.
+      //
+      class column_store
+      {
+      public:
+        column_store(int rows, int cols, int strip_width, bool out_of_core)
+          : m_rows(rows), m_cols(cols), m_strip_width(strip_width)
+          , m_file(nullptr, &std::fclose)
+        {
+          const std::size_t n = static_cast<std::size_t>(rows) * cols;
+          if (out_of_core) {
+            m_file.reset(std::tmpfile());
+            if (!m_file) {
+              throw std::runtime_error("Cannot create a temporary file for "
+                "the distance transform");
+            }
+          }
+          else {
+            m_memory.resize(n);
+          }
+        }
+
+        int width(int strip) const
+        {
+          return std::min(m_strip_width, m_cols - strip * m_strip_width);
+        }
+
+        void write(int strip, int r_begin, int r_end, const int* data)
+        {
+          const std::size_t n = count(strip, r_begin, r_end);
+          if (!m_file) {
+            std::copy(data, data + n, &m_memory[offset(strip, r_begin)]);
+            return;
+          }
+          seek(strip, r_begin);
+          if (std::fwrite(data, sizeof(int), n, m_file.get()) != n) {
+            throw std::runtime_error("Cannot write the temporary file of the "
+              "distance transform");
+          }
+        }
+
+        void read(int strip, int r_begin, int r_end, int* data)
+        {
+          const std::size_t n = count(strip, r_begin, r_end);
+          if (!m_file) {
+            const int* first = &m_memory[offset(strip, r_begin)];
+            std::copy(first, first + n, data);
+            return;
+          }
+          seek(strip, r_begin);
+          if (std::fread(data, sizeof(int), n, m_file.get()) != n) {
+            throw std::runtime_error("Cannot read the temporary file of the "
+              "distance transform");
+          }
+        }
+
+      private:
+        std::size_t count(int strip, int r_begin, int r_end) const
+        {
+          return static_cast<std::size_t>(r_end - r_begin) * width(strip);
+        }
+
+        std::size_t offset(int strip, int r) const
+        {
+          return static_cast<std::size_t>(strip) * m_strip_width * m_rows
+            + static_cast<std::size_t>(r) * width(strip);
+        }
+
+        void seek(int strip, int r)
+        {
+          const std::uint64_t position =
+            static_cast<std::uint64_t>(offset(strip, r)) * sizeof(int);
+#if defined(_WIN32)
+          const int failed = _fseeki64(m_file.get(),
+            static_cast<__int64>(position), SEEK_SET);
+#else
+          const int failed = fseeko(m_file.get(),
+            static_cast<off_t>(position), SEEK_SET);
+#endif
+          if (failed) {
+            throw std::runtime_error("Cannot seek in the temporary file of "
+              "the distance transform");
+          }
+        }
+
+        int m_rows;
+        int m_cols;
+        int m_strip_width;
+        std::vector<int> m_memory;
+        std::unique_ptr<std::FILE, int(*)(std::FILE*)> m_file;
+      };
+
+      // First phase for one strip: down the strip block by block, keeping
+      // the distance of the row above in carry, and then back up through
+      // the store. Return false if target is not present in the strip.
+      template<class InRaster>
+      bool blocked_column_phase(const InRaster& in,
+        const blink::raster::raster_traits::value_type<InRaster>& target,
+        column_store& store, int strip, int rows, int cols,
+        int block_rows, int strip_width, int inf, std::vector<int>& block,
+        std::vector<int>& carry)
+      {
+        using in_type = blink::raster::raster_traits::value_type<InRaster>;
+        const int c_begin = strip * strip_width;
+        const int width = store.width(strip);
+        bool has_target = false;
+
+        std::fill(carry.begin(), carry.begin() + width, inf);
+        for (int r_begin = 0; r_begin < rows; r_begin += block_rows) {
+          const int r_end = std::min(rows, r_begin + block_rows);
+          int* d = block.data();
+          for (int r = r_begin; r < r_end; ++r) {
+            auto a = in.begin()
+              + (static_cast<std::size_t>(r) * cols + c_begin);
+            for (int c = 0; c < width; ++c, ++a, ++d) {
+              if (static_cast<in_type>(*a) == target) {
+                *d = 0;
+                has_target = true;
+              }
+              else {
+                *d = carry[c] == inf ? inf : carry[c] + 1;
+              }
+              carry[c] = *d;
+            }
+          }
+          store.write(strip, r_begin, r_end, block.data());
+        }
+
+        std::fill(carry.begin(), carry.begin() + width, inf);
+        const int last = ((rows - 1) / block_rows) * block_rows;
+        for (int r_begin = last; r_begin >= 0; r_begin -= block_rows) {
+          const int r_end = std::min(rows, r_begin + block_rows);
+          store.read(strip, r_begin, r_end, block.data());
+          for (int r = r_end - r_begin - 1; r >= 0; --r) { // going back
+            int* d = block.data() + r * width;
+            for (int c = 0; c < width; ++c, ++d) {
+              if (*d > carry[c] + 1) {
+                *d = carry[c] + 1;
+              }
+              carry[c] = *d;
+            }
+          }
+          store.write(strip, r_begin, r_end, block.data());
+        }
+        return has_target;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Distance transform going through in and out by blocks, see the top of
+    // this file. The result is identical to that of the other versions.
+    // Return false if target is not present in raster, true otherwise
+    //
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, const blocked_execution& exec)
+    {
+      using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      if (rows == 0 || cols == 0) return false;
+      const int inf = rows + cols;
+      const int block_rows = std::max(1, std::min(rows, exec.m_blocks.m_rows));
+      const int block_cols = std::max(1, std::min(cols, exec.m_blocks.m_cols));
+      const int strips = (cols + block_cols - 1) / block_cols;
+
+      detail::column_store store(rows, cols, block_cols, exec.m_out_of_core);
+      std::vector<int> block(static_cast<std::size_t>(block_rows) * block_cols);
+      std::vector<int> carry(block_cols);
+      bool has_target = false;
+      for (int s = 0; s < strips; ++s) {
+        if (detail::blocked_column_phase(in, target, store, s, rows, cols,
+          block_rows, block_cols, inf, block, carry)) {
+          has_target = true;
+        }
+      }
+
+      // Second phase by rows of blocks, transposed from the strips
+      const std::size_t row_of_blocks = static_cast<std::size_t>(block_rows)
+        * cols;
+      std::vector<int> columns(row_of_blocks);
+      std::vector<out_type> result(row_of_blocks);
+      distance_transform_workspace workspace(rows, cols);
+      std::vector<int>& g = workspace.m_g;
+      g.resize(cols);
+      for (int r_begin = 0; r_begin < rows; r_begin += block_rows) {
+        const int r_end = std::min(rows, r_begin + block_rows);
+        for (int s = 0; s < strips; ++s) {
+          const int width = store.width(s);
+          store.read(s, r_begin, r_end, block.data());
+          for (int r = 0; r < r_end - r_begin; ++r) {
+            std::copy(&block[r * width], &block[r * width] + width,
+              &columns[static_cast<std::size_t>(r) * cols + s * block_cols]);
+          }
+        }
+        for (int r = 0; r < r_end - r_begin; ++r) {
+          const int* row = &columns[static_cast<std::size_t>(r) * cols];
+          for (int c = 0; c < cols; ++c) {
+            g[cols - 1 - c] = row[c]; // in reverse, as in process_line
+          }
+          detail::process_line(g, workspace,
+            result.begin() + static_cast<std::size_t>(r) * cols, inf,
+            Method{});
+        }
+        for (int s = 0; s < strips; ++s) {
+          const int c_begin = s * block_cols;
+          const int width = store.width(s);
+          for (int r = r_begin; r < r_end; ++r) {
+            auto first = result.begin()
+              + (static_cast<std::size_t>(r - r_begin) * cols + c_begin);
+            std::copy(first, first + width, out.begin()
+              + (static_cast<std::size_t>(r) * cols + c_begin));
+          }
+        }
+      }
+      return has_target;
+    }
+  }
+}
+#endif
@@ -8,15 +8,24 @@
 //=======================================================================
 //
 // This implements the distance transform method by Meijster. 
-// The method is very amenable to parallelization. 
-// But not done here..
+// The method is very amenable to parallelization. Passing a 
+// parallel_execution policy splits the first phase over column strips and 
+// the second phase over rows.
 
 #ifndef BLINK_RASTER_TOOLS_DISTANCE_TRANSFORM_H_AHZ
 #define BLINK_RASTER_TOOLS_DISTANCE_TRANSFORM_H_AHZ
 
 
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster_tools/phase_stats.h>
 #include <blink/raster/raster_traits.h>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
 #include <vector>
 
 
@@ -52,10 +61,13 @@
       {
         return value;
       }
-      int f(int x, int i, std::vector<int>& g, const detail::euclidean&)
+      // Squared distances in 64 bit: g is rows + cols for columns without 
+      // target, whose square exceeds int from rows + cols > 46340.
+      std::int64_t f(int x, int i, std::vector<int>& g, 
+        const detail::euclidean&)
       {
-        const int dx = x - i;
-        const int dy = g[i];
+        const std::int64_t dx = x - i;
+        const std::int64_t dy = g[i];
         return dx * dx + dy * dy;
       }
 
@@ -69,9 +81,15 @@
         return std::max(abs(x - i), g[i]);
       }
 
+      // Also in 64 bit, the result is clamped to int as it only matters 
+      // within the row
       int sep(int i, int u, std::vector<int>& g, int, const detail::euclidean&)
       {
-        return ( (u-i) * (u+i) + (g[u] - g[i]) * (g[u] + g[i] ) ) / (2 * (u - i));
+        const std::int64_t du = u - i;
+        const std::int64_t dg = g[u] - g[i];
+        const std::int64_t w = ( du * (u+i) + dg * (g[u] + g[i] ) ) / (2 * du);
+        const std::int64_t limit = std::numeric_limits<int>::max() - 1;
+        return static_cast<int>(std::max(-limit, std::min(limit, w)));
 
         //return (u*u - i*i + g[u] * g[u] - g[i] * g[i]) / (2 * (u - i));
       }
@@ -96,14 +114,60 @@
         int s;
         int t;
       };
+    }
 
-      template<class T, class ResultIter, class MethodTag>
-      void process_line(std::vector<T>& g, ResultIter& iter, int inf, 
-        const MethodTag&)
+    ////////////////////////////////////////////////////////////////////////////
+    // Buffers for the row phase of the distance transform: the column 
+    // distances of a row (g), the stack of the lower envelope (s and t) and
+    // the buffers of the scans for manhattan and chessboard distances.
+    // Pass the same workspace to a series of transforms to avoid allocating
+    // them per row and per call. The buffers grow as needed, reserve the 
+    // rows and columns of the largest raster to never allocate during a 
+    // transform: the chessboard scan indexes its buffer by distance, up to
+    // rows + cols. A workspace can not be shared between threads.
+    //
+    class distance_transform_workspace
+    {
+    public:
+      distance_transform_workspace()
+      {
+      }
+
+      distance_transform_workspace(int rows, int cols)
+      {
+        reserve(rows, cols);
+      }
+
+      void reserve(int rows, int cols)
+      {
+        const int size = std::max(rows, cols);
+        m_g.reserve(size);
+        m_st.reserve(size);
+        m_h.reserve(size);
+        m_last.reserve(static_cast<std::size_t>(rows) + cols + 1);
+      }
+
+      std::vector<int> m_g;
+      std::vector<detail::st_pair> m_st;
+      std::vector<int> m_h;
+      std::vector<int> m_last; // by distance, grows to the largest distance
+    };
+
+    namespace detail
+    {
+
+      // The lower envelope of the sites of g, into the stack st: site s 
+      // is nearest from column t onwards. The columns u for which 
+      // is_site(u) is false take no part. The stack is empty if there are
+      // no sites.
+      template<class IsSite, class MethodTag>
+      void lower_envelope(std::vector<int>& g, std::vector<st_pair>& st,
+        int inf, IsSite&& is_site, const MethodTag&)
       {
         const int m = static_cast<int>(g.size());
-        std::vector<st_pair> st(1, st_pair(0, 0));
-        for (int u = 1; u < m; ++u) {
+        st.clear();
+        for (int u = 0; u < m; ++u) {
+          if (!is_site(u)) continue;
           while (!st.empty() &&
             f(st.back().t, st.back().s, g, MethodTag{})
         > f(st.back().t, u, g, MethodTag{})){
@@ -119,6 +183,16 @@
             }
           }
         }
+      }
+
+      template<class T, class ResultIter, class MethodTag>
+      void process_line(std::vector<T>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int inf, 
+        const MethodTag&)
+      {
+        const int m = static_cast<int>(g.size());
+        std::vector<st_pair>& st = workspace.m_st;
+        lower_envelope(g, st, inf, [](int) { return true; }, MethodTag{});
         for (int u = m - 1; u >= 0; --u, ++iter) { 
           //++iter because g was in reverse
           *iter = optionally_square_root(f(u, st.back().s, g, MethodTag{}), 
@@ -128,6 +202,387 @@
           }
         }
       }
+
+      // Row phase of the bounded transform. g holds the column distances of a
+      // row in forward order, capped at cap. Sites at the cap are too far to 
+      // matter and take no part in the lower envelope. Cells further than 
+      // radius from all sites get the saturated value. 
+      template<class ResultIter, class MethodTag>
+      void process_line_bounded(std::vector<int>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int cap, 
+        int inf, double radius, double saturated, const MethodTag&)
+      {
+        const int m = static_cast<int>(g.size());
+        std::vector<st_pair>& st = workspace.m_st;
+        lower_envelope(g, st, inf, [&](int u) { return g[u] < cap; }, 
+          MethodTag{});
+        if (st.empty()) { // no sites within reach
+          for (int u = 0; u < m; ++u, ++iter) {
+            *iter = saturated;
+          }
+          return;
+        }
+        std::size_t q = 0;
+        for (int u = 0; u < m; ++u, ++iter) {
+          while (q + 1 < st.size() && st[q + 1].t <= u) {
+            ++q;
+          }
+          const auto d = optionally_square_root(f(u, st[q].s, g, 
+            MethodTag{}), MethodTag{});
+          if (d > radius) {
+            *iter = saturated;
+          }
+          else {
+            *iter = d;
+          }
+        }
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Row phase for manhattan distances. The lower envelope of 
+      // |x - i| + g[i] does not need the stack: it is the minimum of a 
+      // forward and a backward scan that each add 1 per step.
+      //
+      inline void manhattan_scan(const std::vector<int>& g, 
+        std::vector<int>& h)
+      {
+        const int m = static_cast<int>(g.size());
+        h.resize(m);
+        if (m == 0) return; // rows of a raster without columns
+        h[0] = g[0];
+        for (int u = 1; u < m; ++u) {
+          h[u] = std::min(g[u], h[u - 1] + 1);
+        }
+        for (int u = m - 2; u >= 0; --u) {
+          h[u] = std::min(h[u], h[u + 1] + 1);
+        }
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Row phase for chessboard distances, the lower envelope of 
+      // max(|x - i|, g[i]), also by a forward and a backward scan. Going 
+      // forward, if the minimum over i < x is v at x - 1, then at x it is v
+      // if a site with g[i] == v is within v of x, and v + 1 otherwise. 
+      // last[v] is the last site with g[i] == v seen in the scan. Entries 
+      // left by earlier rows are recognised because they are not a site with
+      // g[i] == v in this row. The backward scan is the same in reverse.
+      //
+      inline void chessboard_scan(const std::vector<int>& g, 
+        std::vector<int>& h, std::vector<int>& last)
+      {
+        const int m = static_cast<int>(g.size());
+        h.resize(m);
+        if (m == 0) return; // rows of a raster without columns
+        const int max_g = *std::max_element(g.begin(), g.end());
+        if (static_cast<int>(last.size()) <= max_g) {
+          last.resize(max_g + 1, -1);
+        }
+        int v = g[0];
+        h[0] = v;
+        last[v] = 0;
+        for (int x = 1; x < m; ++x) {
+          const int p = last[v];
+          const bool near = p >= 0 && p < x && p >= x - v && g[p] == v;
+          v = std::min(g[x], near ? v : v + 1);
+          h[x] = v;
+          last[g[x]] = x;
+        }
+        v = g[m - 1];
+        last[v] = m - 1;
+        for (int x = m - 2; x >= 0; --x) {
+          const int p = last[v];
+          const bool near = p > x && p < m && p <= x + v && g[p] == v;
+          v = std::min(g[x], near ? v : v + 1);
+          h[x] = std::min(h[x], v);
+          last[g[x]] = x;
+        }
+      }
+
+      inline void row_scan(const std::vector<int>& g,
+        distance_transform_workspace& workspace, const manhattan&)
+      {
+        manhattan_scan(g, workspace.m_h);
+      }
+
+      inline void row_scan(const std::vector<int>& g,
+        distance_transform_workspace& workspace, const chessboard&)
+      {
+        chessboard_scan(g, workspace.m_h, workspace.m_last);
+      }
+
+      // The row phase for manhattan and chessboard distances, selected over 
+      // the generic version by overload resolution
+      template<class ResultIter>
+      void process_line(std::vector<int>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int, 
+        const manhattan&)
+      {
+        row_scan(g, workspace, manhattan{});
+        const std::vector<int>& h = workspace.m_h;
+        for (int u = static_cast<int>(h.size()) - 1; u >= 0; --u, ++iter) {
+          *iter = h[u]; // g was in reverse
+        }
+      }
+
+      template<class ResultIter>
+      void process_line(std::vector<int>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int, 
+        const chessboard&)
+      {
+        row_scan(g, workspace, chessboard{});
+        const std::vector<int>& h = workspace.m_h;
+        for (int u = static_cast<int>(h.size()) - 1; u >= 0; --u, ++iter) {
+          *iter = h[u]; // g was in reverse
+        }
+      }
+
+      // The bounded row phase by scans. Sites at the cap only give distances
+      // beyond the radius, so they need not be excluded.
+      template<class ResultIter, class MethodTag>
+      void process_line_bounded_scan(std::vector<int>& g,
+        distance_transform_workspace& workspace, ResultIter iter, 
+        double radius, double saturated, const MethodTag&)
+      {
+        row_scan(g, workspace, MethodTag{});
+        const std::vector<int>& h = workspace.m_h;
+        for (std::size_t u = 0; u < h.size(); ++u, ++iter) {
+          if (h[u] > radius) {
+            *iter = saturated;
+          }
+          else {
+            *iter = h[u];
+          }
+        }
+      }
+
+      template<class ResultIter>
+      void process_line_bounded(std::vector<int>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int, int, 
+        double radius, double saturated, const manhattan&)
+      {
+        process_line_bounded_scan(g, workspace, iter, radius, saturated, 
+          manhattan{});
+      }
+
+      template<class ResultIter>
+      void process_line_bounded(std::vector<int>& g, 
+        distance_transform_workspace& workspace, ResultIter iter, int, int,
+        double radius, double saturated, const chessboard&)
+      {
+        process_line_bounded_scan(g, workspace, iter, radius, saturated, 
+          chessboard{});
+      }
+
+      // Cap on the column distances of the bounded transform, any cell 
+      // further than max_radius is at least this far in all metrics
+      inline int bounded_cap(double max_radius, int inf)
+      {
+        const double cap = std::floor(max_radius) + 1;
+        return cap < inf ? static_cast<int>(cap) : inf;
+      }
+
+      // The radius and the saturated value in the units of the method
+      inline double radius_in_units(double radius, const euclidean_squared&)
+      {
+        return radius * radius;
+      }
+
+      template<class Method>
+      double radius_in_units(double radius, const Method&)
+      {
+        return radius;
+      }
+
+      inline double saturated_in_units(int cap, const euclidean_squared&)
+      {
+        return static_cast<double>(cap) * cap;
+      }
+
+      template<class Method>
+      double saturated_in_units(int cap, const Method&)
+      {
+        return cap;
+      }
+
+      template<class InRaster, class OutRaster, class Method>
+      std::vector<bool> bounded_multi_distance_transform(const InRaster& in,
+        std::vector<OutRaster*>& outs,
+        const std::vector<blink::raster::raster_traits::value_type<InRaster> >&
+          targets, double max_radius, const Method&,
+        distance_transform_workspace& workspace)
+      {
+        using in_type = blink::raster::raster_traits::value_type<InRaster>;
+        using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+        using out_iterator = decltype(outs[0]->begin());
+        const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+        const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+        const int n = static_cast<int>(targets.size());
+
+        const int inf = rows + cols;
+        const int cap_int = bounded_cap(max_radius, inf);
+        const out_type cap = static_cast<out_type>(cap_int);
+        const double radius = radius_in_units(max_radius, Method{});
+        const double saturated = saturated_in_units(cap_int, Method{});
+        std::vector<bool> has_target(n, false);
+
+        auto a = in.begin();
+        std::vector<out_iterator> v;
+        for (int k = 0; k < n; ++k) {
+          v.push_back(outs[k]->begin());
+        }
+
+        for (int c = 0; c < cols; ++c, ++a) { // first row
+          const in_type value = static_cast<in_type>(*a);
+          for (int k = 0; k < n; ++k) {
+            if (value == targets[k])
+            {
+              (*v[k]) = 0;
+              has_target[k] = true;
+            }
+            else
+            {
+              (*v[k]) = cap;
+            }
+            ++v[k];
+          }
+        }
+
+        std::vector<out_iterator> u;
+        for (int k = 0; k < n; ++k) {
+          u.push_back(outs[k]->begin());
+        }
+        for (int r = 1; r < rows; ++r) {
+          for (int c = 0; c < cols; ++c, ++a) { // subsequent rows
+            const in_type value = static_cast<in_type>(*a);
+            for (int k = 0; k < n; ++k) {
+              out_type up = *u[k];
+              if (value == targets[k])
+              {
+                (*v[k]) = 0;
+                has_target[k] = true;
+              }
+              else
+              {
+                (*v[k]) = up == cap ? cap : up + 1;
+              }
+              ++u[k];
+              ++v[k];
+            }
+          }
+        }
+
+        const std::ptrdiff_t step = cols; // row offsets may exceed int
+        std::vector<int>& g = workspace.m_g;
+        g.resize(cols);
+        for (int r = rows - 2; r >= 0; --r) {
+          for (int k = 0; k < n; ++k) {
+            auto uk = outs[k]->begin() + ((r + 1) * step - 1);
+            auto vk = outs[k]->begin() + ((r + 2) * step - 1);
+            for (int c = cols - 1; c >= 0; --c, --uk, --vk) { // going back
+              out_type up = (*uk);
+              out_type vp = (*vk);
+              if (up > vp) {
+                (*uk) = vp + 1;
+              }
+              g[c] = detail::round(vp);
+            }
+            detail::process_line_bounded(g, workspace,
+              outs[k]->begin() + (r + 1) * step, cap_int, inf, radius, 
+              saturated, Method{});
+          }
+        }
+        for (int k = 0; k < n; ++k) { //last line
+          auto vk = outs[k]->begin() + (cols - 1);
+          for (int c = cols - 1; c >= 0; --c, --vk) { // going back
+            out_type vp = (*vk);
+            g[c] = detail::round(vp);
+          }
+          detail::process_line_bounded(g, workspace, outs[k]->begin(),
+            cap_int, inf, radius, saturated, Method{});
+        }
+        return has_target;
+      }
+
+      // First phase for the columns [c_begin, c_end): the vertical distance 
+      // to the nearest target in the same column, by a downward and an upward
+      // pass. Return false if target is not present in the strip.
+      template<class InRaster, class OutRaster>
+      bool column_phase(const InRaster& in, OutRaster& out,
+        const blink::raster::raster_traits::value_type<InRaster>& target,
+        const blink::raster::raster_traits::value_type<OutRaster>& inf,
+        int rows, int cols, int c_begin, int c_end)
+      {
+        using in_type = blink::raster::raster_traits::value_type<InRaster>;
+        using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+        const std::ptrdiff_t step = cols; // row offsets may exceed int
+        bool has_target = false;
+
+        auto a = in.begin() + c_begin;
+        auto v = out.begin() + c_begin;
+        for (int c = c_begin; c < c_end; ++c, ++a, ++v) { // first row
+          if (static_cast<in_type>(*a) == target)
+          {
+            (*v) = 0;
+            has_target = true;
+          }
+          else
+          {
+            (*v) = inf;
+          }
+        }
+
+        for (int r = 1; r < rows; ++r) { // subsequent rows
+          a = in.begin() + (r * step + c_begin);
+          auto u = out.begin() + ((r - 1) * step + c_begin);
+          v = out.begin() + (r * step + c_begin);
+          for (int c = c_begin; c < c_end; ++c, ++a, ++u, ++v) {
+            out_type up = *u;
+            if (static_cast<in_type>(*a) == target)
+            {
+              (*v) = 0;
+              has_target = true;
+            }
+            else
+            {
+              (*v) = up == inf ? inf : up + 1;
+            }
+          }
+        }
+
+        for (int r = rows - 2; r >= 0; --r) { // going back
+          auto u = out.begin() + (r * step + c_begin);
+          v = out.begin() + ((r + 1) * step + c_begin);
+          for (int c = c_begin; c < c_end; ++c, ++u, ++v) {
+            out_type up = (*u);
+            out_type vp = (*v);
+            if (up > vp) {
+              (*u) = vp + 1;
+            }
+          }
+        }
+        return has_target;
+      }
+
+      // Second phase for the rows [r_begin, r_end), the rows must have 
+      // been through the first phase.
+      template<class OutRaster, class Method>
+      void row_phase(OutRaster& out, int inf, int cols, int r_begin, 
+        int r_end, const Method&)
+      {
+        const std::ptrdiff_t step = cols; // row offsets may exceed int
+        distance_transform_workspace workspace(
+          static_cast<int>(blink::raster::raster_operations::size1(out)), cols);
+        std::vector<int>& g = workspace.m_g;
+        g.resize(cols);
+        for (int r = r_begin; r < r_end; ++r) {
+          auto v = out.begin() + r * step;
+          for (int c = cols - 1; c >= 0; --c, ++v) {
+            g[c] = detail::round(*v); // in reverse, as in process_line
+          }
+          detail::process_line(g, workspace, out.begin() + r * step, inf,
+            Method{});
+        }
+      }
     }
 
     // Return false if target is not present in raster, true otherwise
@@ -138,6 +593,16 @@
       return distance_transform(in, out, target, euclidean_non_squared{});
     }
     
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Execution>
+    bool euclidean_distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Execution& exec)
+    {
+      return distance_transform(in, out, target, euclidean_non_squared{}, 
+        exec);
+    }
+
     // Return false if target is not present in raster, true otherwise
     template<class InRaster, class OutRaster>
     bool squared_euclidean_distance_transform(const InRaster& in, OutRaster& out
@@ -146,6 +611,16 @@
       return distance_transform(in, out, target, euclidean_squared{});
     }
 
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Execution>
+    bool squared_euclidean_distance_transform(const InRaster& in, 
+      OutRaster& out, 
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Execution& exec)
+    {
+      return distance_transform(in, out, target, euclidean_squared{}, exec);
+    }
+
     // Return false if target is not present in raster, true otherwise
     template<class InRaster, class OutRaster>
     bool manhattan_distance_transform(const InRaster& in, OutRaster& out, 
@@ -154,6 +629,15 @@
       return distance_transform(in, out, target, manhattan{});
     }
 
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Execution>
+    bool manhattan_distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Execution& exec)
+    {
+      return distance_transform(in, out, target, manhattan{}, exec);
+    }
+
     // Return false if target is not present in raster, true otherwise
     template<class InRaster, class OutRaster>
     bool chessboard_distance_transform(const InRaster& in, OutRaster& out,
@@ -162,11 +646,33 @@
       return distance_transform(in, out, target, chessboard{});
     }
 
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Execution>
+    bool chessboard_distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Execution& exec)
+    {
+      return distance_transform(in, out, target, chessboard{}, exec);
+    }
+
     // Return false if target is not present in raster, true otherwise
     template<class InRaster, class OutRaster, class Method>
     bool distance_transform(const InRaster& in, OutRaster& out,
       const blink::raster::raster_traits::value_type<InRaster>& target,
       const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return distance_transform(in, out, target, Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, distance_transform_workspace& workspace)
     {
       bool has_target = false;
       using in_type = blink::raster::raster_traits::value_type<InRaster>;
@@ -210,29 +716,667 @@
         }
       }
 
-      u = out.begin() + ((rows - 1) * cols - 1);
-      v = out.begin() + (rows * cols - 1);
+      const std::ptrdiff_t step = cols; // row offsets may exceed int
+      u = out.begin() + ((rows - 1) * step - 1);
+      v = out.begin() + (rows * step - 1);
 
+      std::vector<int>& g = workspace.m_g;
+      g.resize(cols);
       for (int r = rows - 2; r >= 0; --r) {
-        std::vector<int> g;
         for (int c = 0; c < cols; ++c, --u, --v) { // going back
           out_type up = (*u);
           out_type vp = (*v);
           if (up > vp) {
             (*u) = vp + 1;
           }
-          g.push_back(detail::round(vp)); // will have values conveniently in reverse
+          g[c] = detail::round(vp); // will have values conveniently in reverse
         }
-        detail::process_line(g, out.begin() + (r + 1) * cols, static_cast<int>(inf), Method{});
+        detail::process_line(g, workspace, out.begin() + (r + 1) * step,
+          static_cast<int>(inf), Method{});
       }
-      std::vector<int> g; //last line
-      for (int c = 0; c < cols; ++c, --v) { // going back
+      for (int c = 0; c < cols; ++c, --v) { //last line, going back
         out_type vp = (*v);
-        g.push_back(detail::round(vp)); // will have values conveniently in reverse
+        g[c] = detail::round(vp); // will have values conveniently in reverse
+      }
+      detail::process_line(g, workspace, out.begin(), 
+        static_cast<int>(inf), Method{});
+      return has_target;
+    }
+
+    // Distance transform for several targets in a single sweep: the input is 
+    // read once and the column and row phases are done for all targets 
+    // while the row is in cache. outs[k] receives the distances to 
+    // targets[k] and must be of the same size as in. 
+    // Element k of the result is false if targets[k] is not present in 
+    // raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs,
+      const std::vector<blink::raster::raster_traits::value_type<InRaster> >&
+        targets, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return multi_distance_transform(in, outs, targets, Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs,
+      const std::vector<blink::raster::raster_traits::value_type<InRaster> >&
+        targets, const Method&, distance_transform_workspace& workspace)
+    {
+      using in_type = blink::raster::raster_traits::value_type<InRaster>;
+      using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+      using out_iterator = decltype(outs[0].begin());
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      const int n = static_cast<int>(targets.size());
+
+      const out_type inf = rows + cols;
+      std::vector<bool> has_target(n, false);
+
+      auto a = in.begin();
+      std::vector<out_iterator> v;
+      for (int k = 0; k < n; ++k) {
+        v.push_back(outs[k].begin());
+      }
+
+      for (int c = 0; c < cols; ++c, ++a) { // first row
+        const in_type value = static_cast<in_type>(*a);
+        for (int k = 0; k < n; ++k) {
+          if (value == targets[k])
+          {
+            (*v[k]) = 0;
+            has_target[k] = true;
+          }
+          else
+          {
+            (*v[k]) = inf;
+          }
+          ++v[k];
+        }
+      }
+
+      std::vector<out_iterator> u;
+      for (int k = 0; k < n; ++k) {
+        u.push_back(outs[k].begin());
+      }
+      for (int r = 1; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c, ++a) { // subsequent rows
+          const in_type value = static_cast<in_type>(*a);
+          for (int k = 0; k < n; ++k) {
+            out_type up = *u[k];
+            if (value == targets[k])
+            {
+              (*v[k]) = 0;
+              has_target[k] = true;
+            }
+            else
+            {
+              (*v[k]) = up == inf ? inf : up + 1;
+            }
+            ++u[k];
+            ++v[k];
+          }
+        }
+      }
+
+      const std::ptrdiff_t step = cols; // row offsets may exceed int
+      std::vector<int>& g = workspace.m_g;
+      g.resize(cols);
+      for (int r = rows - 2; r >= 0; --r) {
+        for (int k = 0; k < n; ++k) {
+          auto uk = outs[k].begin() + ((r + 1) * step - 1);
+          auto vk = outs[k].begin() + ((r + 2) * step - 1);
+          for (int c = 0; c < cols; ++c, --uk, --vk) { // going back
+            out_type up = (*uk);
+            out_type vp = (*vk);
+            if (up > vp) {
+              (*uk) = vp + 1;
+            }
+            g[c] = detail::round(vp); // will have values conveniently in reverse
+          }
+          detail::process_line(g, workspace, 
+            outs[k].begin() + (r + 1) * step, static_cast<int>(inf), Method{});
+        }
+      }
+      for (int k = 0; k < n; ++k) { //last line
+        auto vk = outs[k].begin() + (cols - 1);
+        for (int c = 0; c < cols; ++c, --vk) { // going back
+          out_type vp = (*vk);
+          g[c] = detail::round(vp); // will have values conveniently in reverse
+        }
+        detail::process_line(g, workspace, outs[k].begin(), 
+          static_cast<int>(inf), Method{});
       }
-      detail::process_line(g, out.begin(), static_cast<int>(inf), Method{});
       return has_target;
     }
+
+    // Distance transform for all categories 0, 1, .. , number_of_categories - 1 
+    // in a single sweep. outs must hold number_of_categories rasters.
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs, int number_of_categories, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return multi_distance_transform(in, outs, number_of_categories, 
+        Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs, int number_of_categories, const Method&,
+      distance_transform_workspace& workspace)
+    {
+      using in_type = blink::raster::raster_traits::value_type<InRaster>;
+      std::vector<in_type> targets;
+      for (int k = 0; k < number_of_categories; ++k) {
+        targets.push_back(static_cast<in_type>(k));
+      }
+      return multi_distance_transform(in, outs, targets, Method{}, workspace);
+    }
+
+    // Distance transform that only resolves distances up to max_radius. Cells
+    // further away than max_radius get the saturated value floor(max_radius)
+    // + 1, squared for euclidean_squared. Intermediate values never exceed 
+    // the saturated value, so narrow integer output types can be used as long 
+    // as they can hold it. Sites that are too far away take no part in the 
+    // lower envelope and rows without any are filled directly.
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    bool bounded_distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      double max_radius, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return bounded_distance_transform(in, out, target, max_radius, 
+        Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    bool bounded_distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      double max_radius, const Method&, 
+      distance_transform_workspace& workspace)
+    {
+      using in_type = blink::raster::raster_traits::value_type<InRaster>;
+      std::vector<OutRaster*> outs(1, &out);
+      const std::vector<in_type> targets(1, target);
+      return detail::bounded_multi_distance_transform(in, outs, targets,
+        max_radius, Method{}, workspace)[0];
+    }
+
+    // Bounded distance transform for several targets in a single sweep, see
+    // multi_distance_transform and bounded_distance_transform.
+    // Element k of the result is false if targets[k] is not present in 
+    // raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> bounded_multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs,
+      const std::vector<blink::raster::raster_traits::value_type<InRaster> >&
+        targets, double max_radius, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return bounded_multi_distance_transform(in, outs, targets, max_radius,
+        Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> bounded_multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs,
+      const std::vector<blink::raster::raster_traits::value_type<InRaster> >&
+        targets, double max_radius, const Method&, 
+      distance_transform_workspace& workspace)
+    {
+      std::vector<OutRaster*> out_pointers;
+      for (auto&& out : outs) {
+        out_pointers.push_back(&out);
+      }
+      return detail::bounded_multi_distance_transform(in, out_pointers, 
+        targets, max_radius, Method{}, workspace);
+    }
+
+    // Bounded distance transform for all categories 0, 1, .. , 
+    // number_of_categories - 1 in a single sweep. 
+    // outs must hold number_of_categories rasters.
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> bounded_multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs, int number_of_categories, 
+      double max_radius, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return bounded_multi_distance_transform(in, outs, number_of_categories,
+        max_radius, Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    template<class InRaster, class OutRaster, class Method>
+    std::vector<bool> bounded_multi_distance_transform(const InRaster& in,
+      std::vector<OutRaster>& outs, int number_of_categories, 
+      double max_radius, const Method&, 
+      distance_transform_workspace& workspace)
+    {
+      using in_type = blink::raster::raster_traits::value_type<InRaster>;
+      std::vector<in_type> targets;
+      for (int k = 0; k < number_of_categories; ++k) {
+        targets.push_back(static_cast<in_type>(k));
+      }
+      return bounded_multi_distance_transform(in, outs, targets, max_radius,
+        Method{}, workspace);
+    }
+
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, const serial_execution&)
+    {
+      return distance_transform(in, out, target, Method{});
+    }
+
+    namespace detail
+    {
+      // The distance transform by its two phases, each spread over threads.
+      // Progress is counted in columns and rows. If the observer cancels 
+      // the run, the remaining strips and rows are skipped and the result is
+      // false.
+      template<class InRaster, class OutRaster, class Method, class Observer>
+      bool phased_distance_transform(const InRaster& in, OutRaster& out,
+        const blink::raster::raster_traits::value_type<InRaster>& target,
+        const Method&, int threads, Observer& observer)
+      {
+        using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+        const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+        const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+        const std::size_t cells = static_cast<std::size_t>(rows) * cols;
+
+        const out_type inf = rows + cols;
+        work_progress<Observer> progress(observer, 
+          static_cast<std::size_t>(rows) + cols);
+        std::atomic<bool> cancelled(false);
+
+        // Column strips should be wide enough for threads not to share the
+        // cache lines of a row.
+        const int min_strip_width = 64;
+        std::atomic<bool> has_target(false);
+        observer.begin_phase(phase::column_phase);
+        parallel_for(0, cols, threads, min_strip_width,
+          [&](int c_begin, int c_end) {
+          if (cancelled) return;
+          if (column_phase(in, out, target, inf, rows, cols, c_begin,
+            c_end)) {
+            has_target = true;
+          }
+          if (!progress.advance(c_end - c_begin)) cancelled = true;
+        });
+        observer.end_phase(phase::column_phase, cells, 0);
+        if (cancelled) return false;
+
+        observer.begin_phase(phase::row_phase);
+        parallel_for(0, rows, threads, 1, [&](int r_begin, int r_end) {
+          if (cancelled) return;
+          row_phase(out, static_cast<int>(inf), cols, r_begin, r_end, 
+            Method{});
+          if (!progress.advance(r_end - r_begin)) cancelled = true;
+        });
+        observer.end_phase(phase::row_phase, cells, 0);
+        return has_target && !cancelled;
+      }
+    }
+
+    // Return false if target is not present in raster, true otherwise
+    // The result is identical to that of the serial version. Both rasters 
+    // must allow different threads to access different cells at the same 
+    // time, which is the case for in-memory rasters.
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, const parallel_execution& exec)
+    {
+      null_observer observer;
+      return detail::phased_distance_transform(in, out, target, Method{},
+        exec.threads(), observer);
+    }
+
+    // As above, recording the column and row phase in stats. Return false
+    // if target is not present in raster or stats cancelled the run.
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, const parallel_execution& exec, phase_stats& stats)
+    {
+      return detail::phased_distance_transform(in, out, target, Method{},
+        exec.threads(), stats);
+    }
+
+    // As above, on the calling thread
+    template<class InRaster, class OutRaster, class Method>
+    bool distance_transform(const InRaster& in, OutRaster& out,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, const serial_execution&, phase_stats& stats)
+    {
+      return detail::phased_distance_transform(in, out, target, Method{}, 1,
+        stats);
+    }
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // Row phase that also gives the site of the lower envelope of each 
+      // cell. g holds the column distances of a row in forward order.
+      // emit(distance, s) is called for each cell of the row in turn, with
+      // s the column in g of the site of its lower envelope. Manhattan and
+      // chessboard distances use the stack as well, the scans do not keep 
+      // track of sites.
+      //
+      template<class Emit, class MethodTag>
+      void process_line_sites(std::vector<int>& g,
+        distance_transform_workspace& workspace, int inf, Emit&& emit,
+        const MethodTag&)
+      {
+        const int m = static_cast<int>(g.size());
+        std::vector<st_pair>& st = workspace.m_st;
+        lower_envelope(g, st, inf, [](int) { return true; }, MethodTag{});
+        std::size_t q = 0;
+        for (int u = 0; u < m; ++u) {
+          while (q + 1 < st.size() && st[q + 1].t <= u) {
+            ++q;
+          }
+          emit(f(u, st[q].s, g, MethodTag{}), st[q].s);
+        }
+      }
+
+      // First phase of the nearest feature transform. The cells are visited 
+      // once in row-major order from a and is_target(*a) tells the targets.
+      // column, from the start of the output raster, receives the vertical 
+      // distance to the nearest target in the same column and site_rows the
+      // row of that target, -1 if the column has none. Return false if there
+      // are no targets.
+      template<class InIter, class IsTarget, class OutIter>
+      bool feature_column_phase(InIter a, IsTarget&& is_target, int rows,
+        int cols, int inf, OutIter column, std::vector<int>& site_rows)
+      {
+        bool has_target = false;
+        const std::ptrdiff_t step = cols; // row offsets may exceed int
+        site_rows.resize(static_cast<std::size_t>(rows) * cols);
+        std::ptrdiff_t i = 0;
+        for (int r = 0; r < rows; ++r) {
+          for (int c = 0; c < cols; ++c, ++i, ++a) {
+            if (is_target(*a)) {
+              *(column + i) = 0;
+              site_rows[i] = r;
+              has_target = true;
+            }
+            else if (r == 0 || site_rows[i - step] < 0) {
+              *(column + i) = inf;
+              site_rows[i] = -1;
+            }
+            else {
+              *(column + i) = detail::round(*(column + (i - step))) + 1;
+              site_rows[i] = site_rows[i - step];
+            }
+          }
+        }
+        // going back, from the last cell that has a row below
+        for (i = (static_cast<std::ptrdiff_t>(rows) - 1) * step; i-- > 0;) {
+          const int below = detail::round(*(column + (i + step))) + 1;
+          if (detail::round(*(column + i)) > below) {
+            *(column + i) = below;
+            site_rows[i] = site_rows[i + step];
+          }
+        }
+        return has_target;
+      }
+
+      // Second phase of the nearest feature transform for row r, whose 
+      // column distances start at column. emit(distance, index) is called 
+      // for each cell of the row in turn, with index the row * cols + col of
+      // its nearest target, as a std::ptrdiff_t, or -1 if there is none. 
+      // emit may overwrite the column distances of the row.
+      template<class ColumnIter, class Emit, class Method>
+      void feature_row_phase(ColumnIter column,
+        const std::vector<int>& site_rows, int r, int cols, int inf,
+        distance_transform_workspace& workspace, Emit&& emit, const Method&)
+      {
+        std::vector<int>& g = workspace.m_g;
+        const std::size_t first = static_cast<std::size_t>(r) * cols;
+        g.resize(cols);
+        for (int c = 0; c < cols; ++c, ++column) {
+          g[c] = detail::round(*column);
+        }
+        const int* rows_of_sites = &site_rows[first];
+        process_line_sites(g, workspace, inf, [&](std::int64_t d, int s) {
+          emit(d, rows_of_sites[s] < 0 ? std::ptrdiff_t(-1)
+            : static_cast<std::ptrdiff_t>(rows_of_sites[s]) * cols + s);
+        }, Method{});
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Distance transform that also gives the nearest target of each cell, 
+    // found in the same pass from the sites of the lower envelope. nearest
+    // receives the index row * cols + col of the nearest target, ties are 
+    // broken arbitrarily. If target is not present, nearest is -1 
+    // throughout. For rasters of more than 2^31 cells, nearest needs a 64 
+    // bit value type to hold the index. The first phase keeps the column 
+    // distances in out, as distance_transform does, and the rows of their 
+    // targets in a buffer of the size of the raster. 
+    // Return false if target is not present in raster, true otherwise
+    //
+    template<class InRaster, class OutRaster, class IndexRaster, 
+      class Method>
+    bool nearest_feature_transform(const InRaster& in, OutRaster& out,
+      IndexRaster& nearest,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return nearest_feature_transform(in, out, nearest, target, Method{},
+        workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    // Return false if target is not present in raster, true otherwise
+    template<class InRaster, class OutRaster, class IndexRaster, 
+      class Method>
+    bool nearest_feature_transform(const InRaster& in, OutRaster& out,
+      IndexRaster& nearest,
+      const blink::raster::raster_traits::value_type<InRaster>& target,
+      const Method&, distance_transform_workspace& workspace)
+    {
+      using in_type = blink::raster::raster_traits::value_type<InRaster>;
+      using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+      using index_type = blink::raster::raster_traits::value_type<IndexRaster>;
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      const int inf = rows + cols;
+
+      std::vector<int> site_rows;
+      const bool has_target = detail::feature_column_phase(in.begin(),
+        [&](const in_type& value) { return value == target; }, 
+        rows, cols, inf, out.begin(), site_rows);
+
+      auto v = out.begin();
+      auto w = nearest.begin();
+      for (int r = 0; r < rows; ++r) {
+        detail::feature_row_phase(v, site_rows, r, cols, inf, workspace,
+          [&](std::int64_t d, std::ptrdiff_t index) {
+          *v = static_cast<out_type>(detail::optionally_square_root(d, 
+            Method{}));
+          *w = static_cast<index_type>(index);
+          ++v;
+          ++w;
+        }, Method{});
+      }
+      return has_target;
+    }
+
+    namespace detail
+    {
+      // The category of a cell, -1 if it is outside 0, 1, .. ,
+      // number_of_categories - 1
+      template<class T>
+      int category_of(const T& value, int number_of_categories)
+      {
+        const int k = static_cast<int>(value);
+        return k >= 0 && k < number_of_categories
+          && static_cast<double>(value) == k ? k : -1;
+      }
+
+      // First phase of the nearest other category, for all categories at
+      // once. The cells are visited once in row-major order from a.
+      // categories receives the category of each cell and site_rows the row
+      // of the nearest cell of another category in the same column, -1 if
+      // the column has none. Return false if the map is a single category.
+      template<class InIter>
+      bool other_category_column_phase(InIter a, int number_of_categories,
+        int rows, int cols, std::vector<int>& categories,
+        std::vector<int>& site_rows)
+      {
+        const std::size_t step = static_cast<std::size_t>(cols);
+        categories.resize(static_cast<std::size_t>(rows) * step);
+        site_rows.resize(categories.size());
+        bool uniform = true;
+        std::size_t i = 0;
+        for (int r = 0; r < rows; ++r) {
+          for (int c = 0; c < cols; ++c, ++i, ++a) {
+            categories[i] = category_of(*a, number_of_categories);
+            uniform = uniform && categories[i] == categories[0];
+            if (r == 0) {
+              site_rows[i] = -1;
+            }
+            else if (categories[i - step] != categories[i]) {
+              site_rows[i] = r - 1;
+            }
+            else {
+              site_rows[i] = site_rows[i - step];
+            }
+          }
+        }
+        // going back, from the last cell that has a row below. The nearest
+        // cell below is the cell below, if it is another category, or else
+        // the nearest cell below of the cell below.
+        for (int r = rows - 2; r >= 0; --r) {
+          for (int c = cols - 1; c >= 0; --c) {
+            i = static_cast<std::size_t>(r) * step + c;
+            const int below = categories[i + step] != categories[i] ? r + 1
+              : site_rows[i + step] > r ? site_rows[i + step] : -1;
+            if (below >= 0
+              && (site_rows[i] < 0 || below - r < r - site_rows[i])) {
+              site_rows[i] = below;
+            }
+          }
+        }
+        return !uniform || categories.empty() || categories[0] < 0;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // For a categorical map with categories 0, 1, .. , 
+    // number_of_categories - 1: the distance to the nearest cell of another
+    // category, and the category of that cell. The first phase is one pass
+    // for all categories: the nearest cell of another category in the same
+    // column. The second phase takes one lower envelope per run of a
+    // category in the row, over the columns within reach of the run. Cells
+    // outside the range of categories count as another category for all
+    // cells, but are left unchanged themselves. Cells nearest to such a
+    // cell, or without another category in the map, get label -1. The
+    // first phase keeps the categories and the rows of the nearest cells in
+    // two buffers of the size of the raster.
+    // Return false if there is a category without another category in the 
+    // map, true otherwise.
+    //
+    template<class InRaster, class OutRaster, class LabelRaster, 
+      class Method>
+    bool nearest_other_category(const InRaster& in, OutRaster& out,
+      LabelRaster& labels, int number_of_categories, const Method&)
+    {
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      distance_transform_workspace workspace(rows, cols);
+      return nearest_other_category(in, out, labels, number_of_categories,
+        Method{}, workspace);
+    }
+
+    // As above, with the buffers of the workspace
+    template<class InRaster, class OutRaster, class LabelRaster, 
+      class Method>
+    bool nearest_other_category(const InRaster& in, OutRaster& out,
+      LabelRaster& labels, int number_of_categories, const Method&,
+      distance_transform_workspace& workspace)
+    {
+      using out_type = blink::raster::raster_traits::value_type<OutRaster>;
+      using label_type = blink::raster::raster_traits::value_type<LabelRaster>;
+      const int rows = static_cast<int>(blink::raster::raster_operations::size1(in));
+      const int cols = static_cast<int>(blink::raster::raster_operations::size2(in));
+      const int inf = rows + cols;
+
+      std::vector<int> categories;
+      std::vector<int> site_rows;
+      const bool all_found = detail::other_category_column_phase(in.begin(),
+        number_of_categories, rows, cols, categories, site_rows);
+
+      // A run of cells of category k in a row has another category in the
+      // row just before and just after it, where the run does not start or
+      // end the row. Sites further along the row are further from all cells
+      // of the run, so the lower envelope of the run only needs its own 
+      // columns and the one at either end. The runs of a row together take
+      // at most twice the row. Cells of another category are their own site.
+      std::vector<int>& g = workspace.m_g;
+      for (int r = 0; r < rows; ++r) {
+        const std::ptrdiff_t first = static_cast<std::ptrdiff_t>(r) * cols;
+        const int* row = categories.data() + first;
+        const int* row_sites = site_rows.data() + first;
+        for (int begin = 0, end = 0; begin < cols; begin = end) {
+          const int k = row[begin];
+          while (end < cols && row[end] == k) ++end;
+          if (k < 0) continue;
+          const int lo = std::max(0, begin - 1);
+          const int hi = std::min(cols, end + 1);
+          g.resize(hi - lo);
+          for (int c = lo; c < hi; ++c) {
+            g[c - lo] = row[c] != k ? 0
+              : row_sites[c] < 0 ? inf : std::abs(row_sites[c] - r);
+          }
+          auto v = out.begin() + first + lo;
+          auto w = labels.begin() + first + lo;
+          int c = lo;
+          detail::process_line_sites(g, workspace, inf, 
+            [&](std::int64_t d, int s) {
+            if (c >= begin && c < end) {
+              const int site = lo + s;
+              *v = static_cast<out_type>(detail::optionally_square_root(d,
+                Method{}));
+              *w = static_cast<label_type>(row[site] != k ? row[site]
+                : row_sites[site] < 0 ? -1
+                : categories[static_cast<std::size_t>(row_sites[site])
+                  * cols + site]);
+            }
+            ++c;
+            ++v;
+            ++w;
+          }, Method{});
+        }
+      }
+      return all_found;
+    }
   }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,417 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Distributions of similarity values, as used by Fuzzy Kappa, and the
+// expected minimum of two of them.
+
+#ifndef BLINK_RASTER_TOOLS_DISTRIBUTION_H_AHZ
+#define BLINK_RASTER_TOOLS_DISTRIBUTION_H_AHZ
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>    // maps are used to create distributions
+#include <utility>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+    typedef std::map<double, int, std::greater<double> > distribution;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Exact distribution as a contiguous list of (value, count) pairs, ordered
+    // from high to low value like the std::map based distribution. Values are
+    // appended unsorted and only sorted and merged into the list in batches,
+    // so adding an observation is a push_back instead of a tree insertion.
+    // Removals are batched in the same way. Call compact() before reading 
+    // values(); it also releases the buffers of the batches. Values are 
+    // stored as Key, a float key halves the memory of the pending values at
+    // the cost of rounding the values. Counts are 64 bit, as a distribution
+    // may see more than 2^31 cells.
+    //
+    template<class Key>
+    class basic_flat_distribution
+    {
+    public:
+      typedef std::pair<Key, std::int64_t> value_count;
+
+      basic_flat_distribution() : m_compact_at(min_batch)
+      {
+      }
+
+      // Compacted distribution with the pairs of values and counts of
+      // values(), from high to low value, to restore a stored distribution
+      explicit basic_flat_distribution(std::vector<value_count> values)
+        : m_values(std::move(values))
+        , m_compact_at(std::max<std::size_t>(min_batch, 2 * m_values.size()))
+      {
+      }
+
+      void add(double value)
+      {
+        m_pending.push_back(static_cast<Key>(value));
+        if (m_pending.size() >= m_compact_at) merge_pending();
+      }
+
+      // Remove an observation that was added before
+      void remove(double value)
+      {
+        m_removed.push_back(static_cast<Key>(value));
+        if (m_removed.size() >= m_compact_at) merge_pending();
+      }
+
+      // Add all observations of another distribution
+      void merge(const basic_flat_distribution& other)
+      {
+        m_pending.insert(m_pending.end(), other.m_pending.begin(),
+          other.m_pending.end());
+        m_removed.insert(m_removed.end(), other.m_removed.begin(),
+          other.m_removed.end());
+        merge_sorted(other.m_values);
+        if (m_pending.size() >= m_compact_at) merge_pending();
+      }
+
+      // Sort the pending values and merge them into the list. The buffers 
+      // of pending values are released, so that a compacted distribution 
+      // only takes the memory of its list.
+      void compact()
+      {
+        merge_pending();
+        std::vector<Key>().swap(m_pending);
+        std::vector<Key>().swap(m_removed);
+      }
+
+      // Pairs of values and counts, from high to low value
+      const std::vector<value_count>& values() const
+      {
+        return m_values;
+      }
+
+      bool empty() const
+      {
+        return m_values.empty() && m_pending.empty();
+      }
+
+      // Number of (value, count) pairs, after compact()
+      std::size_t size() const
+      {
+        return m_values.size();
+      }
+
+    private:
+      enum { min_batch = 4096 };
+
+      // As compact(), keeping the buffers for the values that follow
+      void merge_pending()
+      {
+        if (m_pending.empty() && m_removed.empty()) return;
+        merge_sorted(runs(m_pending, 1));
+        merge_sorted(runs(m_removed, -1));
+        m_pending.clear();
+        m_removed.clear();
+        m_compact_at = std::max<std::size_t>(min_batch, 2 * m_values.size());
+      }
+
+      // Sort values and count them, with a count of sign for each
+      static std::vector<value_count> runs(std::vector<Key>& values,
+        int sign)
+      {
+        std::sort(values.begin(), values.end(), std::greater<Key>());
+        std::vector<value_count> result;
+        for (auto&& v : values) {
+          if (result.empty() || result.back().first != v) {
+            result.emplace_back(v, sign);
+          }
+          else {
+            result.back().second += sign;
+          }
+        }
+        return result;
+      }
+
+      void merge_sorted(const std::vector<value_count>& runs)
+      {
+        if (runs.empty()) return;
+        std::vector<value_count> merged;
+        merged.reserve(m_values.size() + runs.size());
+        auto i = m_values.begin();
+        auto j = runs.begin();
+        while (i != m_values.end() || j != runs.end()) {
+          if (j == runs.end() || (i != m_values.end() && i->first > j->first)) {
+            merged.push_back(*i++);
+          }
+          else if (i == m_values.end() || j->first > i->first) {
+            merged.push_back(*j++);
+          }
+          else {
+            // Values whose observations were all removed are dropped
+            if (i->second + j->second != 0) {
+              merged.emplace_back(i->first, i->second + j->second);
+            }
+            ++i;
+            ++j;
+          }
+        }
+        m_values.swap(merged);
+      }
+
+      std::vector<Key> m_pending;
+      std::vector<Key> m_removed;
+      std::vector<value_count> m_values;
+      std::size_t m_compact_at;
+    };
+
+    typedef basic_flat_distribution<double> flat_distribution;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Approximate distribution of values in [0,1] as a histogram with a fixed 
+    // number of equal-width bins. Memory does not grow with the number of 
+    // observations. Each bin also keeps the lowest and highest value that 
+    // went in, which gives tight bounds when a bin holds a single value, as 
+    // happens for the common similarities 0 and 1. Values outside [0,1] go 
+    // to the first or last bin.
+    //
+    class histogram_distribution
+    {
+    public:
+      typedef std::pair<double, std::int64_t> value_count;
+
+      histogram_distribution(int bins = 256) : m_counts(bins, 0),
+        m_lowest(bins, std::numeric_limits<double>::infinity()),
+        m_highest(bins, -std::numeric_limits<double>::infinity())
+      {
+      }
+
+      // Histogram with the lower_values() and upper_values() of another
+      // histogram with the same bins, to restore a stored histogram
+      histogram_distribution(int bins, const std::vector<value_count>& lower,
+        const std::vector<value_count>& upper) : histogram_distribution(bins)
+      {
+        for (std::size_t i = 0; i < lower.size(); ++i) {
+          const int b = bin(lower[i].first);
+          m_counts[b] = lower[i].second;
+          m_lowest[b] = lower[i].first;
+          m_highest[b] = upper[i].first;
+        }
+      }
+
+      void add(double value)
+      {
+        const int b = bin(value);
+        ++m_counts[b];
+        if (value < m_lowest[b]) m_lowest[b] = value;
+        if (value > m_highest[b]) m_highest[b] = value;
+      }
+
+      // Remove an observation that was added before. The lowest and highest
+      // value of its bin are kept, as they remain valid bounds, until the 
+      // bin is empty.
+      void remove(double value)
+      {
+        const int b = bin(value);
+        if (--m_counts[b] == 0) {
+          m_lowest[b] = std::numeric_limits<double>::infinity();
+          m_highest[b] = -std::numeric_limits<double>::infinity();
+        }
+      }
+
+      // Add all observations of another histogram with the same bins
+      void merge(const histogram_distribution& other)
+      {
+        for (int b = 0; b < bins(); ++b) {
+          m_counts[b] += other.m_counts[b];
+          m_lowest[b] = std::min(m_lowest[b], other.m_lowest[b]);
+          m_highest[b] = std::max(m_highest[b], other.m_highest[b]);
+        }
+      }
+
+      // For symmetry with flat_distribution, nothing to do
+      void compact()
+      {
+      }
+
+      int bins() const
+      {
+        return static_cast<int>(m_counts.size());
+      }
+
+      // Number of bins, for symmetry with flat_distribution
+      std::size_t size() const
+      {
+        return m_counts.size();
+      }
+
+      // Pairs of values and counts, from high to low value, with each bin 
+      // represented by its lowest value 
+      std::vector<value_count> lower_values() const
+      {
+        return values(m_lowest);
+      }
+
+      // Pairs of values and counts, from high to low value, with each bin 
+      // represented by its highest value 
+      std::vector<value_count> upper_values() const
+      {
+        return values(m_highest);
+      }
+
+    private:
+      int bin(double value) const
+      {
+        const int n = bins();
+        const double scaled = value * n;
+        if (!(scaled >= 0)) return 0;
+        if (scaled >= n - 1) return n - 1;
+        return static_cast<int>(scaled);
+      }
+
+      std::vector<value_count> values(const std::vector<double>& bin_values) 
+        const
+      {
+        std::vector<value_count> result;
+        for (int b = bins() - 1; b >= 0; --b) {
+          if (m_counts[b] > 0) result.emplace_back(bin_values[b], m_counts[b]);
+        }
+        return result;
+      }
+
+      std::vector<std::int64_t> m_counts;
+      std::vector<double> m_lowest;
+      std::vector<double> m_highest;
+    };
+
+    namespace detail
+    {
+      // Iterators go through pairs of values and counts from high to low
+      // value
+      template<class IterA, class IterB>
+      double expected_minimum(IterA iterA, IterA endA, IterB iterB, IterB endB,
+        double totalA, double totalB)
+      {
+        double pCum = 0;         // cumulative probability p(min(A,B) <= x)
+        double sumA = 0;         // intermediate for pCumA
+        double sumB = 0;         // intermediate for pCumB
+        double pCumA = 0;        // cumulative probabilty p(A<=x)
+        double pCumB = 0;        // cumulative probability p(B <=x)
+        double x = 1;            // x
+        double expected = 0;     //Integral of x * p(x) over x
+
+        while (iterA != endA || iterB != endB) {
+          // In order to pass all values in both distributions advance to the
+          // largest next value, except if already at the end of the series
+          if (iterB == endB
+            || (iterA != endA && iterA->first > iterB->first)) {
+            x = iterA->first;
+            sumA += iterA->second;
+            pCumA = sumA / totalA;
+            iterA++;
+          }
+          else {
+            x = iterB->first;
+            sumB += iterB->second;
+            pCumB = sumB / totalB;
+            iterB++;
+          }
+
+          const double pCumPrevious = pCum;
+          pCum = pCumA * pCumB; // p(A>=x AND B>=x )
+          expected += (pCum - pCumPrevious) * x;
+        }
+        return expected;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // This function takes two distribution and returns the expected minimum value
+    // when a number is sampled from both functions
+    //
+    inline double expected_minumum_of_two_distributions(
+      const distribution& distriA, // pairs of values and counts
+      const distribution& distriB,
+      double totalA,               //total count
+      double totalB)
+    {
+      return detail::expected_minimum(distriA.begin(), distriA.end(),
+        distriB.begin(), distriB.end(), totalA, totalB);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, as a linear merge of two flat distributions. Both must have
+    // been compacted.
+    //
+    template<class Key>
+    double expected_minumum_of_two_distributions(
+      const basic_flat_distribution<Key>& distriA, // pairs of values and counts
+      const basic_flat_distribution<Key>& distriB,
+      double totalA,                    //total count
+      double totalB)
+    {
+      return detail::expected_minimum(distriA.values().begin(),
+        distriA.values().end(), distriB.values().begin(),
+        distriB.values().end(), totalA, totalB);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Histogram counterpart of the above. The exact expected minimum of the 
+    // values that went into the histograms lies within error of the returned 
+    // value. The histograms must have the same bins. 
+    //
+    inline double expected_minumum_of_two_distributions(
+      const histogram_distribution& distriA, 
+      const histogram_distribution& distriB,
+      double totalA,                         //total count
+      double totalB,
+      double& error)                         // result: bound on the error
+    {
+      // The expected minimum only increases when values increase, so 
+      // representing each bin by its lowest and highest values brackets it
+      const std::vector<histogram_distribution::value_count> lowA = 
+        distriA.lower_values();
+      const std::vector<histogram_distribution::value_count> lowB =
+        distriB.lower_values();
+      const std::vector<histogram_distribution::value_count> highA =
+        distriA.upper_values();
+      const std::vector<histogram_distribution::value_count> highB =
+        distriB.upper_values();
+      const double low = detail::expected_minimum(lowA.begin(), lowA.end(),
+        lowB.begin(), lowB.end(), totalA, totalB);
+      const double high = detail::expected_minimum(highA.begin(), highA.end(),
+        highB.begin(), highB.end(), totalA, totalB);
+      error = (high - low) / 2;
+      return (low + high) / 2;
+    }
+
+    namespace detail
+    {
+      // Uniform interface for exact and approximate distributions 
+      template<class Key>
+      double expected_minimum_and_error(
+        const basic_flat_distribution<Key>& distriA, 
+        const basic_flat_distribution<Key>& distriB,
+        double totalA, double totalB, double& error)
+      {
+        error = 0;
+        return expected_minumum_of_two_distributions(distriA, distriB, totalA,
+          totalB);
+      }
+
+      inline double expected_minimum_and_error(
+        const histogram_distribution& distriA,
+        const histogram_distribution& distriB,
+        double totalA, double totalB, double& error)
+      {
+        return expected_minumum_of_two_distributions(distriA, distriB, totalA,
+          totalB, error);
+      }
+    }
+  }
+}
+#endif
@@ -13,39 +13,61 @@
 #define BLINK_RASTER_TOOLS_FUZZY_KAPPA_H_AHZ
 
 #include <blink/raster_tools/distance_transform.h>
+#include <blink/raster_tools/distribution.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster_tools/phase_stats.h>
+#include <blink/raster_tools/precision.h>
+#include <blink/raster_tools/simd.h>
 #include <blink/raster/raster_traits.h>
 #include <blink/raster/utility.h>
 
-#include <blink/iterator/range_range.h>
-#include <blink/iterator/zip_range.h>
-
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <vector> // vectors are used to store arrays
-#include <map>    // maps are used to create distributions
 namespace blink {
   namespace raster_tools {
-    typedef std::map<double, int, std::greater<double> > distribution;
-
     template<class T>
     using matrix = std::vector< std::vector<T> >;
 
     ////////////////////////////////////////////////////////////////////////////////
     // Fuzzy Kappa can be based on any distance decay function. The function may 
     // be set by one or more parameters. Therefore it is passed as a functor
+    // A functor may also provide cutoff_radius(), the distance beyond which 
+    // it is 0. Fuzzy Kappa then only resolves distances up to that radius. 
     //
     class exponential_decay 
     {
     public:
-      exponential_decay(double halving) : m_halving(halving)
+      // Similarities below threshold are set to 0, which gives the function 
+      // a finite cutoff radius. By default all similarities are kept.
+      exponential_decay(double halving, double threshold = 0) 
+        : m_halving(halving)
+        , m_cutoff(threshold > 0 
+          ? halving * std::log2(1.0 / threshold)
+          : std::numeric_limits<double>::infinity())
       {
       }
 
       double operator()(double d) const
       {
+        if (d > m_cutoff) return 0;
         return pow(0.5, d / m_halving);
       }
 
+      double cutoff_radius() const
+      {
+        return m_cutoff;
+      }
+
       double m_halving;
+      double m_cutoff;
     };
 
     class one_neighbour
@@ -61,10 +83,33 @@ namespace blink {
         if (d < 1.1) return m_value;
         return 0;
       }
+
+      double cutoff_radius() const
+      {
+        return 1.1;
+      }
+
       double m_value;
 
     };
 
+    namespace detail
+    {
+      // The cutoff radius of a distance decay function, infinite if the 
+      // function does not provide one. Call as cutoff_radius(f, 0).
+      template<class DistanceDecay>
+      auto cutoff_radius(const DistanceDecay& f, int) 
+        -> decltype(static_cast<double>(f.cutoff_radius()))
+      {
+        return f.cutoff_radius();
+      }
+
+      template<class DistanceDecay>
+      double cutoff_radius(const DistanceDecay&, long)
+      {
+        return std::numeric_limits<double>::infinity();
+      }
+    }
 
     class gdal_raster_maker
     {
@@ -80,214 +125,713 @@ namespace blink {
     };
 
     ////////////////////////////////////////////////////////////////////////////////
-    // This function takes two distribution and returns the expected minimum value 
-    // when a number is sampled from both functions
+    // Distribution policies for Fuzzy Kappa. Exact distributions are the 
+    // default. Histograms keep the memory per pair of categories bounded,
+    // at the cost of an approximate expected similarity.
     //
-    double expected_minumum_of_two_distributions(
-      const distribution& distriA, // pairs of values and counts
-      const distribution& distriB,
-      double totalA,               //total count
-      double totalB)
+    struct exact_distributions
     {
-      //std::map::const_reverse_iterator goes through the elements from low to high
-      distribution::const_iterator iterA = distriA.begin();
-      distribution::const_iterator iterB = distriB.begin();
-
-      double pCum = 0;         // cumulative probability p(min(A,B) <= x)
-      double sumA = 0;         // intermediate for pCumA
-      double sumB = 0;         // intermediate for pCumB
-      double pCumA = 0;        // cumulative probabilty p(A<=x)
-      double pCumB = 0;        // cumulative probability p(B <=x)
-      double x = 1;            // x
-      double expected = 0;     //Integral of x * p(x) over x
-
-      while (iterA != distriA.end() || iterB != distriB.end()) {
-        // In order to pass all values in both distributions advance to the 
-        // largest next value, except if already at the end of the series 
-        if (iterB == distriB.end()
-          || (iterA != distriA.end() && iterA->first > iterB->first)) {
-          x = iterA->first;
-          sumA += iterA->second;
-          pCumA = sumA / totalA;
-          iterA++;
-        }
-        else {
-          x = iterB->first;
-          sumB += iterB->second;
-          pCumB = sumB / totalB;
-          iterB++;
-        }
+      typedef flat_distribution distribution_type;
+
+      distribution_type make() const
+      {
+        return distribution_type{};
+      }
+    };
+
+    class histogram_distributions
+    {
+    public:
+      typedef histogram_distribution distribution_type;
+
+      histogram_distributions(int bins = 256) : m_bins(bins)
+      {
+      }
+
+      distribution_type make() const
+      {
+        return distribution_type(m_bins);
+      }
+
+      int m_bins;
+    };
 
-        const double pCumPrevious = pCum;
-        pCum = pCumA * pCumB; // p(A>=x AND B>=x )
-        expected += (pCum - pCumPrevious) * x;
+    namespace detail
+    {
+      // Empty distribution of a policy, exact distributions take the keys of
+      // the precision policy
+      template<class T>
+      basic_flat_distribution<typename precision<T>::key_type> 
+        make_distribution(const exact_distributions&, const precision<T>&)
+      {
+        return basic_flat_distribution<typename precision<T>::key_type>{};
+      }
+
+      template<class T>
+      histogram_distribution make_distribution(
+        const histogram_distributions& histograms, const precision<T>&)
+      {
+        return histograms.make();
       }
-      return expected;
     }
 
     ////////////////////////////////////////////////////////////////////////////////
-    // This is the entry function to calculate Fuzzy Kappa (improved), 
-    // Returns false if there are no cells to compare (Fuzzy Kappa = 0)
-    // Returns false if all cells in both maps are identical (Fuzzy Kappa = 1)
+    // The categorical similarity matrix compiled into lists of its nonzero
+    // entries, per category of map B (column) and per category of map A (row).
+    // Applying it to a cell then costs O(nonzeros) instead of 
+    // O(nCatsA * nCatsB). The identity matrix, for which the similarity is 
+    // simply the decayed distance, is recognized and has its own fast path.
     //
-    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
-    class DistanceDecay, class RasterMaker>
-      bool fuzzy_kappa_2009(
-      RasterA& mapA,              // input: first map
-      RasterB& mapB,              // input: second map
-      RasterMask& mask,           // input: mask map
-      int nCatsA, int nCatsB,     // dimension: number of categories in legends
-      const matrix<double>& m,    // parameter: categorical similarity matrix
-      DistanceDecay f,            // parameter: distance decay function
-      RasterOut& comparison,      // result: similarity map
-      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
-      double& fuzzykappa)         // result: improved fuzzy kappa
+    class sparse_similarity_matrix
     {
-        // for use with std::get
-        using a_value = blink::raster::raster_traits::value_type<RasterA>;
-        using b_value = blink::raster::raster_traits::value_type<RasterB>;
-        using mask_value = blink::raster::raster_traits::value_type<RasterMask>;
-        using out_value = blink::raster::raster_traits::value_type<RasterOut>;
-        using temp_raster = RasterMaker::raster_type<double>;
-
-        // Nearest neighbour distances for all categories in both maps
-        std::vector<temp_raster> distancesA;
-        std::vector<temp_raster> distancesB;
+    public:
+      struct entry
+      {
+        entry(int cat, double value) : cat(cat), value(value)
+        {}
+        int cat;
+        double value;
+      };
+
+      sparse_similarity_matrix(const matrix<double>& m, int nCatsA, int nCatsB)
+        : m_nCatsA(nCatsA), m_nCatsB(nCatsB), m_identity(nCatsA == nCatsB)
+        , m_columns(nCatsB), m_rows(nCatsA)
+      {
         for (int catA = 0; catA < nCatsA; ++catA) {
-          temp_raster temp = maker.create<double>(mapA);
-          bool has_catA = blink::raster_tools::euclidean_distance_transform(mapA, temp, catA);
-          //Apply distance decay function on the distances
-          for (auto&& i : temp){
-            i = has_catA ? f(i) : 0;// similarity for infinite distance is 0
+          for (int catB = 0; catB < nCatsB; ++catB) {
+            const double mAB = m[catA][catB];
+            if (mAB != (catA == catB ? 1 : 0)) m_identity = false;
+            if (mAB != 0) {
+              m_columns[catB].emplace_back(catA, mAB);
+              m_rows[catA].emplace_back(catB, mAB);
+            }
           }
-          distancesA.emplace_back(std::move(temp));
         }
+      }
 
-        for (int catB = 0; catB < nCatsB; catB++) {
-          temp_raster temp = maker.create<double>(mapB);
-          bool has_catB = blink::raster_tools::euclidean_distance_transform(mapB, temp, catB);
-          //Apply distance decay function on the distances
-          for (auto&& i : temp) {
-            i = has_catB ? f(i) : 0;// similarity for infinite distance is 0
+      int m_nCatsA;
+      int m_nCatsB;
+      bool m_identity;
+      std::vector< std::vector<entry> > m_columns; // nonzero m[.][catB]
+      std::vector< std::vector<entry> > m_rows;    // nonzero m[catA][.]
+    };
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // Lookup table of a distance decay function by squared distance, 
+      // table[k] = f(sqrt(k)). Euclidean distances on the grid are square 
+      // roots of integers, so the table gives exactly the values of f, for 
+      // one load per cell instead of a call to f.
+      //
+      template<class DistanceDecay>
+      std::vector<double> decay_table(const DistanceDecay& f, std::size_t size)
+      {
+        std::vector<double> table(size);
+        for (std::size_t k = 0; k < size; ++k) {
+          table[k] = f(std::sqrt(static_cast<double>(k)));
+        }
+        return table;
+      }
+
+      enum { max_decay_table = 1 << 20 }; // squared distances, 8 MB
+
+      // Replace squared distances by their decayed value, using the table
+      // where it reaches
+      template<class Layer, class DistanceDecay>
+      void apply_decay_scalar(Layer& layer, const std::vector<double>& table,
+        const DistanceDecay& f)
+      {
+        const double size = static_cast<double>(table.size());
+        for (auto&& i : layer) {
+          const double k = i;
+          i = k < size ? table[static_cast<std::size_t>(k)] : f(std::sqrt(k));
+        }
+      }
+
+      // As above. The table covers all squared distances in the layer if 
+      // complete is true.
+      template<class Layer, class DistanceDecay>
+      void apply_decay(Layer& layer, const std::vector<double>& table,
+        bool /*complete*/, const DistanceDecay& f)
+      {
+        apply_decay_scalar(layer, table, f);
+      }
+
+      // In-memory layers are processed as one contiguous row of cells
+      template<class DistanceDecay>
+      void apply_decay(memory_raster<double>& layer, 
+        const std::vector<double>& table, bool complete, const DistanceDecay& f)
+      {
+        if (complete) {
+          lookup(layer.data(), layer.size(), table.data(), table.size());
+        }
+        else {
+          apply_decay_scalar(layer, table, f);
+        }
+      }
+
+      template<class Layer>
+      double max_value(const Layer& layer)
+      {
+        double max = 0;
+        for (auto&& i : layer) {
+          if (max < i) max = i;
+        }
+        return max;
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Squared nearest neighbour distances for all categories of a map. The
+      // map is read only once for all its categories. The distances are only
+      // resolved up to the cutoff radius, distances beyond it are at most 
+      // max_squared. Without a cutoff max_squared is the largest distance to
+      // a category that is present.
+      //
+      template<class Raster, class Layer>
+      std::vector<bool> squared_distances(const Raster& map, 
+        std::vector<Layer>& layers, int nCats, double cutoff, 
+        double& max_squared, distance_transform_workspace& workspace)
+      {
+        const int inf = static_cast<int>(
+          blink::raster::raster_operations::size1(map)
+          + blink::raster::raster_operations::size2(map));
+
+        // The radius is widened a little so that no distance that rounds to
+        // within the cutoff is saturated. Distances between the two radii 
+        // decay to 0 anyway.
+        const bool bounded = cutoff < inf;
+        const double radius = cutoff * (1 + 1e-9);
+        const std::vector<bool> has_cat = bounded
+          ? bounded_multi_distance_transform(map, layers, nCats, radius,
+            euclidean_squared{}, workspace)
+          : multi_distance_transform(map, layers, nCats, euclidean_squared{},
+            workspace);
+
+        max_squared = 0;
+        if (bounded) {
+          const double cap = bounded_cap(radius, inf);
+          max_squared = cap * cap;
+        }
+        else {
+          for (int cat = 0; cat < nCats; ++cat) {
+            if (has_cat[cat]) {
+              max_squared = std::max(max_squared, max_value(layers[cat]));
+            }
           }
-          distancesB.emplace_back(std::move(temp));
         }
+        return has_cat;
+      }
 
-        // Apply the categorical similarity matrix. Note that this yields the 
-        // similarity of map A to the categories of map B and vice versa
-        std::vector<temp_raster> similarityA;
-        std::vector<temp_raster> similarityB;
-        for (int catA = 0; catA < nCatsA; ++catA) {
-          auto temp = maker.create<double>(mapB);
-          for (auto&& i : temp) i = 0;
-          similarityB.emplace_back(std::move(temp));
-        }
-        for (int catB = 0; catB < nCatsB; ++catB) {
-          auto temp = maker.create<double>(mapB);
-          for (auto&& i : temp) i = 0;
-          similarityA.emplace_back(std::move(temp));
-        }
-
-        auto multi_similarity_a = blink::iterator::make_range_zip_range(similarityA);
-        auto multi_similarity_b = blink::iterator::make_range_zip_range(similarityB);
-        auto multi_distance_a = blink::iterator::make_range_zip_range(distancesA);
-        auto multi_distance_b = blink::iterator::make_range_zip_range(distancesB);
-        static const int a_index = 0;
-        static const int b_index = 1;
-        static const int mask_index = 2;
-        static const int out_index = 3;
-        static const int sim_a_index = 4;
-        static const int sim_b_index = 5;
-        static const int dist_a_index = 6;
-        static const int dist_b_index = 7;
-
-        auto zip = blink::iterator::make_zip_range(
-          std::ref(mapA), //0
-          std::ref(mapB), //1
-          std::ref(mask), //2
-          std::ref(comparison), //3
-          std::ref(multi_similarity_a), //4
-          std::ref(multi_similarity_b), //5
-          std::ref(multi_distance_a),//6
-          std::ref(multi_distance_b)//7
-          );
-
-        double mean = 0;
-        int count = 0;
-        std::vector< std::vector<distribution> > distributionA(nCatsA,
-          std::vector<distribution>(nCatsB));
-        std::vector< std::vector<distribution> > distributionB(nCatsB,
-          std::vector<distribution>(nCatsA));
-
-        // count number of cell and cells per category in both maps
-        std::vector<int> catCountsA(nCatsA, 0);
-        std::vector<int> catCountsB(nCatsB, 0);
-
-        for (auto&& i : zip) {
-          for (int catA = 0; catA < nCatsA; catA++){
-            for (int catB = 0; catB < nCatsB; catB++){
-              const double mAB = m[catA][catB];
-
-              const double da = std::get<dist_a_index>(i)[catA];
-              const double db = std::get<dist_b_index>(i)[catB];
-              const double simAB = mAB * da;
-              const double simBA = mAB * db;
-
-              const double sa = std::get<sim_a_index>(i)[catB];
-              const double sb = std::get<sim_b_index>(i)[catA];
-
-              if (sa < simAB) std::get<sim_a_index>(i)[catB] = simAB;
-              if (sb < simBA) std::get<sim_b_index>(i)[catA] = simBA;
+      //////////////////////////////////////////////////////////////////////////
+      // Nearest neighbour distances for all categories of a map, followed by 
+      // the distance decay function. The map is read only once for all its 
+      // categories. The distances are only resolved up to the cutoff radius 
+      // of the decay function, if it has one. Progress is counted in rows 
+      // per category. Returns false if the observer cancels the run.
+      //
+      template<class Raster, class Layer, class DistanceDecay, class Observer>
+      bool decayed_distances(const Raster& map, std::vector<Layer>& layers,
+        int nCats, const DistanceDecay& f, 
+        distance_transform_workspace& workspace, 
+        work_progress<Observer>& progress)
+      {
+        const std::size_t rows = blink::raster::raster_operations::size1(map);
+        const std::size_t cells = rows 
+          * blink::raster::raster_operations::size2(map);
+        Observer& observer = progress.observer();
+
+        observer.begin_phase(phase::distance_transform);
+        double max_squared;
+        const std::vector<bool> has_cat = squared_distances(map, layers, 
+          nCats, detail::cutoff_radius(f, 0), max_squared, workspace);
+        observer.end_phase(phase::distance_transform, cells * nCats, 0);
+
+        observer.begin_phase(phase::decay);
+        const bool complete = max_squared < max_decay_table;
+        const std::vector<double> table = decay_table(f, complete
+          ? static_cast<std::size_t>(max_squared) + 1 
+          : static_cast<std::size_t>(max_decay_table));
+
+        //Apply distance decay function on the distances
+        for (int cat = 0; cat < nCats; ++cat) {
+          if (has_cat[cat]) {
+            apply_decay(layers[cat], table, complete, f);
+          }
+          else {
+            for (auto&& i : layers[cat]) {
+              i = 0; // similarity for infinite distance is 0
             }
           }
-          if (std::get<2>(i)) {
-            const a_value catA = std::get<a_index>(i);
-            const b_value catB = std::get<b_index>(i);
-            ++catCountsA[catA];
-            ++catCountsB[catA];
-
-            const double simAB = std::get<sim_a_index>(i)[catB];
-            const double simBA = std::get<sim_b_index>(i)[catA];
-            const double sim = std::min(simAB, simBA);
-            mean += sim;
-            ++count;
-            std::get<out_index>(i) = sim;
-
-            for (int catB = 0; catB < nCatsB; catB++) {
-              const double sim = std::get<sim_a_index>(i)[catB];
-              distributionA[catA][catB][sim]++; // See documentation of std::map
+        }
+        observer.end_phase(phase::decay, cells * nCats, 0);
+        return progress.advance(rows * nCats);
+      }
+
+      template<class Raster, class Layer, class DistanceDecay>
+      void decayed_distances(const Raster& map, std::vector<Layer>& layers,
+        int nCats, const DistanceDecay& f, 
+        distance_transform_workspace& workspace)
+      {
+        null_observer observer;
+        work_progress<null_observer> progress(observer, 0);
+        decayed_distances(map, layers, nCats, f, workspace, progress);
+      }
+
+      template<class Raster, class Layer, class DistanceDecay>
+      void decayed_distances(const Raster& map, std::vector<Layer>& layers,
+        int nCats, const DistanceDecay& f)
+      {
+        distance_transform_workspace workspace;
+        decayed_distances(map, layers, nCats, f, workspace);
+      }
+
+      // Decayed distances in layers of a precision policy. Layers of double
+      // and float can hold the squared distances themselves.
+      template<class Raster, class Layer, class DistanceDecay, 
+      class RasterMaker, class T, class Observer>
+      bool decayed_distances(const Raster& map, std::vector<Layer>& layers,
+        int nCats, const DistanceDecay& f, 
+        distance_transform_workspace& workspace, RasterMaker&, 
+        const precision<T>&, work_progress<Observer>& progress)
+      {
+        return decayed_distances(map, layers, nCats, f, workspace, progress);
+      }
+
+      // Layers of fixed16 can not hold squared distances. The distances are
+      // calculated category by category in a single layer of float, and 
+      // then decayed into the layer of the category.
+      template<class Raster, class Layer, class DistanceDecay, 
+      class RasterMaker, class Observer>
+      bool decayed_distances(const Raster& map, std::vector<Layer>& layers,
+        int nCats, const DistanceDecay& f, 
+        distance_transform_workspace& workspace, RasterMaker& maker,
+        const precision<fixed16>&, work_progress<Observer>& progress)
+      {
+        using in_type = blink::raster::raster_traits::value_type<Raster>;
+        using float_raster = typename RasterMaker::template raster_type<float>;
+        const std::size_t rows = blink::raster::raster_operations::size1(map);
+        const std::size_t cells = rows 
+          * blink::raster::raster_operations::size2(map);
+        const int inf = static_cast<int>(
+          blink::raster::raster_operations::size1(map)
+          + blink::raster::raster_operations::size2(map));
+        Observer& observer = progress.observer();
+
+        // As in squared_distances, but the largest squared distance is not 
+        // known in advance without a cutoff radius
+        const double cutoff = detail::cutoff_radius(f, 0);
+        const bool bounded = cutoff < inf;
+        const double radius = cutoff * (1 + 1e-9);
+        const double cap = bounded ? bounded_cap(radius, inf) : inf;
+        const std::vector<double> table = decay_table(f, 
+          std::min<std::size_t>(static_cast<std::size_t>(cap * cap) + 1,
+          max_decay_table));
+        const double size = static_cast<double>(table.size());
+
+        observer.begin_phase(phase::allocation);
+        std::vector<float_raster> squared;
+        squared.emplace_back(maker.template create<float>(map));
+        observer.end_phase(phase::allocation, 0, cells * sizeof(float));
+        std::vector<in_type> target(1);
+        for (int cat = 0; cat < nCats; ++cat) {
+          observer.begin_phase(phase::distance_transform);
+          target[0] = static_cast<in_type>(cat);
+          const bool has_cat = bounded
+            ? bounded_multi_distance_transform(map, squared, target, radius,
+              euclidean_squared{}, workspace)[0]
+            : multi_distance_transform(map, squared, target, 
+              euclidean_squared{}, workspace)[0];
+          observer.end_phase(phase::distance_transform, cells, 0);
+          observer.begin_phase(phase::decay);
+          auto o = layers[cat].begin();
+          for (auto&& i : squared[0]) {
+            const double k = i;
+            if (!has_cat) {
+              *o = 0.0; // similarity for infinite distance is 0
             }
+            else {
+              *o = k < size ? table[static_cast<std::size_t>(k)] 
+                : f(std::sqrt(k));
+            }
+            ++o;
+          }
+          observer.end_phase(phase::decay, cells, 0);
+          if (!progress.advance(rows)) return false;
+        }
+        return true;
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Concurrent setup of the layers. Each category of each map is a job of
+      // its own: its distance transform, directly followed by the distance
+      // decay or, if the category is absent, by filling the layer with 0.
+      // The jobs share a decay table that covers the largest possible
+      // squared distance, so the layers are the same as those of the serial
+      // setup.
+      //
+      struct decay_plan
+      {
+        bool m_bounded;
+        double m_radius;
+        bool m_complete;
+        std::vector<double> m_table;
+      };
+
+      template<class DistanceDecay>
+      decay_plan make_decay_plan(int rows, int cols, const DistanceDecay& f,
+        int threads)
+      {
+        const int inf = rows + cols;
+        const double cutoff = detail::cutoff_radius(f, 0);
+        decay_plan plan;
+        plan.m_bounded = cutoff < inf;
+        plan.m_radius = cutoff * (1 + 1e-9); // see squared_distances
+        double max_squared;
+        if (plan.m_bounded) {
+          const double cap = bounded_cap(plan.m_radius, inf);
+          max_squared = cap * cap;
+        }
+        else {
+          max_squared = static_cast<double>(rows - 1) * (rows - 1)
+            + static_cast<double>(cols - 1) * (cols - 1);
+        }
+        plan.m_complete = max_squared < max_decay_table;
+        plan.m_table.resize(plan.m_complete
+          ? static_cast<std::size_t>(max_squared) + 1
+          : static_cast<std::size_t>(max_decay_table));
+        double* table = plan.m_table.data();
+        parallel_for(0, static_cast<int>(plan.m_table.size()), threads, 4096,
+          [&](int k_begin, int k_end) {
+          for (int k = k_begin; k < k_end; ++k) {
+            table[k] = f(std::sqrt(static_cast<double>(k)));
+          }
+        });
+        return plan;
+      }
+
+      // The buffers of a thread of the concurrent setup. Layers of fixed16
+      // also need a layer of float for the squared distances.
+      template<class Scratch>
+      struct decay_worker
+      {
+        distance_transform_workspace m_workspace;
+        std::unique_ptr<Scratch> m_scratch;
+      };
+
+      template<class Scratch, class RasterMaker, class Model, class T>
+      void make_scratch(decay_worker<Scratch>&, RasterMaker&, const Model&,
+        const precision<T>&)
+      {
+      }
+
+      template<class Scratch, class RasterMaker, class Model>
+      void make_scratch(decay_worker<Scratch>& worker, RasterMaker& maker,
+        const Model& model, const precision<fixed16>&)
+      {
+        worker.m_scratch.reset(new Scratch(
+          maker.template create<float>(model)));
+      }
+
+      template<class Raster, class Layer>
+      bool squared_distance(const Raster& map, Layer& layer, int cat,
+        const decay_plan& plan, distance_transform_workspace& workspace)
+      {
+        using in_type = blink::raster::raster_traits::value_type<Raster>;
+        const in_type target = static_cast<in_type>(cat);
+        return plan.m_bounded
+          ? bounded_distance_transform(map, layer, target, plan.m_radius,
+            euclidean_squared{}, workspace)
+          : distance_transform(map, layer, target, euclidean_squared{},
+            workspace);
+      }
+
+      // One job: the decayed distances to a single category
+      template<class Raster, class Layer, class DistanceDecay, class Scratch,
+      class T>
+      void decayed_distance(const Raster& map, Layer& layer, int cat,
+        const DistanceDecay& f, const decay_plan& plan,
+        decay_worker<Scratch>& worker, const precision<T>&)
+      {
+        if (squared_distance(map, layer, cat, plan, worker.m_workspace)) {
+          apply_decay(layer, plan.m_table, plan.m_complete, f);
+        }
+        else {
+          for (auto&& i : layer) {
+            i = 0; // similarity for infinite distance is 0
+          }
+        }
+      }
+
+      template<class Raster, class Layer, class DistanceDecay, class Scratch>
+      void decayed_distance(const Raster& map, Layer& layer, int cat,
+        const DistanceDecay& f, const decay_plan& plan,
+        decay_worker<Scratch>& worker, const precision<fixed16>&)
+      {
+        const bool has_cat = squared_distance(map, *worker.m_scratch, cat,
+          plan, worker.m_workspace);
+        const std::vector<double>& table = plan.m_table;
+        const double size = static_cast<double>(table.size());
+        auto o = layer.begin();
+        for (auto&& i : *worker.m_scratch) {
+          const double k = i;
+          if (!has_cat) {
+            *o = 0.0; // similarity for infinite distance is 0
+          }
+          else {
+            *o = k < size ? table[static_cast<std::size_t>(k)]
+              : f(std::sqrt(k));
+          }
+          ++o;
+        }
+      }
+
+      template<class RasterA, class RasterB, class Layer, class DistanceDecay,
+      class RasterMaker, class T, class Observer>
+      bool decayed_distances(const RasterA& mapA, const RasterB& mapB,
+        std::vector<Layer>& layersA, std::vector<Layer>& layersB,
+        int nCatsA, int nCatsB, const DistanceDecay& f, RasterMaker& maker,
+        const precision<T>& prec, const serial_execution&,
+        work_progress<Observer>& progress)
+      {
+        distance_transform_workspace workspace;
+        return decayed_distances(mapA, layersA, nCatsA, f, workspace, maker,
+          prec, progress)
+          && decayed_distances(mapB, layersB, nCatsB, f, workspace, maker, 
+          prec, progress);
+      }
+
+      // No more jobs run at the same time than there are threads, so at most
+      // that many scratch layers are allocated. The maps and layers must
+      // allow access from different threads, as in the parallel cell loop.
+      // The jobs are observed together as the distance_transform phase, 
+      // which then includes the decay.
+      template<class RasterA, class RasterB, class Layer, class DistanceDecay,
+      class RasterMaker, class T, class Observer>
+      bool decayed_distances(const RasterA& mapA, const RasterB& mapB,
+        std::vector<Layer>& layersA, std::vector<Layer>& layersB,
+        int nCatsA, int nCatsB, const DistanceDecay& f, RasterMaker& maker,
+        const precision<T>& prec, const parallel_execution& exec,
+        work_progress<Observer>& progress)
+      {
+        using scratch_raster = typename RasterMaker::template raster_type<float>;
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(mapA));
+        const std::size_t cells = static_cast<std::size_t>(rows) * cols;
+        const int threads = exec.threads();
+        Observer& observer = progress.observer();
+        observer.begin_phase(phase::distance_transform);
+        const decay_plan plan = make_decay_plan(rows, cols, f, threads);
+        std::atomic<bool> cancelled(false);
+
+        // Workers are taken from the pool by the threads as they need them
+        std::vector<std::unique_ptr<decay_worker<scratch_raster> > > workers;
+        std::vector<decay_worker<scratch_raster>*> idle;
+        std::mutex mutex;
 
-            for (int catA = 0; catA < nCatsA; catA++) {
-              const double sim = std::get<sim_b_index>(i)[catA];
-              distributionB[catB][catA][sim]++; // See documentation of std::map
+        parallel_for(0, nCatsA + nCatsB, threads, 1,
+          [&](int j_begin, int j_end) {
+          decay_worker<scratch_raster>* worker;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.empty()) {
+              workers.emplace_back(new decay_worker<scratch_raster>);
+              workers.back()->m_workspace.reserve(rows, cols);
+              make_scratch(*workers.back(), maker, mapA, prec);
+              idle.push_back(workers.back().get());
+            }
+            worker = idle.back();
+            idle.pop_back();
+          }
+          for (int j = j_begin; j < j_end && !cancelled; ++j) {
+            if (j < nCatsA) {
+              decayed_distance(mapA, layersA[j], j, f, plan, *worker, prec);
             }
+            else {
+              decayed_distance(mapB, layersB[j - nCatsA], j - nCatsA, f,
+                plan, *worker, prec);
+            }
+            if (!progress.advance(rows)) cancelled = true;
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          idle.push_back(worker);
+        });
+        std::size_t scratch_bytes = 0;
+        for (auto&& worker : workers) {
+          if (worker->m_scratch) scratch_bytes += cells * sizeof(float);
+        }
+        observer.end_phase(phase::distance_transform, 
+          cells * (nCatsA + nCatsB), scratch_bytes);
+        return !cancelled;
+      }
+
+      // Pointer to row r of a layer. In-memory layers are used in place, 
+      // others are first copied into buffer.
+      template<class Layer>
+      const double* layer_row(const Layer& layer, int r, int cols, 
+        double* buffer)
+      {
+        auto i = layer.begin() + static_cast<std::ptrdiff_t>(r) * cols;
+        std::copy(i, i + cols, buffer);
+        return buffer;
+      }
+
+      inline const double* layer_row(const memory_raster<double>& layer, 
+        int r, int, double*)
+      {
+        return layer.row(r);
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Apply the categorical similarity matrix to a row of cells. The values
+      // per category are kept as structure of arrays: da[catA] points to the
+      // decayed distances to catA along the row, and simA + catB * cols 
+      // becomes the similarity of map A to category catB of map B; vice versa
+      // for db and simB. The similarity is the maximum of m[catA][catB] * da
+      // over the nonzero entries, and 0 if none is positive. The two halves
+      // are also available separately, for a single category.
+      //
+      inline void similarity_row_a(const sparse_similarity_matrix& m,
+        int catB, const std::vector<const double*>& da, std::size_t n, 
+        double* simA)
+      {
+        if (m.m_identity) {
+          positive_part(simA, da[catB], n);
+          return;
+        }
+        std::fill(simA, simA + n, 0.0);
+        for (auto&& e : m.m_columns[catB]) {
+          max_product(simA, da[e.cat], e.value, n);
+        }
+      }
+
+      inline void similarity_row_b(const sparse_similarity_matrix& m,
+        int catA, const std::vector<const double*>& db, std::size_t n, 
+        double* simB)
+      {
+        if (m.m_identity) {
+          positive_part(simB, db[catA], n);
+          return;
+        }
+        std::fill(simB, simB + n, 0.0);
+        for (auto&& e : m.m_rows[catA]) {
+          max_product(simB, db[e.cat], e.value, n);
+        }
+      }
+
+      inline void similarity_rows(const sparse_similarity_matrix& m,
+        const std::vector<const double*>& da, 
+        const std::vector<const double*>& db, int cols, double* simA, 
+        double* simB)
+      {
+        const std::size_t n = static_cast<std::size_t>(cols);
+        for (int catB = 0; catB < m.m_nCatsB; ++catB) {
+          similarity_row_a(m, catB, da, n, simA + catB * n);
+        }
+        for (int catA = 0; catA < m.m_nCatsA; ++catA) {
+          similarity_row_b(m, catA, db, n, simB + catA * n);
+        }
+      }
+
+      // The values of one cell in a structure of arrays row buffer
+      struct strided_values
+      {
+        double operator[](int k) const
+        {
+          return first[static_cast<std::size_t>(k) * stride];
+        }
+        const double* first;
+        std::size_t stride;
+      };
+
+      // Output iterator that ignores what is written to it, for comparisons
+      // that do not need the similarity map
+      struct discard_iterator
+      {
+        discard_iterator& operator*() { return *this; }
+        discard_iterator& operator++() { return *this; }
+        template<class T>
+        discard_iterator& operator=(const T&) { return *this; }
+      };
+
+      // Add a row of cells to the accumulator, given their similarities from
+      // similarity_rows, and write the comparison map. The iterators are 
+      // advanced to the next row.
+      template<class Accumulator, class IterA, class IterB, class IterMask,
+      class IterOut>
+      void accumulate_row(Accumulator& accumulator, const double* simA,
+        const double* simB, int cols, IterA& a, IterB& b, IterMask& mask,
+        IterOut& out)
+      {
+        const std::size_t n = static_cast<std::size_t>(cols);
+        for (std::size_t c = 0; c < n; ++c, ++a, ++b, ++mask, ++out) {
+          if (*mask) {
+            *out = accumulator.add(*a, *b, strided_values{ simA + c, n },
+              strided_values{ simB + c, n });
           }
           else {
-            std::get<out_index>(i) = -1; //nodata value
+            *out = -1; //nodata value
           }
         }
+      }
 
+      //////////////////////////////////////////////////////////////////////////
+      // Fuzzy Kappa from the totals of the cell loop: the sum of similarities,
+      // the number of cells, the cells per category and the distributions of
+      // similarity values, which must have been compacted. The expected 
+      // similarities of the pairs of categories are computed on a number of
+      // threads, and added up in a fixed order.
+      // Returns false if there are no cells to compare (Fuzzy Kappa = 0)
+      // Returns false if all cells in both maps are identical (Fuzzy Kappa = 1)
+      //
+      template<class Distribution>
+      bool fuzzy_kappa_from_totals(double sum, std::int64_t count,
+        const std::vector<std::int64_t>& catCountsA,
+        const std::vector<std::int64_t>& catCountsB,
+        const std::vector< std::vector<Distribution> >& distributionA,
+        const std::vector< std::vector<Distribution> >& distributionB,
+        double& fuzzykappa, double& expected_error, int threads)
+      {
+        const int nCatsA = static_cast<int>(catCountsA.size());
+        const int nCatsB = static_cast<int>(catCountsB.size());
+        expected_error = 0;
         if (count == 0) {
           fuzzykappa = 0;
           return false;
         }
-        mean /= count;
+        const double mean = sum / static_cast<double>(count);
+
+        // Expected similarity per pair of categories
+        std::vector<double> eCats(nCatsA * nCatsB, 0);
+        std::vector<double> eErrors(nCatsA * nCatsB, 0);
+        parallel_for(0, nCatsA, threads, 1, [&](int a_begin, int a_end) {
+          for (int catA = a_begin; catA < a_end; ++catA) {
+            for (int catB = 0; catB < nCatsB; ++catB) {
+              // The if statement avoids division by zero
+              if (catCountsA[catA] > 0 && catCountsB[catB] > 0) {
+                const int k = catA * nCatsB + catB;
+                eCats[k] = expected_minimum_and_error(
+                  distributionA[catA][catB], distributionB[catB][catA],
+                  static_cast<double>(catCountsA[catA]), 
+                  static_cast<double>(catCountsB[catB]), eErrors[k]);
+              }
+            }
+          }
+        });
 
         // Calculate expected similarity
         double expected = 0;
         const double squaredTotal = (double)(count)*(double)(count);
         for (int catA = 0; catA < nCatsA; catA++){
           for (int catB = 0; catB < nCatsB; catB++){
-            // The if statement avoids division by zero
             if (catCountsA[catA] > 0 && catCountsB[catB] > 0) {
-              const double pCats = (double)(catCountsA[catA]) * (double)(catCountsB[catB])
-                / squaredTotal;
-              const double eCats = expected_minumum_of_two_distributions(
-                distributionA[catA][catB], distributionB[catB][catA], catCountsA[catA],
-                catCountsB[catB]);
-
-              expected += pCats * eCats;
+              const double pCats = (double)(catCountsA[catA]) 
+                * (double)(catCountsB[catB]) / squaredTotal;
+              const int k = catA * nCatsB + catB;
+              expected += pCats * eCats[k];
+              expected_error += pCats * eErrors[k];
             }
           }
         }
@@ -303,6 +847,637 @@ namespace blink {
         //std::cout << "Mean " << mean << std::endl;
         //std::cout << "Expected " << expected << std::endl;
         return true;
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // The running totals of the Fuzzy Kappa cell loop: the mean similarity,
+      // the cells per category and the distributions of similarity values.
+      //
+      template<class Distribution>
+      class fuzzy_kappa_accumulator
+      {
+      public:
+        fuzzy_kappa_accumulator(int nCatsA, int nCatsB, 
+          const Distribution& empty)
+          : m_nCatsA(nCatsA), m_nCatsB(nCatsB), m_mean(0), m_count(0)
+          , m_catCountsA(nCatsA, 0), m_catCountsB(nCatsB, 0)
+          , m_distributionA(nCatsA, std::vector<Distribution>(nCatsB, empty))
+          , m_distributionB(nCatsB, std::vector<Distribution>(nCatsA, empty))
+        {
+        }
+
+        // Add a cell that is inside the mask, returns its similarity
+        template<class SimA, class SimB>
+        double add(int catA, int catB, SimA&& simA, SimB&& simB)
+        {
+          ++m_catCountsA[catA];
+          ++m_catCountsB[catB];
+
+          const double sim = std::min<double>(simA[catB], simB[catA]);
+          m_mean += sim;
+          ++m_count;
+
+          for (int b = 0; b < m_nCatsB; b++) {
+            m_distributionA[catA][b].add(simA[b]);
+          }
+
+          for (int a = 0; a < m_nCatsA; a++) {
+            m_distributionB[catB][a].add(simB[a]);
+          }
+          return sim;
+        }
+
+        // Add the cells of another accumulator. Everything but the sum of
+        // similarities is exact, so the order of merging does not matter.
+        void merge(const fuzzy_kappa_accumulator& other)
+        {
+          m_mean += other.m_mean;
+          m_count += other.m_count;
+          for (int catA = 0; catA < m_nCatsA; ++catA) {
+            m_catCountsA[catA] += other.m_catCountsA[catA];
+            for (int catB = 0; catB < m_nCatsB; ++catB) {
+              m_distributionA[catA][catB].merge(
+                other.m_distributionA[catA][catB]);
+            }
+          }
+          for (int catB = 0; catB < m_nCatsB; ++catB) {
+            m_catCountsB[catB] += other.m_catCountsB[catB];
+            for (int catA = 0; catA < m_nCatsA; ++catA) {
+              m_distributionB[catB][catA].merge(
+                other.m_distributionB[catB][catA]);
+            }
+          }
+        }
+
+        // Replace the sum of similarities. Merging adds up the sums of the
+        // accumulators, callers that need the sum in the order of the cells,
+        // to have the same result as a serial run, add it up themselves.
+        void set_sum(double sum)
+        {
+          m_mean = sum;
+        }
+
+        // Returns false if there are no cells to compare (Fuzzy Kappa = 0)
+        // Returns false if all cells in both maps are identical (Fuzzy Kappa = 1)
+        bool fuzzy_kappa(double& fuzzykappa, double& expected_error,
+          int threads = 1)
+        {
+          compact(threads);
+          return fuzzy_kappa_from_totals(m_mean, m_count, m_catCountsA,
+            m_catCountsB, m_distributionA, m_distributionB, fuzzykappa,
+            expected_error, threads);
+        }
+
+        // Sort the values that were added to the distributions
+        void compact(int threads = 1)
+        {
+          parallel_for(0, m_nCatsA, threads, 1, [&](int a_begin, int a_end) {
+            for (int catA = a_begin; catA < a_end; ++catA) {
+              for (auto&& d : m_distributionA[catA]) d.compact();
+            }
+          });
+          parallel_for(0, m_nCatsB, threads, 1, [&](int b_begin, int b_end) {
+            for (int catB = b_begin; catB < b_end; ++catB) {
+              for (auto&& d : m_distributionB[catB]) d.compact();
+            }
+          });
+        }
+
+        // Total size of the distributions, after compact()
+        std::size_t distribution_entries() const
+        {
+          std::size_t entries = 0;
+          for (auto&& row : m_distributionA) {
+            for (auto&& d : row) entries += d.size();
+          }
+          for (auto&& row : m_distributionB) {
+            for (auto&& d : row) entries += d.size();
+          }
+          return entries;
+        }
+
+        int m_nCatsA;
+        int m_nCatsB;
+        double m_mean;  // sum of similarities, until divided by m_count
+        std::int64_t m_count;
+        // count number of cell and cells per category in both maps, 64 bit
+        // for maps of more than 2^31 cells
+        std::vector<std::int64_t> m_catCountsA;
+        std::vector<std::int64_t> m_catCountsB;
+        std::vector< std::vector<Distribution> > m_distributionA;
+        std::vector< std::vector<Distribution> > m_distributionB;
+      };
+
+      //////////////////////////////////////////////////////////////////////////
+      // Buffers and running totals for the cell loop over a range of rows. 
+      // The parallel cell loop has one per thread.
+      //
+      template<class Distribution>
+      struct cell_loop_state
+      {
+        cell_loop_state(int nCatsA, int nCatsB, int cols, 
+          const Distribution& empty)
+          : accumulator(nCatsA, nCatsB, empty)
+          , bufferA(nCatsA * static_cast<std::size_t>(cols))
+          , bufferB(nCatsB * static_cast<std::size_t>(cols))
+          , simA(nCatsB * static_cast<std::size_t>(cols))
+          , simB(nCatsA * static_cast<std::size_t>(cols))
+          , da(nCatsA), db(nCatsB)
+        {
+        }
+
+        fuzzy_kappa_accumulator<Distribution> accumulator;
+        std::vector<double> bufferA; // rows of layers that are not in memory
+        std::vector<double> bufferB;
+        std::vector<double> simA;
+        std::vector<double> simB;
+        std::vector<const double*> da;
+        std::vector<const double*> db;
+      };
+
+      // The cell loop for rows [r_begin, r_end)
+      template<class Distribution, class RasterA, class RasterB, 
+      class RasterMask, class RasterOut, class Layer>
+      void cell_loop_rows(cell_loop_state<Distribution>& state,
+        const sparse_similarity_matrix& sparse, RasterA& mapA, RasterB& mapB,
+        RasterMask& mask, RasterOut& comparison, 
+        const std::vector<Layer>& distancesA,
+        const std::vector<Layer>& distancesB, int cols, int r_begin, int r_end)
+      {
+        const std::size_t n = static_cast<std::size_t>(cols);
+        const std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(r_begin) * cols;
+        auto a_iter = mapA.begin() + offset;
+        auto b_iter = mapB.begin() + offset;
+        auto mask_iter = mask.begin() + offset;
+        auto out_iter = comparison.begin() + offset;
+        for (int r = r_begin; r < r_end; ++r) {
+          for (int catA = 0; catA < sparse.m_nCatsA; ++catA) {
+            state.da[catA] = layer_row(distancesA[catA], r, cols, 
+              &state.bufferA[catA * n]);
+          }
+          for (int catB = 0; catB < sparse.m_nCatsB; ++catB) {
+            state.db[catB] = layer_row(distancesB[catB], r, cols, 
+              &state.bufferB[catB * n]);
+          }
+          similarity_rows(sparse, state.da, state.db, cols, state.simA.data(),
+            state.simB.data());
+          accumulate_row(state.accumulator, state.simA.data(), 
+            state.simB.data(), cols, a_iter, b_iter, mask_iter, out_iter);
+        }
+      }
+
+      // Apply the categorical similarity matrix row by row and accumulate the
+      // results. Note that this yields the similarity of map A to the 
+      // categories of map B and vice versa
+      // The cell loop goes through blocks of a fixed number of rows, between
+      // which the observer is told of the progress. Progress is counted in
+      // rows per category.
+      enum { cell_loop_block_rows = 16 };
+
+      // Fuzzy Kappa from the totals of the cell loop, with the compaction of
+      // the distributions and the expected similarity as separate phases
+      template<class Distribution, class Observer>
+      bool observed_fuzzy_kappa(fuzzy_kappa_accumulator<Distribution>& totals,
+        Observer& observer, int threads, double& fuzzykappa,
+        double& expected_error)
+      {
+        observer.begin_phase(phase::compact_distributions);
+        totals.compact(threads);
+        observer.end_phase(phase::compact_distributions, 0, 0);
+        observer.distribution_entries(totals.distribution_entries());
+        observer.begin_phase(phase::expected_similarity);
+        const bool result = totals.fuzzy_kappa(fuzzykappa, expected_error, 
+          threads);
+        observer.end_phase(phase::expected_similarity, 0, 0);
+        return result;
+      }
+
+      template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+      class Layer, class Distribution, class Observer>
+      bool cell_loop(const sparse_similarity_matrix& sparse, RasterA& mapA,
+        RasterB& mapB, RasterMask& mask, RasterOut& comparison,
+        const std::vector<Layer>& distancesA,
+        const std::vector<Layer>& distancesB, const Distribution& empty,
+        const serial_execution&, work_progress<Observer>& progress,
+        double& fuzzykappa, double& expected_error)
+      {
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(mapA));
+        const std::size_t row_units = sparse.m_nCatsA + sparse.m_nCatsB;
+        Observer& observer = progress.observer();
+        observer.begin_phase(phase::cell_loop);
+        cell_loop_state<Distribution> state(sparse.m_nCatsA, sparse.m_nCatsB,
+          cols, empty);
+        for (int r_begin = 0; r_begin < rows; 
+          r_begin += cell_loop_block_rows) {
+          const int r_end = std::min(rows, r_begin + cell_loop_block_rows);
+          cell_loop_rows(state, sparse, mapA, mapB, mask, comparison, 
+            distancesA, distancesB, cols, r_begin, r_end);
+          if (!progress.advance(row_units * (r_end - r_begin))) {
+            observer.end_phase(phase::cell_loop, 0, 0);
+            fuzzykappa = expected_error = 0;
+            return false;
+          }
+        }
+        observer.end_phase(phase::cell_loop, 
+          static_cast<std::size_t>(rows) * cols, 0);
+        return observed_fuzzy_kappa(state.accumulator, observer, 1, 
+          fuzzykappa, expected_error);
+      }
+
+      // The parallel cell loop hands out the blocks to the threads.
+      // The sums of similarities per block are added up in the order of the
+      // blocks, and all other totals are exact. The result therefore does 
+      // not depend on the number of threads or the order in which blocks are
+      // processed. It may differ from the serial loop in the last bits, as
+      // that adds up the similarities cell by cell.
+
+      template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+      class Layer, class Distribution, class Observer>
+      bool cell_loop(const sparse_similarity_matrix& sparse, RasterA& mapA,
+        RasterB& mapB, RasterMask& mask, RasterOut& comparison,
+        const std::vector<Layer>& distancesA,
+        const std::vector<Layer>& distancesB, const Distribution& empty,
+        const parallel_execution& exec, work_progress<Observer>& progress,
+        double& fuzzykappa, double& expected_error)
+      {
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(mapA));
+        const int blocks = (rows + cell_loop_block_rows - 1) 
+          / cell_loop_block_rows;
+        std::vector<double> block_sums(blocks, 0);
+        const std::size_t row_units = sparse.m_nCatsA + sparse.m_nCatsB;
+        Observer& observer = progress.observer();
+        observer.begin_phase(phase::cell_loop);
+        std::atomic<bool> cancelled(false);
+
+        // States are taken from the pool by the threads as they need them
+        std::vector<std::unique_ptr<cell_loop_state<Distribution> > > states;
+        std::vector<cell_loop_state<Distribution>*> idle;
+        std::mutex mutex;
+
+        parallel_for(0, blocks, exec.threads(), 1, 
+          [&](int b_begin, int b_end) {
+          cell_loop_state<Distribution>* state;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.empty()) {
+              states.emplace_back(new cell_loop_state<Distribution>(
+                sparse.m_nCatsA, sparse.m_nCatsB, cols, empty));
+              idle.push_back(states.back().get());
+            }
+            state = idle.back();
+            idle.pop_back();
+          }
+          for (int b = b_begin; b < b_end && !cancelled; ++b) {
+            const int r_begin = b * cell_loop_block_rows;
+            const int r_end = std::min(rows, r_begin + cell_loop_block_rows);
+            state->accumulator.m_mean = 0;
+            cell_loop_rows(*state, sparse, mapA, mapB, mask, comparison,
+              distancesA, distancesB, cols, r_begin, r_end);
+            block_sums[b] = state->accumulator.m_mean;
+            if (!progress.advance(row_units * (r_end - r_begin))) {
+              cancelled = true;
+            }
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          idle.push_back(state);
+        });
+        if (cancelled) {
+          observer.end_phase(phase::cell_loop, 0, 0);
+          fuzzykappa = expected_error = 0;
+          return false;
+        }
+
+        fuzzy_kappa_accumulator<Distribution> total(sparse.m_nCatsA, 
+          sparse.m_nCatsB, empty);
+        for (auto&& state : states) {
+          total.merge(state->accumulator);
+        }
+        double sum = 0;
+        for (auto&& block_sum : block_sums) {
+          sum += block_sum;
+        }
+        total.set_sum(sum);
+        observer.end_phase(phase::cell_loop, 
+          static_cast<std::size_t>(rows) * cols, 0);
+        return observed_fuzzy_kappa(total, observer, exec.threads(), 
+          fuzzykappa, expected_error);
+      }
+
+      // The observer sees the phases of the run and its progress, counted in
+      // rows per category for the distances and the cell loop. If it cancels
+      // the run, the result is false and fuzzykappa 0.
+      template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+      class DistanceDecay, class RasterMaker, class Distributions, class T,
+      class Execution, class Observer>
+      bool fuzzy_kappa_2009(
+        RasterA& mapA,              // input: first map
+        RasterB& mapB,              // input: second map
+        RasterMask& mask,           // input: mask map
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        RasterOut& comparison,      // result: similarity map
+        RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+        const Distributions& distributions, // policy: exact or histograms
+        const precision<T>& prec,   // policy: precision of intermediate layers
+        const Execution& exec,      // policy: serial or parallel cell loop
+        Observer& observer,         // observer: phases and progress
+        double& fuzzykappa,         // result: improved fuzzy kappa
+        double& expected_error)     // result: bound on error in expected similarity
+      {
+        using value_type = typename precision<T>::value_type;
+        using temp_raster = typename RasterMaker::template raster_type<
+          value_type>;
+        const std::size_t rows = blink::raster::raster_operations::size1(mapA);
+        const std::size_t cells = rows 
+          * blink::raster::raster_operations::size2(mapA);
+        work_progress<Observer> progress(observer, 
+          2 * rows * (nCatsA + nCatsB));
+
+        // Nearest neighbour distances for all categories in both maps, each
+        // map is read only once for all its categories
+        observer.begin_phase(phase::allocation);
+        std::vector<temp_raster> distancesA;
+        std::vector<temp_raster> distancesB;
+        for (int catA = 0; catA < nCatsA; ++catA) {
+          distancesA.emplace_back(maker.template create<
+            typename precision<T>::value_type>(mapA));
+        }
+        for (int catB = 0; catB < nCatsB; catB++) {
+          distancesB.emplace_back(maker.template create<
+            typename precision<T>::value_type>(mapB));
+        }
+        observer.end_phase(phase::allocation, 0, 
+          cells * (nCatsA + nCatsB) * sizeof(value_type));
+        if (!decayed_distances(mapA, mapB, distancesA, distancesB, nCatsA, 
+          nCatsB, f, maker, prec, exec, progress)) {
+          fuzzykappa = expected_error = 0;
+          return false;
+        }
+
+        const sparse_similarity_matrix sparse(m, nCatsA, nCatsB);
+        return cell_loop(sparse, mapA, mapB, mask, comparison, distancesA, 
+          distancesB, make_distribution(distributions, prec), exec, progress,
+          fuzzykappa, expected_error);
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // This is the entry function to calculate Fuzzy Kappa (improved), 
+    // Returns false if there are no cells to compare (Fuzzy Kappa = 0)
+    // Returns false if all cells in both maps are identical (Fuzzy Kappa = 1)
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, precision<double>{}, 
+        serial_execution{}, observer, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, with the cell loop and the expected similarity spread over 
+    // threads. The result is the same for any number of threads, see 
+    // detail::cell_loop.
+    // The threads read the maps, the mask and the layers made by maker, and
+    // write different cells of comparison, at the same time. All these 
+    // rasters must therefore allow concurrent access, as in-memory rasters
+    // (memory_raster, memory_raster_maker) do; gdal_raster and 
+    // gdal_raster_maker do not. 
+    // The parallel run takes no less memory than the serial run: the layers
+    // of all nCatsA + nCatsB categories are allocated up front, whatever 
+    // the number of threads. Each thread adds its own buffers: rows of 
+    // similarities per category, the distributions of the cells it visits
+    // and, for precision<fixed16>, a float layer of squared distances.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const parallel_execution& exec, // parameter: number of threads
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, precision<double>{}, exec,
+        observer, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa, recording wall time, cells and bytes of intermediate
+    // rasters per phase, and the number of entries in the distributions, in
+    // stats. The progress callback of stats may cancel the run, the result
+    // is then false and fuzzykappa 0. Without stats, the observer costs
+    // nothing.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      phase_stats& stats,         // result: statistics per phase
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, precision<double>{},
+        serial_execution{}, stats, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, in parallel. The distance transforms of the categories run
+    // concurrently and are recorded as a single distance_transform phase
+    // that includes the decay. The rasters must allow concurrent access, 
+    // see the parallel overload without stats.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const parallel_execution& exec, // parameter: number of threads
+      phase_stats& stats,         // result: statistics per phase
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, precision<double>{}, exec,
+        stats, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Approximate Fuzzy Kappa, for when it must be evaluated many times. The 
+    // similarity values are binned into histograms per pair of categories.
+    // The expected similarity is then within expected_error of its exact 
+    // value. To first order, the error in Fuzzy Kappa is bounded by 
+    // expected_error * (1 - mean) / (1 - expected)^2. If Fuzzy Kappa is not
+    // negative (mean >= expected), that is at most 
+    // expected_error / (1 - expected).
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const histogram_distributions& histograms, // parameter: number of bins
+      double& fuzzykappa,         // result: approximate improved fuzzy kappa
+      double& expected_error)     // result: bound on error in expected similarity
+    {
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, histograms, precision<double>{}, 
+        serial_execution{}, observer, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Approximate Fuzzy Kappa with a parallel cell loop. The rasters must 
+    // allow concurrent access, as for exact Fuzzy Kappa in parallel.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const histogram_distributions& histograms, // parameter: number of bins
+      const parallel_execution& exec, // parameter: number of threads
+      double& fuzzykappa,         // result: approximate improved fuzzy kappa
+      double& expected_error)     // result: bound on error in expected similarity
+    {
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, histograms, precision<double>{}, exec, observer,
+        fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa with the intermediate layers and distributions in reduced 
+    // precision, to save memory and memory bandwidth. See precision.h for 
+    // the error in Fuzzy Kappa that each policy introduces.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker, class T>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const precision<T>& prec,   // parameter: precision<float> or precision<fixed16>
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, prec, serial_execution{},
+        observer, fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, with a parallel cell loop. The rasters must allow 
+    // concurrent access, as for Fuzzy Kappa in double precision. No more
+    // than one float layer per thread is added for precision<fixed16>.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker, class T>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const precision<T>& prec,   // parameter: precision<float> or precision<fixed16>
+      const parallel_execution& exec, // parameter: number of threads
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, exact_distributions{}, prec, exec, observer, 
+        fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Approximate Fuzzy Kappa with intermediate layers in reduced precision.
+    // expected_error only bounds the error of the binning. The error of the
+    // reduced precision layers, described in precision.h, is not included
+    // and comes on top of it.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker, class T>
+      bool fuzzy_kappa_2009(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const histogram_distributions& histograms, // parameter: number of bins
+      const precision<T>& prec,   // parameter: precision<float> or precision<fixed16>
+      double& fuzzykappa,         // result: approximate improved fuzzy kappa
+      double& expected_error)     // result: bound on error in expected similarity
+    {
+      null_observer observer;
+      return detail::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f,
+        comparison, maker, histograms, prec, serial_execution{}, observer,
+        fuzzykappa, expected_error);
     }
   }
 }
@@ -0,0 +1,352 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa that is kept up to date while the second map changes a few
+// cells at a time, as in a land use model that is compared against
+// observations at every time step. A changed cell only affects the
+// similarity of cells within the cutoff radius of the distance decay
+// function, so an update only recomputes the distance transforms in that
+// neighbourhood and replaces the contributions of the cells in it.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_INCREMENTAL_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_INCREMENTAL_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_prepared.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    // A cell of the second map that is set to a new category
+    struct cell_change
+    {
+      int row;
+      int col;
+      int category;
+    };
+
+    namespace detail
+    {
+      // Compensated (Neumaier) summation, so that many additions and
+      // subtractions do not accumulate rounding errors
+      inline void compensated_add(double& sum, double& compensation,
+        double value)
+      {
+        const double t = sum + value;
+        if (std::fabs(sum) >= std::fabs(value)) {
+          compensation += (sum - t) + value;
+        }
+        else {
+          compensation += (value - t) + sum;
+        }
+        sum = t;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa of a fixed first map and a second map that is edited
+    // through update(). The map is divided in tiles; an update recomputes
+    // the tiles within the cutoff radius of a changed cell, with the distance
+    // transforms limited to those tiles and a halo of the cutoff radius. The
+    // cost of an update is therefore proportional to the number of changes,
+    // not to the size of the map. fuzzy_kappa() still compacts the
+    // distributions and recomputes the expected similarity of all
+    // nCatsA * nCatsB pairs of categories, at a cost that grows with the
+    // number of distinct similarity values, whatever the number of changes.
+    // Distance decay functions without a cutoff radius, such as
+    // exponential_decay without a threshold, would recompute the whole
+    // second map on every update and throw std::invalid_argument.
+    // The result is that of fuzzy_kappa_2009 for the current second map, 
+    // except that the sum of similarities is compensated for rounding 
+    // errors, so the last bits of the mean similarity can differ.
+    //
+    template<class DistanceDecay, class Distributions = exact_distributions>
+    class incremental_fuzzy_kappa
+    {
+    public:
+      typedef typename Distributions::distribution_type distribution_type;
+
+      template<class RasterA, class RasterB, class RasterMask>
+      incremental_fuzzy_kappa(
+        const RasterA& mapA,        // input: first map
+        const RasterB& mapB,        // input: second map, initial state
+        const RasterMask& mask,     // input: mask map
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        const Distributions& distributions = Distributions{})
+        : m_reference(mapA, mask, nCatsA, nCatsB, m, with_cutoff(f), 
+          distributions)
+        , m_rows(m_reference.m_rows), m_cols(m_reference.m_cols)
+        , m_categoriesB(m_rows, m_cols)
+        , m_sum(0), m_compensation(0), m_count(0)
+        , m_countsB(nCatsB, 0)
+        , m_distributionB(nCatsB,
+          std::vector<distribution_type>(nCatsA, distributions.make()))
+      {
+        const double cutoff = detail::cutoff_radius(f, 0);
+        m_halo = cutoff < m_rows + m_cols
+          ? static_cast<int>(std::ceil(cutoff)) : -1;
+        m_tile = std::max<int>(min_tile, 2 * m_halo);
+
+        auto b_iter = mapB.begin();
+        const int* catsA = m_reference.m_categories.data();
+        for (auto&& i : m_categoriesB) {
+          i = static_cast<int>(*b_iter);
+          if (*catsA >= 0) ++m_countsB[i];
+          ++b_iter;
+          ++catsA;
+        }
+        for (int catA = 0; catA < nCatsA; ++catA) {
+          m_similarityB.emplace_back(m_rows, m_cols);
+        }
+        recompute(0, m_rows, 0, m_cols);
+        add_cells(0, m_rows, 0, m_cols);
+      }
+
+      // Set cells of the second map to new categories. Throws
+      // std::out_of_range, before any cell is changed, if a change is
+      // outside the map or to a category outside 0..nCatsB-1.
+      void update(const std::vector<cell_change>& changes)
+      {
+        if (changes.empty()) return;
+        check_changes(changes);
+        const std::vector<rectangle> regions = affected_regions(changes);
+        for (auto&& i : regions) {
+          remove_cells(i.r_begin, i.r_end, i.c_begin, i.c_end);
+        }
+        apply(changes);
+        for (auto&& i : regions) {
+          recompute(i.r_begin, i.r_end, i.c_begin, i.c_end);
+          add_cells(i.r_begin, i.r_end, i.c_begin, i.c_end);
+        }
+      }
+
+      // Returns false if there are no cells to compare (Fuzzy Kappa = 0)
+      // Returns false if all cells in both maps are identical (Fuzzy Kappa = 1)
+      bool fuzzy_kappa(double& fuzzykappa, double& expected_error)
+      {
+        for (auto&& row : m_distributionB) {
+          for (auto&& d : row) d.compact();
+        }
+        return detail::fuzzy_kappa_from_totals(m_sum + m_compensation, m_count,
+          m_reference.m_counts, m_countsB, m_reference.m_distribution,
+          m_distributionB, fuzzykappa, expected_error, 1);
+      }
+
+      bool fuzzy_kappa(double& fuzzykappa)
+      {
+        double expected_error;
+        return fuzzy_kappa(fuzzykappa, expected_error);
+      }
+
+    private:
+      enum { min_tile = 32 };
+
+      // Throws before the first map is prepared if f has no cutoff radius
+      static const DistanceDecay& with_cutoff(const DistanceDecay& f)
+      {
+        if (std::isinf(detail::cutoff_radius(f, 0))) {
+          throw std::invalid_argument("incremental_fuzzy_kappa needs a "
+            "distance decay function with a cutoff radius, such as "
+            "exponential_decay with a threshold");
+        }
+        return f;
+      }
+
+      void check_changes(const std::vector<cell_change>& changes) const
+      {
+        for (auto&& c : changes) {
+          if (c.row < 0 || c.row >= m_rows || c.col < 0 || c.col >= m_cols) {
+            throw std::out_of_range("incremental_fuzzy_kappa: changed cell "
+              "outside the map");
+          }
+          if (c.category < 0 || c.category >= m_reference.m_sparse.m_nCatsB) {
+            throw std::out_of_range("incremental_fuzzy_kappa: changed cell "
+              "set to a category outside the legend");
+          }
+        }
+      }
+
+      struct rectangle
+      {
+        int r_begin;
+        int r_end;
+        int c_begin;
+        int c_end;
+      };
+
+      // The tiles within the halo of a changed cell, as runs of adjacent
+      // tiles in the same row of tiles. If recomputing these costs more than
+      // recomputing the whole map, the whole map.
+      std::vector<rectangle> affected_regions(
+        const std::vector<cell_change>& changes) const
+      {
+        const rectangle whole_map = { 0, m_rows, 0, m_cols };
+        if (m_halo < 0) return std::vector<rectangle>(1, whole_map);
+
+        const int tile_rows = (m_rows + m_tile - 1) / m_tile;
+        const int tile_cols = (m_cols + m_tile - 1) / m_tile;
+        std::vector<char> affected(tile_rows * tile_cols, 0);
+        for (auto&& c : changes) {
+          const int tr_begin = std::max(0, c.row - m_halo) / m_tile;
+          const int tr_end = std::min(m_rows - 1, c.row + m_halo) / m_tile;
+          const int tc_begin = std::max(0, c.col - m_halo) / m_tile;
+          const int tc_end = std::min(m_cols - 1, c.col + m_halo) / m_tile;
+          for (int tr = tr_begin; tr <= tr_end; ++tr) {
+            for (int tc = tc_begin; tc <= tc_end; ++tc) {
+              affected[tr * tile_cols + tc] = 1;
+            }
+          }
+        }
+
+        std::vector<rectangle> regions;
+        double cost = 0; // cells in the windows of the distance transforms
+        for (int tr = 0; tr < tile_rows; ++tr) {
+          for (int tc = 0; tc < tile_cols; ++tc) {
+            if (!affected[tr * tile_cols + tc]) continue;
+            const int run_begin = tc;
+            while (tc + 1 < tile_cols && affected[tr * tile_cols + tc + 1]) {
+              ++tc;
+            }
+            rectangle run;
+            run.r_begin = tr * m_tile;
+            run.r_end = std::min(m_rows, run.r_begin + m_tile);
+            run.c_begin = run_begin * m_tile;
+            run.c_end = std::min(m_cols, (tc + 1) * m_tile);
+            regions.push_back(run);
+            cost += static_cast<double>(run.r_end - run.r_begin + 2 * m_halo)
+              * (run.c_end - run.c_begin + 2 * m_halo);
+          }
+        }
+        if (cost >= static_cast<double>(m_rows) * m_cols) {
+          return std::vector<rectangle>(1, whole_map);
+        }
+        return regions;
+      }
+
+      void apply(const std::vector<cell_change>& changes)
+      {
+        for (auto&& c : changes) {
+          int& cat = m_categoriesB.row(c.row)[c.col];
+          if (m_reference.m_categories.row(c.row)[c.col] >= 0) {
+            --m_countsB[cat];
+            ++m_countsB[c.category];
+          }
+          cat = c.category;
+        }
+      }
+
+      // Recompute the similarity of the second map in rows [r_begin, r_end)
+      // and columns [c_begin, c_end), from the categories within the halo
+      void recompute(int r_begin, int r_end, int c_begin, int c_end)
+      {
+        const sparse_similarity_matrix& sparse = m_reference.m_sparse;
+        const int halo = m_halo < 0 ? std::max(m_rows, m_cols) : m_halo;
+        const int wr_begin = std::max(0, r_begin - halo);
+        const int wr_end = std::min(m_rows, r_end + halo);
+        const int wc_begin = std::max(0, c_begin - halo);
+        const int wc_end = std::min(m_cols, c_end + halo);
+
+        memory_raster<int> window(wr_end - wr_begin, wc_end - wc_begin);
+        for (int r = wr_begin; r < wr_end; ++r) {
+          std::copy(m_categoriesB.row(r) + wc_begin,
+            m_categoriesB.row(r) + wc_end, window.row(r - wr_begin));
+        }
+        std::vector<memory_raster<double> > distances;
+        for (int catB = 0; catB < sparse.m_nCatsB; ++catB) {
+          distances.emplace_back(wr_end - wr_begin, wc_end - wc_begin);
+        }
+        detail::decayed_distances(window, distances, sparse.m_nCatsB,
+          m_reference.m_f, m_workspace);
+
+        const std::size_t n = static_cast<std::size_t>(c_end - c_begin);
+        std::vector<const double*> db(sparse.m_nCatsB);
+        for (int r = r_begin; r < r_end; ++r) {
+          for (int catB = 0; catB < sparse.m_nCatsB; ++catB) {
+            db[catB] = distances[catB].row(r - wr_begin) + (c_begin - wc_begin);
+          }
+          for (int catA = 0; catA < sparse.m_nCatsA; ++catA) {
+            detail::similarity_row_b(sparse, catA, db, n,
+              m_similarityB[catA].row(r) + c_begin);
+          }
+        }
+      }
+
+      // Add or remove the contributions of the cells in a rectangle. The
+      // cells per category only change with the categories, see apply().
+      void add_cells(int r_begin, int r_end, int c_begin, int c_end)
+      {
+        for_cells(r_begin, r_end, c_begin, c_end, 1);
+      }
+
+      void remove_cells(int r_begin, int r_end, int c_begin, int c_end)
+      {
+        for_cells(r_begin, r_end, c_begin, c_end, -1);
+      }
+
+      void for_cells(int r_begin, int r_end, int c_begin, int c_end, int sign)
+      {
+        const int nCatsA = m_reference.m_sparse.m_nCatsA;
+        for (int r = r_begin; r < r_end; ++r) {
+          const int* catsA = m_reference.m_categories.row(r);
+          const int* catsB = m_categoriesB.row(r);
+          for (int c = c_begin; c < c_end; ++c) {
+            const int catA = catsA[c];
+            if (catA < 0) continue;
+            const int catB = catsB[c];
+            const double simA = m_reference.m_similarity[catB].row(r)[c];
+            const double sim = std::min<double>(simA,
+              m_similarityB[catA].row(r)[c]);
+            std::vector<distribution_type>& distribution =
+              m_distributionB[catB];
+            if (sign > 0) {
+              detail::compensated_add(m_sum, m_compensation, sim);
+              ++m_count;
+              for (int a = 0; a < nCatsA; ++a) {
+                distribution[a].add(m_similarityB[a].row(r)[c]);
+              }
+            }
+            else {
+              detail::compensated_add(m_sum, m_compensation, -sim);
+              --m_count;
+              for (int a = 0; a < nCatsA; ++a) {
+                distribution[a].remove(m_similarityB[a].row(r)[c]);
+              }
+            }
+          }
+        }
+      }
+
+      prepared_map<DistanceDecay, Distributions> m_reference;
+      int m_rows;
+      int m_cols;
+      int m_halo;  // cutoff radius in cells, -1 if it spans the map
+      int m_tile;  // tile size
+      memory_raster<int> m_categoriesB;
+      std::vector<memory_raster<double> > m_similarityB; // per category of A
+      distance_transform_workspace m_workspace;
+      double m_sum;          // sum of similarities
+      double m_compensation; // rounding error of m_sum
+      std::int64_t m_count;
+      std::vector<std::int64_t> m_countsB;
+      std::vector< std::vector<distribution_type> > m_distributionB;
+    };
+  }
+}
+#endif
@@ -0,0 +1,613 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa for all pairs in a set of maps with the same legend, for
+// instance the runs of a model ensemble. Apart from the sum of similarities,
+// everything in a comparison only depends on one of the two maps: its
+// similarity to the categories of the other map, its cells per category and
+// its distributions of similarity values. These are computed once per map,
+// and kept in a temporary file if they do not all fit in the memory budget,
+// after which a pair only costs one pass over the cells.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_PAIRWISE_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_PAIRWISE_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_prepared.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Observer for fuzzy_kappa_2009_pairwise that does not need the
+    // similarity maps of the pairs. An observer that does is called as
+    // on_pair(i, j, comparison) with a memory_raster<double>, from the
+    // worker threads.
+    //
+    struct no_pair_observer {};
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // All that the pairwise comparisons need of a single map
+      //
+      template<class Distribution>
+      struct pairwise_map
+      {
+        memory_raster<int> categories;                   // -1 outside the mask
+        std::vector<memory_raster<double> > similarityA; // as map A
+        std::vector<memory_raster<double> > similarityB; // as map B
+        std::vector<std::int64_t> counts;                // cells per category
+        std::vector< std::vector<Distribution> > distributionA;
+        std::vector< std::vector<Distribution> > distributionB;
+      };
+
+      template<class Raster, class RasterMask, class DistanceDecay,
+      class Distribution>
+      std::shared_ptr<pairwise_map<Distribution> > prepare_pairwise_map(
+        const Raster& map, const RasterMask& mask,
+        const sparse_similarity_matrix& m, const DistanceDecay& f,
+        const Distribution& empty)
+      {
+        const int nCats = m.m_nCatsA;
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(map));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(map));
+        std::shared_ptr<pairwise_map<Distribution> > p =
+          std::make_shared<pairwise_map<Distribution> >();
+        p->categories = masked_categories(map, mask);
+        {
+          std::vector<memory_raster<double> > distances;
+          for (int cat = 0; cat < nCats; ++cat) {
+            distances.emplace_back(rows, cols);
+          }
+          decayed_distances(map, distances, nCats, f);
+          p->similarityA = similarity_layers(distances, m, true, rows, cols);
+          p->similarityB = similarity_layers(distances, m, false, rows, cols);
+        }
+        p->counts.assign(nCats, 0);
+        p->distributionA.assign(nCats, std::vector<Distribution>(nCats, empty));
+        p->distributionB.assign(nCats, std::vector<Distribution>(nCats, empty));
+        side_totals(p->categories, p->similarityA, p->counts,
+          p->distributionA);
+        p->counts.assign(nCats, 0);
+        side_totals(p->categories, p->similarityB, p->counts,
+          p->distributionB);
+        return p;
+      }
+
+      // Upper bound on the memory of the distributions of one side of a
+      // map. Each cell in the mask adds a value to nCats distributions and a
+      // flat distribution has at most one entry per value.
+      inline std::size_t side_distribution_bytes(const flat_distribution&,
+        std::size_t cells, int nCats)
+      {
+        const std::size_t n = static_cast<std::size_t>(nCats);
+        return cells * n * sizeof(flat_distribution::value_count)
+          + n * n * sizeof(flat_distribution);
+      }
+
+      inline std::size_t side_distribution_bytes(
+        const histogram_distribution& empty, std::size_t, int nCats)
+      {
+        const std::size_t n = static_cast<std::size_t>(nCats);
+        return n * n * (sizeof(histogram_distribution)
+          + empty.size() * (sizeof(std::int64_t) + 2 * sizeof(double)));
+      }
+
+      // Memory of a pairwise_map, including its distributions
+      template<class Distribution>
+      std::size_t pairwise_map_bytes(std::size_t cells, int nCats,
+        const Distribution& empty)
+      {
+        return cells * (sizeof(int) + 2 * nCats * sizeof(double))
+          + 2 * side_distribution_bytes(empty, cells, nCats);
+      }
+
+      // Memory that prepare_pairwise_map needs on top of the map it makes.
+      // First the decayed distances to each category. Then, for flat 
+      // distributions, the values of a side that are pending until its 
+      // distributions are compacted, in buffers of up to twice their size,
+      // and the lists of the distribution that merges a full buffer.
+      inline std::size_t prepare_scratch_bytes(const flat_distribution&,
+        std::size_t cells, int nCats)
+      {
+        const std::size_t n = static_cast<std::size_t>(nCats);
+        return 2 * cells * n * sizeof(double)
+          + 2 * cells * sizeof(flat_distribution::value_count);
+      }
+
+      inline std::size_t prepare_scratch_bytes(const histogram_distribution&,
+        std::size_t cells, int nCats)
+      {
+        return cells * nCats * sizeof(double);
+      }
+
+      // Memory per thread for the similarity map of a pair
+      inline std::size_t pair_output_bytes(const no_pair_observer&,
+        std::size_t)
+      {
+        return 0;
+      }
+
+      template<class PairObserver>
+      std::size_t pair_output_bytes(const PairObserver&, std::size_t cells)
+      {
+        return cells * sizeof(double);
+      }
+
+      template<class OutIter>
+      OutIter pair_output(const no_pair_observer&,
+        std::unique_ptr<memory_raster<double> >&, int, int)
+      {
+        return OutIter{};
+      }
+
+      template<class OutIter, class PairObserver>
+      OutIter pair_output(const PairObserver&,
+        std::unique_ptr<memory_raster<double> >& comparison, int rows,
+        int cols)
+      {
+        comparison.reset(new memory_raster<double>(rows, cols));
+        return OutIter(comparison->data());
+      }
+
+      inline void notify_pair(no_pair_observer&, int, int,
+        const std::unique_ptr<memory_raster<double> >&)
+      {
+      }
+
+      template<class PairObserver>
+      void notify_pair(PairObserver& on_pair, int i, int j,
+        const std::unique_ptr<memory_raster<double> >& comparison)
+      {
+        on_pair(i, j, *comparison);
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // Temporary file of prepared maps. A map that is unloaded to make room
+      // for another group is read back from the file instead of prepared
+      // again. Each map is written once, after it is prepared, and the file
+      // is deleted when the store is destroyed. Calls from several threads
+      // take turns.
+      //
+      template<class Distribution>
+      class pairwise_map_store
+      {
+      public:
+        pairwise_map_store(int n, int rows, int cols, int nCats,
+          const Distribution& empty)
+          : m_rows(rows), m_cols(cols), m_nCats(nCats), m_empty(empty)
+          , m_offsets(n, -1), m_end(0), m_file(std::tmpfile(), &std::fclose)
+        {
+          if (!m_file) {
+            throw std::runtime_error("Cannot create a temporary file for "
+              "the pairwise Fuzzy Kappa");
+          }
+        }
+
+        bool contains(int i)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          return m_offsets[i] >= 0;
+        }
+
+        void write(int i, const pairwise_map<Distribution>& p)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          seek(m_end);
+          write_values(p.categories.data(), p.categories.size());
+          for (auto&& layer : p.similarityA) {
+            write_values(layer.data(), layer.size());
+          }
+          for (auto&& layer : p.similarityB) {
+            write_values(layer.data(), layer.size());
+          }
+          write_values(p.counts.data(), p.counts.size());
+          for (auto&& row : p.distributionA) {
+            for (auto&& d : row) write_distribution(d);
+          }
+          for (auto&& row : p.distributionB) {
+            for (auto&& d : row) write_distribution(d);
+          }
+          m_offsets[i] = m_end;
+          m_end = tell();
+        }
+
+        std::shared_ptr<pairwise_map<Distribution> > read(int i)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          seek(m_offsets[i]);
+          std::shared_ptr<pairwise_map<Distribution> > p =
+            std::make_shared<pairwise_map<Distribution> >();
+          p->categories = memory_raster<int>(m_rows, m_cols);
+          read_values(p->categories.data(), p->categories.size());
+          for (auto* layers : { &p->similarityA, &p->similarityB }) {
+            for (int cat = 0; cat < m_nCats; ++cat) {
+              layers->emplace_back(m_rows, m_cols);
+              read_values(layers->back().data(), layers->back().size());
+            }
+          }
+          p->counts.resize(m_nCats);
+          read_values(p->counts.data(), p->counts.size());
+          for (auto* distributions : { &p->distributionA,
+            &p->distributionB }) {
+            distributions->resize(m_nCats);
+            for (auto&& row : *distributions) {
+              for (int cat = 0; cat < m_nCats; ++cat) {
+                row.push_back(read_distribution(m_empty));
+              }
+            }
+          }
+          return p;
+        }
+
+      private:
+        template<class Key>
+        void write_distribution(const basic_flat_distribution<Key>& d)
+        {
+          write_size(d.values().size());
+          write_values(d.values().data(), d.values().size());
+        }
+
+        void write_distribution(const histogram_distribution& d)
+        {
+          const std::vector<histogram_distribution::value_count> lower =
+            d.lower_values();
+          const std::vector<histogram_distribution::value_count> upper =
+            d.upper_values();
+          write_size(lower.size());
+          write_values(lower.data(), lower.size());
+          write_values(upper.data(), upper.size());
+        }
+
+        template<class Key>
+        basic_flat_distribution<Key> read_distribution(
+          const basic_flat_distribution<Key>&)
+        {
+          std::vector<typename basic_flat_distribution<Key>::value_count>
+            values(read_size());
+          read_values(values.data(), values.size());
+          return basic_flat_distribution<Key>(std::move(values));
+        }
+
+        histogram_distribution read_distribution(
+          const histogram_distribution& empty)
+        {
+          const std::size_t n = read_size();
+          std::vector<histogram_distribution::value_count> lower(n);
+          std::vector<histogram_distribution::value_count> upper(n);
+          read_values(lower.data(), n);
+          read_values(upper.data(), n);
+          return histogram_distribution(empty.bins(), lower, upper);
+        }
+
+        void write_size(std::uint64_t n)
+        {
+          write_values(&n, 1);
+        }
+
+        std::size_t read_size()
+        {
+          std::uint64_t n = 0;
+          read_values(&n, 1);
+          return static_cast<std::size_t>(n);
+        }
+
+        template<class T>
+        void write_values(const T* data, std::size_t n)
+        {
+          if (std::fwrite(data, sizeof(T), n, m_file.get()) != n) {
+            throw std::runtime_error("Cannot write the temporary file of the "
+              "pairwise Fuzzy Kappa");
+          }
+        }
+
+        template<class T>
+        void read_values(T* data, std::size_t n)
+        {
+          if (std::fread(data, sizeof(T), n, m_file.get()) != n) {
+            throw std::runtime_error("Cannot read the temporary file of the "
+              "pairwise Fuzzy Kappa");
+          }
+        }
+
+        void seek(std::int64_t position)
+        {
+#if defined(_WIN32)
+          const int failed = _fseeki64(m_file.get(),
+            static_cast<__int64>(position), SEEK_SET);
+#else
+          const int failed = fseeko(m_file.get(),
+            static_cast<off_t>(position), SEEK_SET);
+#endif
+          if (failed) {
+            throw std::runtime_error("Cannot seek in the temporary file of "
+              "the pairwise Fuzzy Kappa");
+          }
+        }
+
+        std::int64_t tell()
+        {
+#if defined(_WIN32)
+          return _ftelli64(m_file.get());
+#else
+          return ftello(m_file.get());
+#endif
+        }
+
+        int m_rows;
+        int m_cols;
+        int m_nCats;
+        Distribution m_empty;
+        std::vector<std::int64_t> m_offsets; // -1 if not written yet
+        std::int64_t m_end;
+        std::unique_ptr<std::FILE, int(*)(std::FILE*)> m_file;
+        std::mutex m_mutex;
+      };
+
+      // Output iterator for the similarity map of a pair, discarding the
+      // values when there is no observer for them
+      template<class PairObserver>
+      struct pair_iterator
+      {
+        typedef double* type;
+      };
+
+      template<>
+      struct pair_iterator<no_pair_observer>
+      {
+        typedef discard_iterator type;
+      };
+
+      // Fuzzy Kappa with map a as map A and map b as map B. The cells are
+      // visited in the same order as by fuzzy_kappa_2009, so the result is
+      // the same.
+      template<class Distribution, class OutIter>
+      bool pairwise_fuzzy_kappa(const pairwise_map<Distribution>& a,
+        const pairwise_map<Distribution>& b, OutIter out_iter,
+        double& fuzzykappa, double& expected_error)
+      {
+        const std::size_t cells = a.categories.size();
+        const int* catsA = a.categories.data();
+        const int* catsB = b.categories.data();
+        double sum = 0;
+        std::int64_t count = 0;
+        for (std::size_t i = 0; i < cells; ++i, ++out_iter) {
+          const int catA = catsA[i];
+          if (catA < 0) {
+            *out_iter = -1; //nodata value
+            continue;
+          }
+          const int catB = catsB[i];
+          const double sim = std::min<double>(
+            a.similarityA[catB].data()[i], b.similarityB[catA].data()[i]);
+          sum += sim;
+          ++count;
+          *out_iter = sim;
+        }
+        return fuzzy_kappa_from_totals(sum, count, a.counts, b.counts,
+          a.distributionA, b.distributionB, fuzzykappa, expected_error, 1);
+      }
+
+      template<class Raster, class RasterMask, class DistanceDecay,
+      class Distributions, class PairObserver>
+      void fuzzy_kappa_2009_pairwise(
+        const std::vector<Raster>& maps, // input: maps to compare
+        const RasterMask& mask,     // input: mask map
+        int nCats,                  // dimension: number of categories in legend
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        const Distributions& distributions, // policy: exact or histograms
+        std::size_t memory_budget,  // parameter: bytes for layers and scratch
+        const parallel_execution& exec, // parameter: number of threads
+        PairObserver& on_pair,      // result: similarity maps per pair
+        matrix<double>& kappas,     // result: kappas[i][j], map i as map A
+        matrix<double>& errors)     // result: bound on error in expected similarity
+      {
+        typedef typename Distributions::distribution_type distribution_type;
+        typedef typename pair_iterator<PairObserver>::type out_iterator;
+        const int n = static_cast<int>(maps.size());
+        kappas.assign(n, std::vector<double>(n, 0));
+        errors.assign(n, std::vector<double>(n, 0));
+        if (n == 0) return;
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(maps[0]));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(maps[0]));
+        const sparse_similarity_matrix sparse(m, nCats, nCats);
+        const distribution_type empty = distributions.make();
+
+        // The maps are split in groups. Pairs are processed per pair of
+        // groups, for which the maps of both groups must be loaded, so a
+        // group is at most half the number of maps that fit in memory. 
+        // Besides the loaded maps, the budget must hold the scratch of the
+        // maps that are prepared at the same time, or the similarity maps
+        // of the pairs that are compared at the same time. Fewer maps are
+        // prepared at the same time if that is what it takes to hold two 
+        // maps.
+        const std::size_t cells = static_cast<std::size_t>(rows) * cols;
+        const std::size_t bytes = pairwise_map_bytes(cells, nCats, empty);
+        const std::size_t scratch = prepare_scratch_bytes(empty, cells, nCats);
+        const std::size_t output = pair_output_bytes(on_pair, cells);
+        const int threads = exec.threads();
+        const std::size_t minimum = std::min(n, 2) * bytes 
+          + std::max(scratch, threads * output);
+        if (memory_budget < minimum) {
+          throw std::invalid_argument("fuzzy_kappa_2009_pairwise: a memory "
+            "budget of " + std::to_string(memory_budget) + " bytes can not "
+            "hold two maps, " + std::to_string(minimum) + " bytes needed");
+        }
+        const int prepare_threads = static_cast<int>(std::min<std::size_t>(
+          threads, (memory_budget - std::min(n, 2) * bytes)
+          / std::max<std::size_t>(1, scratch)));
+        const std::size_t transient = std::max(prepare_threads * scratch,
+          threads * output);
+        const int capacity = static_cast<int>(std::min<std::size_t>(n,
+          (memory_budget - transient) / bytes));
+        const int group = capacity >= n ? n : capacity / 2;
+        const int groups = (n + group - 1) / group;
+
+        // With more than one group, prepared maps go to a temporary file so
+        // that they are read back instead of prepared again
+        std::vector<std::shared_ptr<pairwise_map<distribution_type> > >
+          loaded(n);
+        std::unique_ptr<pairwise_map_store<distribution_type> > store;
+        if (groups > 1) {
+          store.reset(new pairwise_map_store<distribution_type>(n, rows, cols,
+            nCats, empty));
+        }
+        auto load = [&](int g_first, int g_second) {
+          // Unload the maps outside both groups, and load the missing ones
+          std::vector<int> missing;
+          for (int i = 0; i < n; ++i) {
+            const int g = i / group;
+            if (g != g_first && g != g_second) {
+              loaded[i].reset();
+            }
+            else if (!loaded[i]) {
+              missing.push_back(i);
+            }
+          }
+          parallel_for(0, static_cast<int>(missing.size()), prepare_threads, 1,
+            [&](int begin, int end) {
+            for (int k = begin; k < end; ++k) {
+              const int i = missing[k];
+              if (store && store->contains(i)) {
+                loaded[i] = store->read(i);
+                continue;
+              }
+              loaded[i] = prepare_pairwise_map(maps[i], mask, sparse, f,
+                empty);
+              if (store) store->write(i, *loaded[i]);
+            }
+          });
+        };
+
+        // Going back and forth over the groups of j keeps the last group
+        // of a row loaded for the next row
+        for (int gi = 0; gi < groups; ++gi) {
+          const int i_begin = gi * group;
+          const int i_end = std::min(n, i_begin + group);
+          for (int step = 0; step < groups; ++step) {
+            const int gj = gi % 2 == 0 ? step : groups - 1 - step;
+            const int j_begin = gj * group;
+            const int j_end = std::min(n, j_begin + group);
+            load(gi, gj);
+
+            const int nj = j_end - j_begin;
+            const int pairs = (i_end - i_begin) * nj;
+            parallel_for(0, pairs, exec.threads(), 1, [&](int begin, int end) {
+              for (int p = begin; p < end; ++p) {
+                const int i = i_begin + p / nj;
+                const int j = j_begin + p % nj;
+                std::unique_ptr<memory_raster<double> > comparison;
+                out_iterator out = pair_output<out_iterator>(on_pair,
+                  comparison, rows, cols);
+                pairwise_fuzzy_kappa(*loaded[i], *loaded[j], out,
+                  kappas[i][j], errors[i][j]);
+                notify_pair(on_pair, i, j, comparison);
+              }
+            });
+          }
+        }
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa for all ordered pairs of maps with the same legend,
+    // kappas[i][j] has map i as map A and map j as map B. The results are
+    // the same as those of fuzzy_kappa_2009.
+    // The per-map layers take about rows * cols * (4 + 16 * nCats) bytes per
+    // map, and the exact distributions up to twice as much. Preparing a map
+    // takes up to rows * cols * (16 * nCats + 32) bytes more while it runs,
+    // and each similarity map given to on_pair rows * cols * 8 bytes. 
+    // memory_budget bounds the sum of these estimates. Each map is prepared
+    // once. If not all maps fit, maps are processed in groups, and the
+    // prepared maps are kept in a temporary file and read back as needed.
+    // A budget that can not hold two maps and the scratch of one throws
+    // std::invalid_argument. A temporary file that can not be created,
+    // written or read throws std::runtime_error.
+    //
+    template<class Raster, class RasterMask, class DistanceDecay>
+    void fuzzy_kappa_2009_pairwise(
+      const std::vector<Raster>& maps, // input: maps to compare
+      const RasterMask& mask,     // input: mask map
+      int nCats,                  // dimension: number of categories in legend
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      std::size_t memory_budget,  // parameter: bytes for layers and scratch
+      const parallel_execution& exec, // parameter: number of threads
+      matrix<double>& kappas)     // result: kappas[i][j], map i as map A
+    {
+      no_pair_observer on_pair;
+      matrix<double> errors; // always 0 for exact distributions
+      detail::fuzzy_kappa_2009_pairwise(maps, mask, nCats, m, f,
+        exact_distributions{}, memory_budget, exec, on_pair, kappas, errors);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, also passing the similarity map of each pair to
+    // on_pair(i, j, comparison). It is called from the worker threads.
+    //
+    template<class Raster, class RasterMask, class DistanceDecay,
+    class PairObserver>
+    void fuzzy_kappa_2009_pairwise(
+      const std::vector<Raster>& maps, // input: maps to compare
+      const RasterMask& mask,     // input: mask map
+      int nCats,                  // dimension: number of categories in legend
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      std::size_t memory_budget,  // parameter: bytes for layers and scratch
+      const parallel_execution& exec, // parameter: number of threads
+      PairObserver on_pair,       // result: similarity maps per pair
+      matrix<double>& kappas)     // result: kappas[i][j], map i as map A
+    {
+      matrix<double> errors; // always 0 for exact distributions
+      detail::fuzzy_kappa_2009_pairwise(maps, mask, nCats, m, f,
+        exact_distributions{}, memory_budget, exec, on_pair, kappas, errors);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Approximate pairwise Fuzzy Kappa, see the approximate fuzzy_kappa_2009
+    //
+    template<class Raster, class RasterMask, class DistanceDecay>
+    void fuzzy_kappa_2009_pairwise(
+      const std::vector<Raster>& maps, // input: maps to compare
+      const RasterMask& mask,     // input: mask map
+      int nCats,                  // dimension: number of categories in legend
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      const histogram_distributions& histograms, // parameter: number of bins
+      std::size_t memory_budget,  // parameter: bytes for layers and scratch
+      const parallel_execution& exec, // parameter: number of threads
+      matrix<double>& kappas,     // result: kappas[i][j], map i as map A
+      matrix<double>& errors)     // result: bound on error in expected similarity
+    {
+      no_pair_observer on_pair;
+      detail::fuzzy_kappa_2009_pairwise(maps, mask, nCats, m, f, histograms,
+        memory_budget, exec, on_pair, kappas, errors);
+    }
+  }
+}
+#endif
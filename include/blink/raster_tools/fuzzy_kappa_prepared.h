@@ -0,0 +1,330 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa for comparing one reference map against many other maps.
+// The similarity of the reference map to the categories of the other
+// legend, and its distributions of similarity values, only depend on the
+// reference map, the mask, the similarity matrix and the distance decay
+// function. A prepared_map computes them once, so each comparison only
+// needs the distance transforms of the other map.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_PREPARED_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_PREPARED_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/parallel.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    namespace detail
+    {
+      // The categories of a map inside the mask, -1 outside
+      template<class Raster, class RasterMask>
+      memory_raster<int> masked_categories(const Raster& map,
+        const RasterMask& mask)
+      {
+        memory_raster<int> categories(
+          static_cast<int>(blink::raster::raster_operations::size1(map)),
+          static_cast<int>(blink::raster::raster_operations::size2(map)));
+        auto map_iter = map.begin();
+        auto mask_iter = mask.begin();
+        for (auto&& i : categories) {
+          i = *mask_iter ? static_cast<int>(*map_iter) : -1;
+          ++map_iter;
+          ++mask_iter;
+        }
+        return categories;
+      }
+
+      // The similarity of a map to the categories of the other map, from its
+      // decayed distances. first tells if the map is map A or map B.
+      inline std::vector<memory_raster<double> > similarity_layers(
+        const std::vector<memory_raster<double> >& distances,
+        const sparse_similarity_matrix& m, bool first, int rows, int cols)
+      {
+        const std::size_t n = static_cast<std::size_t>(cols);
+        const int nOther = first ? m.m_nCatsB : m.m_nCatsA;
+        std::vector<memory_raster<double> > similarity;
+        for (int other = 0; other < nOther; ++other) {
+          similarity.emplace_back(rows, cols);
+        }
+        std::vector<const double*> d(distances.size());
+        for (int r = 0; r < rows; ++r) {
+          for (std::size_t cat = 0; cat < distances.size(); ++cat) {
+            d[cat] = distances[cat].row(r);
+          }
+          for (int other = 0; other < nOther; ++other) {
+            if (first) {
+              similarity_row_a(m, other, d, n, similarity[other].row(r));
+            }
+            else {
+              similarity_row_b(m, other, d, n, similarity[other].row(r));
+            }
+          }
+        }
+        return similarity;
+      }
+
+      // The cells per category and the distributions of the similarity to 
+      // the categories of the other map, compacted
+      template<class Distribution>
+      void side_totals(const memory_raster<int>& categories,
+        const std::vector<memory_raster<double> >& similarity,
+        std::vector<std::int64_t>& counts,
+        std::vector< std::vector<Distribution> >& distribution)
+      {
+        const int nOther = static_cast<int>(similarity.size());
+        for (std::size_t i = 0; i < categories.size(); ++i) {
+          const int cat = categories.data()[i];
+          if (cat < 0) continue;
+          ++counts[cat];
+          for (int other = 0; other < nOther; ++other) {
+            distribution[cat][other].add(similarity[other].data()[i]);
+          }
+        }
+        for (auto&& row : distribution) {
+          for (auto&& d : row) d.compact();
+        }
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // A reference map, prepared to be compared as the first map (map A)
+    // against any number of second maps with the same dimensions, mask and
+    // legend.
+    //
+    template<class DistanceDecay, class Distributions = exact_distributions>
+    class prepared_map
+    {
+    public:
+      typedef typename Distributions::distribution_type distribution_type;
+
+      template<class RasterA, class RasterMask>
+      prepared_map(
+        const RasterA& mapA,        // input: the reference map
+        const RasterMask& mask,     // input: mask map
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        const Distributions& distributions = Distributions{})
+        : m_rows(static_cast<int>(blink::raster::raster_operations::size1(mapA)))
+        , m_cols(static_cast<int>(blink::raster::raster_operations::size2(mapA)))
+        , m_sparse(m, nCatsA, nCatsB), m_f(f), m_distributions(distributions)
+        , m_categories(detail::masked_categories(mapA, mask))
+        , m_counts(nCatsA, 0)
+        , m_distribution(nCatsA,
+          std::vector<distribution_type>(nCatsB, distributions.make()))
+      {
+        std::vector<memory_raster<double> > distancesA;
+        for (int catA = 0; catA < nCatsA; ++catA) {
+          distancesA.emplace_back(m_rows, m_cols);
+        }
+        detail::decayed_distances(mapA, distancesA, nCatsA, f);
+        m_similarity = detail::similarity_layers(distancesA, m_sparse, true,
+          m_rows, m_cols);
+        detail::side_totals(m_categories, m_similarity, m_counts,
+          m_distribution);
+      }
+
+      int m_rows;
+      int m_cols;
+      sparse_similarity_matrix m_sparse;
+      DistanceDecay m_f;
+      Distributions m_distributions;
+      memory_raster<int> m_categories;            // -1 outside the mask
+      std::vector<memory_raster<double> > m_similarity; // per category of B
+      std::vector<std::int64_t> m_counts;         // cells per category
+      std::vector< std::vector<distribution_type> > m_distribution;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Convenience function to deduce the type of the distance decay function
+    //
+    template<class RasterA, class RasterMask, class DistanceDecay>
+    prepared_map<DistanceDecay> make_prepared_map(const RasterA& mapA,
+      const RasterMask& mask, int nCatsA, int nCatsB, const matrix<double>& m,
+      DistanceDecay f)
+    {
+      return prepared_map<DistanceDecay>(mapA, mask, nCatsA, nCatsB, m, f);
+    }
+
+    template<class RasterA, class RasterMask, class DistanceDecay>
+    prepared_map<DistanceDecay, histogram_distributions> make_prepared_map(
+      const RasterA& mapA, const RasterMask& mask, int nCatsA, int nCatsB,
+      const matrix<double>& m, DistanceDecay f,
+      const histogram_distributions& histograms)
+    {
+      return prepared_map<DistanceDecay, histogram_distributions>(mapA, mask,
+        nCatsA, nCatsB, m, f, histograms);
+    }
+
+    namespace detail
+    {
+      // The cell loop against a prepared map. Only the totals of map B are
+      // collected, those of map A come from the prepared map. Cells are
+      // processed in the same order as by fuzzy_kappa_2009, so the result is
+      // the same.
+      template<class DistanceDecay, class Distributions, class RasterB,
+      class OutIter>
+      bool fuzzy_kappa_2009_prepared(
+        const prepared_map<DistanceDecay, Distributions>& reference,
+        RasterB& mapB,              // input: second map
+        OutIter out_iter,           // result: similarity map
+        double& fuzzykappa,         // result: improved fuzzy kappa
+        double& expected_error)     // result: bound on error in expected similarity
+      {
+        typedef typename Distributions::distribution_type distribution_type;
+        const sparse_similarity_matrix& sparse = reference.m_sparse;
+        const int nCatsA = sparse.m_nCatsA;
+        const int nCatsB = sparse.m_nCatsB;
+        const int rows = reference.m_rows;
+        const int cols = reference.m_cols;
+        const std::size_t n = static_cast<std::size_t>(cols);
+
+        std::vector<memory_raster<double> > distancesB;
+        for (int catB = 0; catB < nCatsB; ++catB) {
+          distancesB.emplace_back(rows, cols);
+        }
+        decayed_distances(mapB, distancesB, nCatsB, reference.m_f);
+
+        double sum = 0;
+        std::int64_t count = 0;
+        std::vector<std::int64_t> countsB(nCatsB, 0);
+        std::vector< std::vector<distribution_type> > distributionB(nCatsB,
+          std::vector<distribution_type>(nCatsA,
+          reference.m_distributions.make()));
+
+        std::vector<const double*> db(nCatsB);
+        std::vector<double> simB(nCatsA * n);
+        auto b_iter = mapB.begin();
+        for (int r = 0; r < rows; ++r) {
+          for (int catB = 0; catB < nCatsB; ++catB) {
+            db[catB] = distancesB[catB].row(r);
+          }
+          for (int catA = 0; catA < nCatsA; ++catA) {
+            similarity_row_b(sparse, catA, db, n, &simB[catA * n]);
+          }
+          const int* cat_row = reference.m_categories.row(r);
+          for (std::size_t c = 0; c < n; ++c, ++b_iter, ++out_iter) {
+            const int catA = cat_row[c];
+            if (catA < 0) {
+              *out_iter = -1; //nodata value
+              continue;
+            }
+            const int catB = static_cast<int>(*b_iter);
+            const double simA = reference.m_similarity[catB].row(r)[c];
+            const double sim = std::min<double>(simA, simB[catA * n + c]);
+            sum += sim;
+            ++count;
+            ++countsB[catB];
+            for (int a = 0; a < nCatsA; ++a) {
+              distributionB[catB][a].add(simB[a * n + c]);
+            }
+            *out_iter = sim;
+          }
+        }
+        for (auto&& row : distributionB) {
+          for (auto&& d : row) d.compact();
+        }
+        return fuzzy_kappa_from_totals(sum, count, reference.m_counts, countsB,
+          reference.m_distribution, distributionB, fuzzykappa, expected_error,
+          1);
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa of a prepared reference map (map A) and a second map. The
+    // result is the same as fuzzy_kappa_2009 with the arguments used to
+    // prepare the reference map.
+    //
+    template<class DistanceDecay, class Distributions, class RasterB,
+    class RasterOut>
+    bool fuzzy_kappa_2009(
+      const prepared_map<DistanceDecay, Distributions>& reference,
+      RasterB& mapB,              // input: second map
+      RasterOut& comparison,      // result: similarity map
+      double& fuzzykappa,         // result: improved fuzzy kappa
+      double& expected_error)     // result: bound on error in expected similarity
+    {
+      return detail::fuzzy_kappa_2009_prepared(reference, mapB,
+        comparison.begin(), fuzzykappa, expected_error);
+    }
+
+    template<class DistanceDecay, class RasterB, class RasterOut>
+    bool fuzzy_kappa_2009(
+      const prepared_map<DistanceDecay, exact_distributions>& reference,
+      RasterB& mapB,              // input: second map
+      RasterOut& comparison,      // result: similarity map
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009_prepared(reference, mapB,
+        comparison.begin(), fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Compare a prepared reference map against a sequence of maps, and write
+    // their Fuzzy Kappa to result. Maps are read one at a time, so the
+    // sequence may be generated on the fly. Returns the iterator past the
+    // last result.
+    //
+    template<class DistanceDecay, class Distributions, class InputIter,
+    class OutputIter>
+    OutputIter fuzzy_kappa_2009_batch(
+      const prepared_map<DistanceDecay, Distributions>& reference,
+      InputIter first, InputIter last, // input: second maps
+      OutputIter result)               // result: improved fuzzy kappa
+    {
+      for (; first != last; ++first, ++result) {
+        auto&& mapB = *first;
+        double fuzzykappa;
+        double expected_error;
+        detail::fuzzy_kappa_2009_prepared(reference, mapB,
+          detail::discard_iterator{}, fuzzykappa, expected_error);
+        *result = fuzzykappa;
+      }
+      return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, comparing a number of maps at the same time. The maps are
+    // taken from a random access range.
+    //
+    template<class DistanceDecay, class Distributions, class RandomIter,
+    class OutputIter>
+    OutputIter fuzzy_kappa_2009_batch(
+      const prepared_map<DistanceDecay, Distributions>& reference,
+      RandomIter first, RandomIter last, // input: second maps
+      OutputIter result,                 // result: improved fuzzy kappa
+      const parallel_execution& exec)    // parameter: number of threads
+    {
+      const int n = static_cast<int>(std::distance(first, last));
+      std::vector<double> kappas(n);
+      detail::parallel_for(0, n, exec.threads(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+          auto&& mapB = first[i];
+          double expected_error;
+          detail::fuzzy_kappa_2009_prepared(reference, mapB,
+            detail::discard_iterator{}, kappas[i], expected_error);
+        }
+      });
+      return std::copy(kappas.begin(), kappas.end(), result);
+    }
+  }
+}
+#endif
@@ -0,0 +1,204 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa for maps that are too large to hold all intermediate layers
+// in memory. The maps are processed in horizontal bands. Each band is
+// extended by a halo of rows as wide as the cutoff radius of the distance
+// decay function, which is enough to find all targets within that radius.
+// Decay functions without a cutoff radius are rejected, as every band would
+// need the whole map.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_STREAMING_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_STREAMING_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+    namespace detail
+    {
+      // Copy rows [r_begin, r_end) of a raster into a memory raster of
+      // r_end - r_begin rows
+      template<class Raster, class T>
+      void copy_rows(Raster& in, int r_begin, int r_end, memory_raster<T>& out)
+      {
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(in));
+        auto i = in.begin() + static_cast<std::ptrdiff_t>(r_begin) * cols;
+        T* o = out.data();
+        for (std::size_t n = static_cast<std::size_t>(r_end - r_begin) * cols;
+          n > 0; --n, ++i, ++o) {
+          *o = static_cast<T>(*i);
+        }
+      }
+
+      template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+      class DistanceDecay, class Distributions>
+      bool fuzzy_kappa_2009_streaming(
+        RasterA& mapA,              // input: first map
+        RasterB& mapB,              // input: second map
+        RasterMask& mask,           // input: mask map
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        RasterOut& comparison,      // result: similarity map
+        int band_rows,              // parameter: number of rows per band
+        const Distributions& distributions, // policy: exact or histograms
+        double& fuzzykappa,         // result: improved fuzzy kappa
+        double& expected_error)     // result: bound on error in expected similarity
+      {
+        using a_value = blink::raster::raster_traits::value_type<RasterA>;
+        using b_value = blink::raster::raster_traits::value_type<RasterB>;
+        const int rows = static_cast<int>(blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(blink::raster::raster_operations::size2(mapA));
+        band_rows = std::max(1, std::min(band_rows, rows)); // no overflow below
+
+        const double cutoff = detail::cutoff_radius(f, 0);
+        if (std::isinf(cutoff)) {
+          throw std::invalid_argument("fuzzy_kappa_2009_streaming needs a "
+            "distance decay function with a cutoff radius, such as "
+            "exponential_decay with a threshold");
+        }
+        const int halo = cutoff < rows ? static_cast<int>(std::ceil(cutoff)) : rows;
+
+        // The band-local rasters reuse one block of the arena, sized for the
+        // largest band, band_rows + 2 * halo rows, and the vectors holding
+        // the layers are reused across bands. decayed_distances still 
+        // allocates its flags per category and its decay table per band.
+        const std::size_t largest = static_cast<std::size_t>(
+          std::min(rows, band_rows + 2 * halo)) * cols;
+        auto aligned = [](std::size_t bytes) {
+          const std::size_t a = memory_arena::alignment;
+          return (bytes + a - 1) / a * a;
+        };
+        const std::size_t band_bytes = aligned(largest * sizeof(a_value))
+          + aligned(largest * sizeof(b_value))
+          + (nCatsA + nCatsB) * aligned(largest * sizeof(double));
+        std::shared_ptr<memory_arena> arena =
+          std::make_shared<memory_arena>(band_bytes);
+        distance_transform_workspace workspace(rows, cols);
+
+        const std::size_t n = static_cast<std::size_t>(cols);
+        const sparse_similarity_matrix sparse(m, nCatsA, nCatsB);
+        fuzzy_kappa_accumulator<typename Distributions::distribution_type>
+          accumulator(nCatsA, nCatsB, distributions.make());
+        std::vector<const double*> da(nCatsA);
+        std::vector<const double*> db(nCatsB);
+        std::vector<double> simA(nCatsB * n);
+        std::vector<double> simB(nCatsA * n);
+        std::vector<memory_raster<double> > distancesA;
+        std::vector<memory_raster<double> > distancesB;
+        distancesA.reserve(nCatsA);
+        distancesB.reserve(nCatsB);
+
+        auto mask_iter = mask.begin();
+        auto out_iter = comparison.begin();
+        for (int band_begin = 0; band_begin < rows; band_begin += band_rows) {
+          const int band_end = std::min(rows, band_begin + band_rows);
+          const int first = std::max(0, band_begin - halo);
+          const int last = std::min(rows, band_end + halo);
+
+          distancesA.clear(); // gives the block of the last band back
+          distancesB.clear();
+          memory_raster<a_value> localA(last - first, cols, arena);
+          memory_raster<b_value> localB(last - first, cols, arena);
+          copy_rows(mapA, first, last, localA);
+          copy_rows(mapB, first, last, localB);
+
+          for (int catA = 0; catA < nCatsA; ++catA) {
+            distancesA.emplace_back(last - first, cols, arena);
+          }
+          for (int catB = 0; catB < nCatsB; ++catB) {
+            distancesB.emplace_back(last - first, cols, arena);
+          }
+          decayed_distances(localA, distancesA, nCatsA, f, workspace);
+          decayed_distances(localB, distancesB, nCatsB, f, workspace);
+
+          for (int r = band_begin; r < band_end; ++r) {
+            const int local_r = r - first;
+            for (int catA = 0; catA < nCatsA; ++catA) {
+              da[catA] = distancesA[catA].row(local_r);
+            }
+            for (int catB = 0; catB < nCatsB; ++catB) {
+              db[catB] = distancesB[catB].row(local_r);
+            }
+            similarity_rows(sparse, da, db, cols, simA.data(), simB.data());
+            const a_value* a_iter = localA.row(local_r);
+            const b_value* b_iter = localB.row(local_r);
+            accumulate_row(accumulator, simA.data(), simB.data(), cols, 
+              a_iter, b_iter, mask_iter, out_iter);
+          }
+        }
+        return accumulator.fuzzy_kappa(fuzzykappa, expected_error);
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa evaluated band by band. Only the band-local distance layers
+    // are kept, so memory is in the order of (band_rows + 2 * halo) * cols *
+    // (nCatsA + nCatsB) instead of rows * cols * (nCatsA + nCatsB). The halo
+    // is the cutoff radius of the distance decay function. Functions without
+    // one, such as exponential_decay without a threshold, would need the 
+    // whole map for every band and throw std::invalid_argument. The 
+    // comparison map is written band by band. The result is the same as 
+    // fuzzy_kappa_2009.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay>
+      bool fuzzy_kappa_2009_streaming(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      int band_rows,              // parameter: number of rows per band
+      double& fuzzykappa)         // result: improved fuzzy kappa
+    {
+      double expected_error; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009_streaming(mapA, mapB, mask, nCatsA,
+        nCatsB, m, f, comparison, band_rows, exact_distributions{},
+        fuzzykappa, expected_error);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, with the similarity values binned into histograms, see the
+    // approximate fuzzy_kappa_2009.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay>
+      bool fuzzy_kappa_2009_streaming(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      int band_rows,              // parameter: number of rows per band
+      const histogram_distributions& histograms, // parameter: number of bins
+      double& fuzzykappa,         // result: approximate improved fuzzy kappa
+      double& expected_error)     // result: bound on error in expected similarity
+    {
+      return detail::fuzzy_kappa_2009_streaming(mapA, mapB, mask, nCatsA,
+        nCatsB, m, f, comparison, band_rows, histograms, fuzzykappa,
+        expected_error);
+    }
+  }
+}
+#endif
@@ -0,0 +1,264 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa for a number of distance decay functions at once, for
+// sensitivity analysis of the decay parameters. The distance transforms do
+// not depend on the decay function, so they are done only once. The
+// squared distances are kept and each decay function is applied to them
+// row by row, in a single pass over the cells.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_SWEEP_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_SWEEP_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+    namespace detail
+    {
+      // A distance decay function with its table of decayed squared
+      // distances, see decay_table
+      template<class DistanceDecay>
+      struct decay_setting
+      {
+        decay_setting(const DistanceDecay& f, double max_squared)
+          : f(f), table(decay_table(f, max_squared < max_decay_table
+          ? static_cast<std::size_t>(max_squared) + 1
+          : static_cast<std::size_t>(max_decay_table)))
+        {
+        }
+
+        // out[i] = f(sqrt(squared[i]))
+        void apply(const double* squared, std::size_t n, double* out) const
+        {
+          std::copy(squared, squared + n, out);
+          if (lookup(out, n, table.data(), table.size()) > 0) {
+            const double size = static_cast<double>(table.size());
+            for (std::size_t i = 0; i < n; ++i) {
+              const double k = squared[i];
+              out[i] = k < size ? table[static_cast<std::size_t>(k)]
+                : f(std::sqrt(k));
+            }
+          }
+        }
+
+        DistanceDecay f;
+        std::vector<double> table;
+      };
+
+      template<class RasterA, class RasterB, class RasterMask, class OutIter,
+      class DistanceDecay, class RasterMaker, class Distributions>
+      std::vector<bool> fuzzy_kappa_2009_sweep(
+        RasterA& mapA,              // input: first map
+        RasterB& mapB,              // input: second map
+        RasterMask& mask,           // input: mask map
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        const std::vector<DistanceDecay>& fs, // parameter: distance decay functions
+        std::vector<OutIter> out_iters, // result: similarity maps
+        RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+        const Distributions& distributions, // policy: exact or histograms
+        std::vector<double>& fuzzykappas,     // result: improved fuzzy kappa
+        std::vector<double>& expected_errors) // result: bound on error in expected similarity
+      {
+        using temp_raster = typename RasterMaker::template raster_type<double>;
+        typedef typename Distributions::distribution_type distribution_type;
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(mapA));
+        const std::size_t n = static_cast<std::size_t>(cols);
+        const int nSettings = static_cast<int>(fs.size());
+
+        // The distances are resolved up to the largest cutoff radius
+        double cutoff = 0;
+        for (auto&& f : fs) {
+          cutoff = std::max(cutoff, detail::cutoff_radius(f, 0));
+        }
+
+        std::vector<temp_raster> distancesA;
+        std::vector<temp_raster> distancesB;
+        for (int catA = 0; catA < nCatsA; ++catA) {
+          distancesA.emplace_back(maker.template create<double>(mapA));
+        }
+        for (int catB = 0; catB < nCatsB; catB++) {
+          distancesB.emplace_back(maker.template create<double>(mapB));
+        }
+        distance_transform_workspace workspace;
+        double max_squaredA, max_squaredB;
+        const std::vector<bool> has_catA = squared_distances(mapA, distancesA,
+          nCatsA, cutoff, max_squaredA, workspace);
+        const std::vector<bool> has_catB = squared_distances(mapB, distancesB,
+          nCatsB, cutoff, max_squaredB, workspace);
+
+        std::vector<decay_setting<DistanceDecay> > settings;
+        std::vector<cell_loop_state<distribution_type> > states;
+        for (auto&& f : fs) {
+          settings.emplace_back(f, std::max(max_squaredA, max_squaredB));
+          states.emplace_back(nCatsA, nCatsB, cols, distributions.make());
+        }
+
+        // The squared distances, categories and mask of a row are read once
+        // for all decay functions. Absent categories have similarity 0.
+        std::vector<double> squaredA(nCatsA * n);
+        std::vector<double> squaredB(nCatsB * n);
+        std::vector<const double*> sa(nCatsA);
+        std::vector<const double*> sb(nCatsB);
+        const std::vector<double> zeros(n, 0.0);
+        std::vector<int> rowA(n);
+        std::vector<int> rowB(n);
+        std::vector<char> rowMask(n);
+
+        const sparse_similarity_matrix sparse(m, nCatsA, nCatsB);
+        auto a_iter = mapA.begin();
+        auto b_iter = mapB.begin();
+        auto mask_iter = mask.begin();
+        for (int r = 0; r < rows; ++r) {
+          for (int catA = 0; catA < nCatsA; ++catA) {
+            sa[catA] = layer_row(distancesA[catA], r, cols, &squaredA[catA * n]);
+          }
+          for (int catB = 0; catB < nCatsB; ++catB) {
+            sb[catB] = layer_row(distancesB[catB], r, cols, &squaredB[catB * n]);
+          }
+          for (std::size_t c = 0; c < n; ++c, ++a_iter, ++b_iter, ++mask_iter) {
+            rowA[c] = static_cast<int>(*a_iter);
+            rowB[c] = static_cast<int>(*b_iter);
+            rowMask[c] = *mask_iter ? 1 : 0;
+          }
+
+          for (int k = 0; k < nSettings; ++k) {
+            cell_loop_state<distribution_type>& state = states[k];
+            for (int catA = 0; catA < nCatsA; ++catA) {
+              if (has_catA[catA]) {
+                settings[k].apply(sa[catA], n, &state.bufferA[catA * n]);
+                state.da[catA] = &state.bufferA[catA * n];
+              }
+              else {
+                state.da[catA] = zeros.data();
+              }
+            }
+            for (int catB = 0; catB < nCatsB; ++catB) {
+              if (has_catB[catB]) {
+                settings[k].apply(sb[catB], n, &state.bufferB[catB * n]);
+                state.db[catB] = &state.bufferB[catB * n];
+              }
+              else {
+                state.db[catB] = zeros.data();
+              }
+            }
+            similarity_rows(sparse, state.da, state.db, cols,
+              state.simA.data(), state.simB.data());
+            const int* a = rowA.data();
+            const int* b = rowB.data();
+            const char* in_mask = rowMask.data();
+            accumulate_row(state.accumulator, state.simA.data(),
+              state.simB.data(), cols, a, b, in_mask, out_iters[k]);
+          }
+        }
+
+        std::vector<bool> result(nSettings);
+        fuzzykappas.assign(nSettings, 0);
+        expected_errors.assign(nSettings, 0);
+        for (int k = 0; k < nSettings; ++k) {
+          result[k] = states[k].accumulator.fuzzy_kappa(fuzzykappas[k],
+            expected_errors[k]);
+        }
+        return result;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa for each of a number of distance decay functions, as if
+    // fuzzy_kappa_2009 is called for each of them, but with only one
+    // distance transform per category. Memory for the cell loop grows with
+    // the number of functions: (nCatsA + nCatsB) row buffers and a set of
+    // distributions per function. Element k of the result is false if
+    // fuzzykappas[k] is 0 or 1 because there are no cells to compare or all
+    // cells are identical.
+    //
+    template<class RasterA, class RasterB, class RasterMask,
+    class DistanceDecay, class RasterMaker>
+      std::vector<bool> fuzzy_kappa_2009_sweep(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      const std::vector<DistanceDecay>& fs, // parameter: distance decay functions
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      std::vector<double>& fuzzykappas) // result: improved fuzzy kappa per function
+    {
+      std::vector<double> expected_errors; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009_sweep(mapA, mapB, mask, nCatsA, nCatsB,
+        m, fs, std::vector<detail::discard_iterator>(fs.size()), maker,
+        exact_distributions{}, fuzzykappas, expected_errors);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, also writing the similarity map per function. There must be
+    // as many comparison maps as functions.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      std::vector<bool> fuzzy_kappa_2009_sweep(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      const std::vector<DistanceDecay>& fs, // parameter: distance decay functions
+      std::vector<RasterOut>& comparisons, // result: similarity map per function
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      std::vector<double>& fuzzykappas) // result: improved fuzzy kappa per function
+    {
+      std::vector<decltype(comparisons.front().begin())> out_iters;
+      for (auto&& comparison : comparisons) {
+        out_iters.push_back(comparison.begin());
+      }
+      std::vector<double> expected_errors; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009_sweep(mapA, mapB, mask, nCatsA, nCatsB,
+        m, fs, out_iters, maker, exact_distributions{}, fuzzykappas,
+        expected_errors);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, with the similarity values binned into histograms, see the
+    // approximate fuzzy_kappa_2009.
+    //
+    template<class RasterA, class RasterB, class RasterMask, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      std::vector<bool> fuzzy_kappa_2009_sweep(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterMask& mask,           // input: mask map
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      const std::vector<DistanceDecay>& fs, // parameter: distance decay functions
+      std::vector<RasterOut>& comparisons, // result: similarity map per function
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const histogram_distributions& histograms, // parameter: number of bins
+      std::vector<double>& fuzzykappas,     // result: approximate improved fuzzy kappa
+      std::vector<double>& expected_errors) // result: bound on error in expected similarity
+    {
+      std::vector<decltype(comparisons.front().begin())> out_iters;
+      for (auto&& comparison : comparisons) {
+        out_iters.push_back(comparison.begin());
+      }
+      return detail::fuzzy_kappa_2009_sweep(mapA, mapB, mask, nCatsA, nCatsB,
+        m, fs, out_iters, maker, histograms, fuzzykappas, expected_errors);
+    }
+  }
+}
+#endif
@@ -0,0 +1,179 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Fuzzy Kappa per zone, for example per administrative region. The mask
+// holds zone ids instead of a yes / no value. The distance transforms are
+// over the whole map, so that similarity is not cut off at the zone
+// boundaries, and the cells are added to the totals of their zone.
+
+#ifndef BLINK_RASTER_TOOLS_FUZZY_KAPPA_ZONAL_H_AHZ
+#define BLINK_RASTER_TOOLS_FUZZY_KAPPA_ZONAL_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster/raster_traits.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+    namespace detail
+    {
+      template<class RasterA, class RasterB, class RasterZones,
+      class RasterOut, class DistanceDecay, class RasterMaker,
+      class Distributions>
+      std::vector<bool> fuzzy_kappa_2009_zonal(
+        RasterA& mapA,              // input: first map
+        RasterB& mapB,              // input: second map
+        RasterZones& zones,         // input: zone map, 1..nZones, 0 is excluded
+        int nCatsA, int nCatsB,     // dimension: number of categories in legends
+        int nZones,                 // dimension: number of zones
+        const matrix<double>& m,    // parameter: categorical similarity matrix
+        DistanceDecay f,            // parameter: distance decay function
+        RasterOut& comparison,      // result: similarity map
+        RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+        const Distributions& distributions, // policy: exact or histograms
+        std::vector<double>& fuzzykappas,     // result: improved fuzzy kappa per zone
+        std::vector<double>& expected_errors) // result: bound on error in expected similarity
+      {
+        using temp_raster = typename RasterMaker::template raster_type<double>;
+        typedef typename Distributions::distribution_type distribution_type;
+        const int rows = static_cast<int>(
+          blink::raster::raster_operations::size1(mapA));
+        const int cols = static_cast<int>(
+          blink::raster::raster_operations::size2(mapA));
+        const std::size_t n = static_cast<std::size_t>(cols);
+
+        std::vector<temp_raster> distancesA;
+        std::vector<temp_raster> distancesB;
+        for (int catA = 0; catA < nCatsA; ++catA) {
+          distancesA.emplace_back(maker.template create<double>(mapA));
+        }
+        for (int catB = 0; catB < nCatsB; catB++) {
+          distancesB.emplace_back(maker.template create<double>(mapB));
+        }
+        distance_transform_workspace workspace;
+        decayed_distances(mapA, distancesA, nCatsA, f, workspace);
+        decayed_distances(mapB, distancesB, nCatsB, f, workspace);
+
+        // One accumulator per zone, the overall totals are merged from these
+        // after the cell loop. Accumulator 0 stays empty.
+        const sparse_similarity_matrix sparse(m, nCatsA, nCatsB);
+        std::vector<fuzzy_kappa_accumulator<distribution_type> > accumulators(
+          nZones + 1, fuzzy_kappa_accumulator<distribution_type>(nCatsA,
+          nCatsB, distributions.make()));
+        cell_loop_state<distribution_type> state(nCatsA, nCatsB, cols,
+          distributions.make());
+        double sum = 0; // over all zones, in the order of the cells
+
+        auto a_iter = mapA.begin();
+        auto b_iter = mapB.begin();
+        auto zone_iter = zones.begin();
+        auto out_iter = comparison.begin();
+        for (int r = 0; r < rows; ++r) {
+          for (int catA = 0; catA < nCatsA; ++catA) {
+            state.da[catA] = layer_row(distancesA[catA], r, cols,
+              &state.bufferA[catA * n]);
+          }
+          for (int catB = 0; catB < nCatsB; ++catB) {
+            state.db[catB] = layer_row(distancesB[catB], r, cols,
+              &state.bufferB[catB * n]);
+          }
+          similarity_rows(sparse, state.da, state.db, cols,
+            state.simA.data(), state.simB.data());
+
+          for (std::size_t c = 0; c < n;
+            ++c, ++a_iter, ++b_iter, ++zone_iter, ++out_iter) {
+            const int zone = static_cast<int>(*zone_iter);
+            if (zone > 0 && zone <= nZones) {
+              const double sim = accumulators[zone].add(*a_iter, *b_iter,
+                strided_values{ state.simA.data() + c, n },
+                strided_values{ state.simB.data() + c, n });
+              sum += sim;
+              *out_iter = sim;
+            }
+            else {
+              *out_iter = -1; //nodata value
+            }
+          }
+        }
+
+        std::vector<bool> result(nZones + 1);
+        fuzzykappas.assign(nZones + 1, 0);
+        expected_errors.assign(nZones + 1, 0);
+        for (int zone = 1; zone <= nZones; ++zone) {
+          accumulators[0].merge(accumulators[zone]);
+          result[zone] = accumulators[zone].fuzzy_kappa(fuzzykappas[zone],
+            expected_errors[zone]);
+        }
+        accumulators[0].set_sum(sum);
+        result[0] = accumulators[0].fuzzy_kappa(fuzzykappas[0],
+          expected_errors[0]);
+        return result;
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Fuzzy Kappa per zone, in a single run. Zones are numbered 1..nZones;
+    // cells with any other value in the zone map are excluded. Element
+    // zone of fuzzykappas is the Fuzzy Kappa of that zone, and element 0,
+    // for which there is no zone, is the overall value. The expected
+    // similarity of a zone is based on the cells in the zone only. If the
+    // zone map has no values other than 0 and 1..nZones, the overall value
+    // is the same as that of fuzzy_kappa_2009 with the zone map as mask.
+    // Element k of the result is false if fuzzykappas[k] is 0 or 1 because
+    // there are no cells to compare or all cells are identical.
+    //
+    template<class RasterA, class RasterB, class RasterZones, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      std::vector<bool> fuzzy_kappa_2009_zonal(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterZones& zones,         // input: zone map, 1..nZones, 0 is excluded
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      int nZones,                 // dimension: number of zones
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      std::vector<double>& fuzzykappas) // result: improved fuzzy kappa per zone
+    {
+      std::vector<double> expected_errors; // always 0 for exact distributions
+      return detail::fuzzy_kappa_2009_zonal(mapA, mapB, zones, nCatsA, nCatsB,
+        nZones, m, f, comparison, maker, exact_distributions{}, fuzzykappas,
+        expected_errors);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // As above, with the similarity values binned into histograms, see the
+    // approximate fuzzy_kappa_2009.
+    //
+    template<class RasterA, class RasterB, class RasterZones, class RasterOut,
+    class DistanceDecay, class RasterMaker>
+      std::vector<bool> fuzzy_kappa_2009_zonal(
+      RasterA& mapA,              // input: first map
+      RasterB& mapB,              // input: second map
+      RasterZones& zones,         // input: zone map, 1..nZones, 0 is excluded
+      int nCatsA, int nCatsB,     // dimension: number of categories in legends
+      int nZones,                 // dimension: number of zones
+      const matrix<double>& m,    // parameter: categorical similarity matrix
+      DistanceDecay f,            // parameter: distance decay function
+      RasterOut& comparison,      // result: similarity map
+      RasterMaker maker,          // RasterMaker::raster<T> r = maker.create<T>(model)
+      const histogram_distributions& histograms, // parameter: number of bins
+      std::vector<double>& fuzzykappas,     // result: approximate improved fuzzy kappa
+      std::vector<double>& expected_errors) // result: bound on error in expected similarity
+    {
+      return detail::fuzzy_kappa_2009_zonal(mapA, mapB, zones, nCatsA, nCatsB,
+        nZones, m, f, comparison, maker, histograms, fuzzykappas,
+        expected_errors);
+    }
+  }
+}
+#endif
@@ -0,0 +1,588 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Native access to IDRISI rasters: a text header (.rdc) and the cells as a
+// flat binary array (.rst). The array is memory mapped and read in place,
+// without going through GDAL and its block cache. Errors in opening,
+// parsing or writing files are reported by std::runtime_error.
+
+#ifndef BLINK_RASTER_TOOLS_IDRISI_RASTER_H_AHZ
+#define BLINK_RASTER_TOOLS_IDRISI_RASTER_H_AHZ
+
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The data types of binary IDRISI rasters, with their cell types
+    //
+    enum class idrisi_data_type { byte, integer, real };
+
+    template<class T>
+    struct idrisi_type_of;
+
+    template<>
+    struct idrisi_type_of<std::uint8_t>
+    {
+      static const idrisi_data_type value = idrisi_data_type::byte;
+    };
+
+    template<>
+    struct idrisi_type_of<std::int16_t>
+    {
+      static const idrisi_data_type value = idrisi_data_type::integer;
+    };
+
+    template<>
+    struct idrisi_type_of<float>
+    {
+      static const idrisi_data_type value = idrisi_data_type::real;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The fields of the .rdc header that are needed to read the cells, and
+    // the reference system. The reference system is kept as text, so that a
+    // raster written with this header as model has the same reference system.
+    //
+    struct idrisi_header
+    {
+      int m_rows;
+      int m_cols;
+      idrisi_data_type m_data_type;
+      std::string m_ref_system;
+      std::string m_ref_units;
+      std::string m_unit_dist;
+      std::string m_min_x;
+      std::string m_max_x;
+      std::string m_min_y;
+      std::string m_max_y;
+      std::string m_position_error;
+      std::string m_resolution;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Header of a raster in the plane, with cells of size 1 and the origin in
+    // the lower left corner
+    //
+    inline idrisi_header plane_idrisi_header(int rows, int cols,
+      idrisi_data_type data_type)
+    {
+      idrisi_header header;
+      header.m_rows = rows;
+      header.m_cols = cols;
+      header.m_data_type = data_type;
+      header.m_ref_system = "plane";
+      header.m_ref_units = "m";
+      header.m_unit_dist = "1";
+      header.m_min_x = "0";
+      header.m_max_x = std::to_string(cols);
+      header.m_min_y = "0";
+      header.m_max_y = std::to_string(rows);
+      header.m_position_error = "unknown";
+      header.m_resolution = "1";
+      return header;
+    }
+
+    namespace detail
+    {
+      inline std::string trim(const std::string& s)
+      {
+        std::size_t first = 0;
+        std::size_t last = s.size();
+        while (first < last && std::isspace(static_cast<unsigned char>(s[first]))) {
+          ++first;
+        }
+        while (last > first && std::isspace(static_cast<unsigned char>(s[last - 1]))) {
+          --last;
+        }
+        return s.substr(first, last - first);
+      }
+
+      inline std::string lower(std::string s)
+      {
+        for (auto&& c : s) {
+          c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return s;
+      }
+
+      // The path without its extension, if it has one
+      inline std::string idrisi_stem(const std::string& path)
+      {
+        const std::size_t dot = path.find_last_of('.');
+        const std::size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos
+          || (slash != std::string::npos && dot < slash)) {
+          return path;
+        }
+        return path.substr(0, dot);
+      }
+
+      // The header file of a raster, which may also have an upper case
+      // extension
+      inline std::string idrisi_header_path(const std::string& path)
+      {
+        const std::string stem = idrisi_stem(path);
+        const std::string candidates[] = { stem + ".rdc", stem + ".RDC" };
+        for (auto&& candidate : candidates) {
+          if (std::ifstream(candidate.c_str()).good()) return candidate;
+        }
+        throw std::runtime_error("IDRISI header not found: " + stem + ".rdc");
+      }
+
+      // The data file of a raster: the path itself if it is that of the 
+      // data file, else with the extension .rst or .RST. If none exists, 
+      // the .rst path, for the error of opening it.
+      inline std::string idrisi_data_path(const std::string& path)
+      {
+        const std::string stem = idrisi_stem(path);
+        const std::string candidates[] = { path, stem + ".rst", stem + ".RST" };
+        for (auto&& candidate : candidates) {
+          if (lower(candidate.substr(stem.size())) == ".rst"
+            && std::ifstream(candidate.c_str()).good()) return candidate;
+        }
+        return stem + ".rst";
+      }
+
+      inline int header_int(const std::string& key, const std::string& value)
+      {
+        std::istringstream in(value);
+        int result;
+        if (!(in >> result) || result < 0) {
+          throw std::runtime_error("IDRISI header: invalid " + key + " '"
+            + value + "'");
+        }
+        return result;
+      }
+
+      inline std::size_t cell_size(idrisi_data_type type)
+      {
+        switch (type) {
+        case idrisi_data_type::byte: return 1;
+        case idrisi_data_type::integer: return 2;
+        default: return 4;
+        }
+      }
+
+      inline const char* type_name(idrisi_data_type type)
+      {
+        switch (type) {
+        case idrisi_data_type::byte: return "byte";
+        case idrisi_data_type::integer: return "integer";
+        default: return "real";
+        }
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Parse the .rdc header that belongs to an IDRISI raster, the path may be
+    // that of the .rst or of the .rdc file. Fields of the reference system
+    // that are missing are those of plane_idrisi_header.
+    //
+    inline idrisi_header read_idrisi_header(const std::string& path)
+    {
+      const std::string header_path = detail::idrisi_header_path(path);
+      std::ifstream in(header_path.c_str());
+      if (!in) {
+        throw std::runtime_error("Cannot open IDRISI header: " + header_path);
+      }
+      idrisi_header header;
+      bool has_rows = false;
+      bool has_cols = false;
+      bool has_type = false;
+      std::string reference[9];
+      const char* reference_keys[9] = { "ref. system", "ref. units",
+        "unit dist.", "min. x", "max. x", "min. y", "max. y", "pos'n error",
+        "resolution" };
+      std::string line;
+      while (std::getline(in, line)) {
+        const std::size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        const std::string key = detail::lower(detail::trim(line.substr(0, colon)));
+        const std::string text = detail::trim(line.substr(colon + 1));
+        const std::string value = detail::lower(text);
+        const auto reference_key = std::find(reference_keys,
+          reference_keys + 9, key);
+        if (reference_key != reference_keys + 9) {
+          reference[reference_key - reference_keys] = text;
+        }
+        else if (key == "rows") {
+          header.m_rows = detail::header_int(key, value);
+          has_rows = true;
+        }
+        else if (key == "columns") {
+          header.m_cols = detail::header_int(key, value);
+          has_cols = true;
+        }
+        else if (key == "data type") {
+          if (value == "byte") header.m_data_type = idrisi_data_type::byte;
+          else if (value == "integer") header.m_data_type = idrisi_data_type::integer;
+          else if (value == "real") header.m_data_type = idrisi_data_type::real;
+          else {
+            throw std::runtime_error("IDRISI header: unsupported data type '"
+              + value + "' in " + header_path);
+          }
+          has_type = true;
+        }
+        else if (key == "file type" && value != "binary") {
+          throw std::runtime_error("IDRISI header: unsupported file type '"
+            + value + "' in " + header_path);
+        }
+      }
+      if (!has_rows || !has_cols || !has_type) {
+        throw std::runtime_error("IDRISI header: rows, columns or data type "
+          "missing in " + header_path);
+      }
+      const idrisi_header plane = plane_idrisi_header(header.m_rows,
+        header.m_cols, header.m_data_type);
+      std::string idrisi_header::* const fields[9] = {
+        &idrisi_header::m_ref_system, &idrisi_header::m_ref_units,
+        &idrisi_header::m_unit_dist, &idrisi_header::m_min_x,
+        &idrisi_header::m_max_x, &idrisi_header::m_min_y,
+        &idrisi_header::m_max_y, &idrisi_header::m_position_error,
+        &idrisi_header::m_resolution };
+      for (int i = 0; i < 9; ++i) {
+        header.*fields[i] = reference[i].empty() ? plane.*fields[i]
+          : reference[i];
+      }
+      return header;
+    }
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // A file mapped read-only into memory, unmapped when destroyed
+      //
+      class mapped_file
+      {
+      public:
+        explicit mapped_file(const std::string& path)
+          : m_data(nullptr), m_size(0)
+        {
+#if defined(_WIN32)
+          m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+          if (m_file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Cannot open " + path);
+          }
+          LARGE_INTEGER size;
+          if (!GetFileSizeEx(m_file, &size)) {
+            CloseHandle(m_file);
+            throw std::runtime_error("Cannot get the size of " + path);
+          }
+          m_size = static_cast<std::size_t>(size.QuadPart);
+          m_mapping = nullptr;
+          if (m_size > 0) {
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0,
+              0, nullptr);
+            if (m_mapping != nullptr) {
+              m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+            if (m_data == nullptr) {
+              if (m_mapping != nullptr) CloseHandle(m_mapping);
+              CloseHandle(m_file);
+              throw std::runtime_error("Cannot map " + path);
+            }
+          }
+#else
+          m_file = ::open(path.c_str(), O_RDONLY);
+          if (m_file < 0) {
+            throw std::runtime_error("Cannot open " + path);
+          }
+          struct stat status;
+          if (::fstat(m_file, &status) != 0) {
+            ::close(m_file);
+            throw std::runtime_error("Cannot get the size of " + path);
+          }
+          m_size = static_cast<std::size_t>(status.st_size);
+          if (m_size > 0) {
+            void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_file, 0);
+            if (p == MAP_FAILED) {
+              ::close(m_file);
+              throw std::runtime_error("Cannot map " + path);
+            }
+            m_data = p;
+          }
+#endif
+        }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file()
+        {
+#if defined(_WIN32)
+          if (m_data != nullptr) UnmapViewOfFile(m_data);
+          if (m_mapping != nullptr) CloseHandle(m_mapping);
+          CloseHandle(m_file);
+#else
+          if (m_data != nullptr) ::munmap(m_data, m_size);
+          ::close(m_file);
+#endif
+        }
+
+        const void* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+      private:
+#if defined(_WIN32)
+        HANDLE m_file;
+        HANDLE m_mapping;
+#else
+        int m_file;
+#endif
+        void* m_data;
+        std::size_t m_size;
+      };
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Read-only IDRISI raster, iterating directly over the memory mapped
+    // .rst file. T is the type of the cells in the file: std::uint8_t for
+    // byte, std::int16_t for integer and float for real rasters. Files are
+    // little endian, as written by IDRISI on x86. Like the gdal_raster,
+    // copies share the same mapping.
+    //
+    template<class T>
+    class idrisi_raster
+    {
+    public:
+      using value_type = T;
+      using iterator = const T*;
+      using const_iterator = const T*;
+
+      idrisi_raster() : m_rows(0), m_cols(0), m_data(nullptr)
+      {
+      }
+
+      // The path may be that of the .rst or the .rdc file
+      explicit idrisi_raster(const std::string& path)
+      {
+        const idrisi_header header = read_idrisi_header(path);
+        if (header.m_data_type != idrisi_type_of<T>::value) {
+          throw std::runtime_error(std::string("IDRISI raster ") + path
+            + " has data type " + detail::type_name(header.m_data_type)
+            + ", not " + detail::type_name(idrisi_type_of<T>::value));
+        }
+        const std::string data_path = detail::idrisi_data_path(path);
+        m_file = std::make_shared<detail::mapped_file>(data_path);
+        m_rows = header.m_rows;
+        m_cols = header.m_cols;
+        if (m_file->size() != size() * sizeof(T)) {
+          throw std::runtime_error("IDRISI raster " + data_path
+            + " does not match the size in its header");
+        }
+        m_data = static_cast<const T*>(m_file->data());
+      }
+
+      std::size_t size1() const { return static_cast<std::size_t>(m_rows); }
+      std::size_t size2() const { return static_cast<std::size_t>(m_cols); }
+      std::size_t size() const { return size1() * size2(); }
+
+      const_iterator begin() const { return m_data; }
+      const_iterator end() const { return m_data + size(); }
+
+      const T* data() const { return m_data; }
+
+      // First cell of row r
+      const T* row(int r) const
+      {
+        return m_data + static_cast<std::size_t>(r) * m_cols;
+      }
+
+    private:
+      int m_rows;
+      int m_cols;
+      const T* m_data;
+      std::shared_ptr<detail::mapped_file> m_file; // keeps the mapping alive
+    };
+
+    template<class T>
+    idrisi_raster<T> open_idrisi_raster(const std::string& path)
+    {
+      return idrisi_raster<T>(path);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Write a raster as an IDRISI raster, path is that of the .rst file. The
+    // cells are stored as T: std::uint8_t, std::int16_t or float. Values
+    // that T can not represent are an error, including values with a
+    // fraction if T is integral and finite values beyond the range of float.
+    // Cells equal to nodata, if given, are left out of the value range and
+    // recorded as flag value. The reference system is that of model, which
+    // must have the rows and columns of the raster.
+    //
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path,
+      const idrisi_header& model, bool has_nodata, double nodata)
+    {
+      const int rows = static_cast<int>(
+        blink::raster::raster_operations::size1(raster));
+      const int cols = static_cast<int>(
+        blink::raster::raster_operations::size2(raster));
+      const std::string stem = detail::idrisi_stem(path);
+      if (model.m_rows != rows || model.m_cols != cols) {
+        throw std::runtime_error("The model header of " + stem + ".rst "
+          "does not have the rows and columns of the raster");
+      }
+
+      std::ofstream data((stem + ".rst").c_str(), std::ios::binary);
+      if (!data) {
+        throw std::runtime_error("Cannot create " + stem + ".rst");
+      }
+      double min_value = std::numeric_limits<double>::infinity();
+      double max_value = -std::numeric_limits<double>::infinity();
+      const std::size_t buffer_size = 4096;
+      T buffer[buffer_size];
+      std::size_t n = 0;
+      for (auto&& i : raster) {
+        const double value = static_cast<double>(i);
+        const bool in_range =
+          value >= static_cast<double>(std::numeric_limits<T>::lowest())
+          && value <= static_cast<double>(std::numeric_limits<T>::max());
+        if (!in_range && (std::is_integral<T>::value || std::isfinite(value))) {
+          throw std::runtime_error("Value out of range for the data type of "
+            + stem + ".rst");
+        }
+        if (std::is_integral<T>::value && value != std::trunc(value)) {
+          throw std::runtime_error("Value with a fraction for the integral "
+            "data type of " + stem + ".rst");
+        }
+        const T stored = static_cast<T>(i);
+        if (!has_nodata || value != nodata) { // range of the stored values
+          min_value = std::min(min_value, static_cast<double>(stored));
+          max_value = std::max(max_value, static_cast<double>(stored));
+        }
+        buffer[n++] = stored;
+        if (n == buffer_size) {
+          data.write(reinterpret_cast<const char*>(buffer), n * sizeof(T));
+          n = 0;
+        }
+      }
+      data.write(reinterpret_cast<const char*>(buffer), n * sizeof(T));
+      if (!data) {
+        throw std::runtime_error("Cannot write " + stem + ".rst");
+      }
+      if (min_value > max_value) { // no values
+        min_value = max_value = 0;
+      }
+
+      std::ofstream header((stem + ".rdc").c_str());
+      if (!header) {
+        throw std::runtime_error("Cannot create " + stem + ".rdc");
+      }
+      // Enough digits for the values to read back as stored
+      header.precision(std::is_integral<T>::value
+        ? std::numeric_limits<double>::max_digits10
+        : std::numeric_limits<T>::max_digits10);
+      header
+        << "file format : IDRISI Raster A.1\n"
+        << "file title  : \n"
+        << "data type   : " << detail::type_name(idrisi_type_of<T>::value) << "\n"
+        << "file type   : binary\n"
+        << "columns     : " << cols << "\n"
+        << "rows        : " << rows << "\n"
+        << "ref. system : " << model.m_ref_system << "\n"
+        << "ref. units  : " << model.m_ref_units << "\n"
+        << "unit dist.  : " << model.m_unit_dist << "\n"
+        << "min. X      : " << model.m_min_x << "\n"
+        << "max. X      : " << model.m_max_x << "\n"
+        << "min. Y      : " << model.m_min_y << "\n"
+        << "max. Y      : " << model.m_max_y << "\n"
+        << "pos'n error : " << model.m_position_error << "\n"
+        << "resolution  : " << model.m_resolution << "\n"
+        << "min. value  : " << min_value << "\n"
+        << "max. value  : " << max_value << "\n"
+        << "display min : " << min_value << "\n"
+        << "display max : " << max_value << "\n"
+        << "value units : unspecified\n"
+        << "value error : unknown\n";
+      if (has_nodata) {
+        header
+          << "flag value  : " << nodata << "\n"
+          << "flag def'n  : NODATA\n";
+      }
+      else {
+        header
+          << "flag value  : none\n"
+          << "flag def'n  : none\n";
+      }
+      header << "legend cats : 0\n";
+      if (!header) {
+        throw std::runtime_error("Cannot write " + stem + ".rdc");
+      }
+    }
+
+    // As above, in the plane with cells of size 1
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path,
+      bool has_nodata, double nodata)
+    {
+      const idrisi_header model = plane_idrisi_header(
+        static_cast<int>(blink::raster::raster_operations::size1(raster)),
+        static_cast<int>(blink::raster::raster_operations::size2(raster)),
+        idrisi_type_of<T>::value);
+      write_idrisi_raster<T>(raster, path, model, has_nodata, nodata);
+    }
+
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path)
+    {
+      write_idrisi_raster<T>(raster, path, false, 0);
+    }
+
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path,
+      double nodata)
+    {
+      write_idrisi_raster<T>(raster, path, true, nodata);
+    }
+
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path,
+      const idrisi_header& model)
+    {
+      write_idrisi_raster<T>(raster, path, model, false, 0);
+    }
+
+    template<class T, class Raster>
+    void write_idrisi_raster(const Raster& raster, const std::string& path,
+      const idrisi_header& model, double nodata)
+    {
+      write_idrisi_raster<T>(raster, path, model, true, nodata);
+    }
+  }
+}
+#endif
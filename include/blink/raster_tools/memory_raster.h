@@ -0,0 +1,209 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// A raster that lives in one contiguous block of memory, for intermediate
+// results that fit in RAM. Its iterators are plain pointers that go through
+// the raster row by row.
+
+#ifndef BLINK_RASTER_TOOLS_MEMORY_RASTER_H_AHZ
+#define BLINK_RASTER_TOOLS_MEMORY_RASTER_H_AHZ
+
+#include <blink/raster/raster_traits.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Hands out memory from a few large blocks. The blocks are kept when the
+    // rasters using them are destroyed, and each block is reused once all
+    // rasters in it are gone. Repeated calls with rasters of the same size 
+    // therefore only allocate the first time, also while rasters made
+    // earlier are still alive: these only hold on to their own blocks.
+    //
+    class memory_arena
+    {
+    public:
+      static const std::size_t alignment = 64; // cache line, and AVX-512
+
+      memory_arena(std::size_t block_size = std::size_t(1) << 26)
+        : m_block_size(block_size)
+      {
+      }
+
+      memory_arena(const memory_arena&) = delete;
+      memory_arena& operator=(const memory_arena&) = delete;
+
+      // Memory for bytes, nullptr for 0 bytes: empty rasters take no part 
+      // in the blocks
+      void* allocate(std::size_t bytes)
+      {
+        if (bytes == 0) return nullptr;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        auto b = std::find_if(m_blocks.begin(), m_blocks.end(), 
+          [bytes](const block& b) { return b.offset + bytes <= b.size; });
+        if (b == m_blocks.end()) {
+          block nb;
+          nb.size = std::max(bytes, m_block_size);
+          nb.memory.reset(new char[nb.size + alignment]);
+          const std::uintptr_t p = reinterpret_cast<std::uintptr_t>(nb.memory.get());
+          nb.begin = nb.memory.get() + (alignment - p % alignment) % alignment;
+          nb.offset = 0;
+          nb.live = 0;
+          m_blocks.push_back(std::move(nb));
+          b = m_blocks.end() - 1;
+        }
+        void* p = b->begin + b->offset;
+        b->offset += bytes;
+        ++b->live;
+        return p;
+      }
+
+      // Releases memory obtained from allocate, the block that holds it is 
+      // reused once it has no live allocations left. nullptr is ignored.
+      void release(void* p)
+      {
+        if (p == nullptr) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        char* c = static_cast<char*>(p);
+        for (auto&& b : m_blocks) {
+          if (c >= b.begin && c < b.begin + b.size) {
+            if (--b.live == 0) {
+              b.offset = 0;
+            }
+            return;
+          }
+        }
+      }
+
+      // Total size of the blocks held by the arena
+      std::size_t capacity() const
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::size_t total = 0;
+        for (auto&& b : m_blocks) total += b.size;
+        return total;
+      }
+
+    private:
+      struct block
+      {
+        std::unique_ptr<char[]> memory;
+        char* begin;
+        std::size_t size;
+        std::size_t offset; // first free byte
+        std::size_t live;   // number of allocations not yet released
+      };
+
+      mutable std::mutex m_mutex;
+      std::vector<block> m_blocks;
+      std::size_t m_block_size;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Row-major raster in contiguous memory. Like the gdal_raster, copies
+    // share the same cells. The cells are initialized to zero.
+    //
+    template<class T>
+    class memory_raster
+    {
+    public:
+      using value_type = T;
+      using iterator = T*;
+      using const_iterator = const T*;
+
+      memory_raster() : m_rows(0), m_cols(0), m_data(nullptr)
+      {
+      }
+
+      // Stand-alone raster, owning its memory
+      memory_raster(int rows, int cols) : m_rows(rows), m_cols(cols)
+      {
+        const std::size_t n = size();
+        std::shared_ptr<T> buffer(new T[n](), std::default_delete<T[]>());
+        m_data = buffer.get();
+        m_buffer = buffer;
+      }
+
+      // Raster with its memory taken from an arena. The arena only releases
+      // the memory, so the cells must not need destroying.
+      memory_raster(int rows, int cols, std::shared_ptr<memory_arena> arena)
+        : m_rows(rows), m_cols(cols)
+      {
+        static_assert(std::is_trivially_destructible<T>::value,
+          "the cells of an arena raster are never destroyed");
+        const std::size_t n = size();
+        T* p = static_cast<T*>(arena->allocate(n * sizeof(T)));
+        std::uninitialized_fill(p, p + n, T{});
+        m_data = p;
+        m_buffer = std::shared_ptr<T>(p, [arena](T* cells) { arena->release(cells); });
+      }
+
+      std::size_t size1() const { return static_cast<std::size_t>(m_rows); }
+      std::size_t size2() const { return static_cast<std::size_t>(m_cols); }
+      std::size_t size() const { return size1() * size2(); }
+
+      iterator begin() { return m_data; }
+      iterator end() { return m_data + size(); }
+      const_iterator begin() const { return m_data; }
+      const_iterator end() const { return m_data + size(); }
+
+      T* data() { return m_data; }
+      const T* data() const { return m_data; }
+
+      // First cell of row r
+      T* row(int r) { return m_data + static_cast<std::size_t>(r) * m_cols; }
+      const T* row(int r) const
+      {
+        return m_data + static_cast<std::size_t>(r) * m_cols;
+      }
+
+    private:
+      int m_rows;
+      int m_cols;
+      T* m_data;
+      std::shared_ptr<T> m_buffer; // keeps the memory alive
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // RasterMaker for intermediate results in memory. All rasters made by
+    // the same maker (or copies of it) share one arena.
+    //
+    class memory_raster_maker
+    {
+    public:
+      template<class T>
+      using raster_type = memory_raster<T>;
+
+      memory_raster_maker() : m_arena(std::make_shared<memory_arena>())
+      {
+      }
+
+      template<class T, class Model>
+      raster_type<T> create(const Model& model)
+      {
+        return memory_raster<T>(
+          static_cast<int>(blink::raster::raster_operations::size1(model)),
+          static_cast<int>(blink::raster::raster_operations::size2(model)),
+          m_arena);
+      }
+
+      std::shared_ptr<memory_arena> m_arena;
+    };
+  }
+}
+#endif
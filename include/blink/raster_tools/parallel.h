@@ -0,0 +1,94 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Execution policies and the minimal threading support used by the
+// parallel versions of the raster tools.
+
+#ifndef BLINK_RASTER_TOOLS_PARALLEL_H_AHZ
+#define BLINK_RASTER_TOOLS_PARALLEL_H_AHZ
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Execution policy: run everything on the calling thread
+    //
+    struct serial_execution {};
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Execution policy: spread the work over a number of threads.
+    // threads == 0 means: use as many threads as the hardware supports.
+    //
+    class parallel_execution
+    {
+    public:
+      parallel_execution(int threads = 0) : m_threads(threads)
+      {
+      }
+
+      int threads() const
+      {
+        if (m_threads > 0) return m_threads;
+        const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+        return hardware > 0 ? hardware : 1;
+      }
+
+      int m_threads;
+    };
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // Split [first, last) into chunks of at least min_chunk elements and
+      // process them on a number of threads. The chunks are handed out
+      // dynamically, so uneven chunks do not stall the other threads.
+      // The function is called as f(chunk_begin, chunk_end).
+      //
+      template<class Function>
+      void parallel_for(int first, int last, int threads, int min_chunk,
+        Function f)
+      {
+        const int n = last - first;
+        if (n <= 0) return;
+        min_chunk = std::max(1, min_chunk);
+        threads = std::max(1, std::min(threads, (n + min_chunk - 1) / min_chunk));
+        if (threads == 1) {
+          f(first, last);
+          return;
+        }
+
+        // About four chunks per thread, to balance the load
+        const int chunk = std::max(min_chunk, n / (4 * threads));
+        std::atomic<int> next(first);
+        auto worker = [&]() {
+          for (;;) {
+            const int begin = next.fetch_add(chunk);
+            if (begin >= last) return;
+            f(begin, std::min(last, begin + chunk));
+          }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; ++i) {
+          pool.emplace_back(worker);
+        }
+        worker(); // the calling thread takes part as well
+        for (auto&& t : pool) {
+          t.join();
+        }
+      }
+    }
+  }
+}
+#endif
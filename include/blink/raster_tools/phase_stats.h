@@ -0,0 +1,233 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Observers of the phases of the distance transform and Fuzzy Kappa. The
+// algorithms take the observer as a template parameter, the null_observer
+// that is used by default compiles to nothing. phase_stats records time,
+// cells and memory per phase, and reports progress to a callback that can
+// cancel the run.
+
+#ifndef BLINK_RASTER_TOOLS_PHASE_STATS_H_AHZ
+#define BLINK_RASTER_TOOLS_PHASE_STATS_H_AHZ
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+namespace blink {
+  namespace raster_tools {
+
+    enum class phase
+    {
+      allocation,            // intermediate layers
+      column_phase,          // first phase of the distance transform
+      row_phase,             // second phase of the distance transform
+      distance_transform,    // all distance transforms of a map
+      decay,                 // distance decay applied to the distances
+      cell_loop,             // similarities and distribution inserts
+      compact_distributions, // sorting the distributions
+      expected_similarity    // expected minimum of the distributions
+    };
+
+    enum { number_of_phases = 8 };
+
+    inline const char* phase_name(phase p)
+    {
+      switch (p) {
+      case phase::allocation: return "allocation";
+      case phase::column_phase: return "column_phase";
+      case phase::row_phase: return "row_phase";
+      case phase::distance_transform: return "distance_transform";
+      case phase::decay: return "decay";
+      case phase::cell_loop: return "cell_loop";
+      case phase::compact_distributions: return "compact_distributions";
+      default: return "expected_similarity";
+      }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // The observer that is used when none is given.
+    //
+    struct null_observer
+    {
+      void begin_phase(phase)
+      {
+      }
+
+      void end_phase(phase, std::size_t /*cells*/, std::size_t /*bytes*/)
+      {
+      }
+
+      void distribution_entries(std::size_t)
+      {
+      }
+
+      // Return false to cancel the run
+      bool progress(std::size_t /*done*/, std::size_t /*total*/)
+      {
+        return true;
+      }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Statistics per phase. A phase that is entered several times adds up.
+    // With parallel execution begin_phase and end_phase are only called by
+    // the calling thread, progress may be called by any thread.
+    //
+    struct phase_record
+    {
+      phase_record() : m_seconds(0), m_cells(0), m_bytes(0), m_calls(0)
+      {
+      }
+
+      double m_seconds;    // wall time
+      std::size_t m_cells; // cells processed, counted once per layer
+      std::size_t m_bytes; // intermediate rasters allocated
+      int m_calls;
+    };
+
+    class phase_stats
+    {
+    public:
+      // Called with the fraction of the work done, return false to cancel
+      typedef std::function<bool(double)> progress_function;
+
+      phase_stats() : m_distribution_entries(0), m_cancelled(false)
+      {
+      }
+
+      explicit phase_stats(progress_function progress)
+        : m_distribution_entries(0), m_progress(progress), m_cancelled(false)
+      {
+      }
+
+      void begin_phase(phase p)
+      {
+        m_start[index(p)] = std::chrono::steady_clock::now();
+      }
+
+      void end_phase(phase p, std::size_t cells, std::size_t bytes)
+      {
+        phase_record& record = m_records[index(p)];
+        record.m_seconds += std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - m_start[index(p)]).count();
+        record.m_cells += cells;
+        record.m_bytes += bytes;
+        ++record.m_calls;
+      }
+
+      // Number of (value, count) pairs in the distributions of Fuzzy Kappa
+      void distribution_entries(std::size_t entries)
+      {
+        m_distribution_entries += entries;
+      }
+
+      bool progress(std::size_t done, std::size_t total)
+      {
+        if (m_cancelled) return false;
+        if (!m_progress) return true;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_progress(total > 0 ? static_cast<double>(done) / total : 1.0)) {
+          m_cancelled = true;
+        }
+        return !m_cancelled;
+      }
+
+      bool cancelled() const
+      {
+        return m_cancelled;
+      }
+
+      const phase_record& operator[](phase p) const
+      {
+        return m_records[index(p)];
+      }
+
+      std::size_t distribution_entries() const
+      {
+        return m_distribution_entries;
+      }
+
+    private:
+      static int index(phase p)
+      {
+        return static_cast<int>(p);
+      }
+
+      std::array<phase_record, number_of_phases> m_records;
+      std::array<std::chrono::steady_clock::time_point, number_of_phases>
+        m_start;
+      std::size_t m_distribution_entries;
+      progress_function m_progress;
+      std::atomic<bool> m_cancelled;
+      std::mutex m_mutex;
+    };
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // Counts the units of work done and passes them to the observer. The
+      // count is atomic, so that threads can share it. Without an observer
+      // there is nothing to count.
+      //
+      template<class Observer>
+      class work_progress
+      {
+      public:
+        work_progress(Observer& observer, std::size_t total)
+          : m_observer(observer), m_total(total), m_done(0)
+        {
+        }
+
+        // Return false if the run is cancelled
+        bool advance(std::size_t units)
+        {
+          return m_observer.progress(m_done += units, m_total);
+        }
+
+        Observer& observer()
+        {
+          return m_observer;
+        }
+
+      private:
+        Observer& m_observer;
+        std::size_t m_total;
+        std::atomic<std::size_t> m_done;
+      };
+
+      template<>
+      class work_progress<null_observer>
+      {
+      public:
+        work_progress(null_observer& observer, std::size_t)
+          : m_observer(observer)
+        {
+        }
+
+        bool advance(std::size_t)
+        {
+          return true;
+        }
+
+        null_observer& observer()
+        {
+          return m_observer;
+        }
+
+      private:
+        null_observer& m_observer;
+      };
+    }
+  }
+}
+#endif
@@ -0,0 +1,102 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Precision policies for the intermediate layers of Fuzzy Kappa. The
+// decayed distances per category take most of the memory and memory
+// bandwidth of the cell loop; they are similarities in [0,1] and do not
+// always need a double.
+
+#ifndef BLINK_RASTER_TOOLS_PRECISION_H_AHZ
+#define BLINK_RASTER_TOOLS_PRECISION_H_AHZ
+
+#include <cstdint>
+
+namespace blink {
+  namespace raster_tools {
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Value in [0,1] as a 16 bit fixed point number, with a resolution of
+    // 1 / 65535. Values outside [0,1] are clamped. It converts to and from
+    // double, so that rasters of fixed16 can be used where rasters of double
+    // are read or written.
+    //
+    class fixed16
+    {
+    public:
+      fixed16() : m_bits(0)
+      {
+      }
+
+      fixed16(double value) : m_bits(encode(value))
+      {
+      }
+
+      operator double() const
+      {
+        return m_bits / scale;
+      }
+
+      std::uint16_t bits() const
+      {
+        return m_bits;
+      }
+
+    private:
+      static std::uint16_t encode(double value)
+      {
+        if (!(value > 0)) return 0;
+        if (value >= 1) return 65535;
+        return static_cast<std::uint16_t>(value * scale + 0.5);
+      }
+
+      static constexpr double scale = 65535.0;
+      std::uint16_t m_bits;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    // precision<T> stores the decayed distances as T, and the values of the
+    // exact distributions as key_type. With double, the default, results
+    // are those of the full precision calculation.
+    // The error in Fuzzy Kappa follows from the error e in each decayed
+    // distance: similarities are then within e * max|m| of their exact
+    // value, as are the mean and expected similarity, so Fuzzy Kappa is
+    // within about 2 * e * max|m| / (1 - expected).
+    //  float   : e = 6e-8 relative, Fuzzy Kappa within ~1e-7 / (1 - expected)
+    //  fixed16 : e = 7.6e-6 absolute, Fuzzy Kappa within
+    //            ~1.5e-5 * max|m| / (1 - expected)
+    // The distances for fixed16 are calculated per category, through a
+    // single layer of float, and layers of fixed16 can only be created by
+    // makers of in-memory rasters.
+    //
+    template<class T>
+    struct precision;
+
+    template<>
+    struct precision<double>
+    {
+      typedef double value_type;
+      typedef double key_type;
+    };
+
+    template<>
+    struct precision<float>
+    {
+      typedef float value_type;
+      typedef float key_type;
+    };
+
+    template<>
+    struct precision<fixed16>
+    {
+      typedef fixed16 value_type;
+      typedef float key_type;
+    };
+  }
+}
+#endif
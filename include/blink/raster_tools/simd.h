@@ -0,0 +1,277 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Batch kernels over contiguous rows of doubles, with AVX2 and AVX-512
+// versions that are selected at runtime, depending on what the processor
+// supports. All versions give identical results: the kernels only use
+// operations that are exact (max, compare, gather) or a single rounded
+// multiplication. Define BLINK_RASTER_TOOLS_NO_SIMD to always use the
+// scalar versions. The AVX-512 kernels use the masked forms of the 
+// intrinsics with all lanes set, and the gathers an explicit zero source:
+// the unmasked forms leave their source undefined, which GCC reports as
+// possibly uninitialized.
+
+#ifndef BLINK_RASTER_TOOLS_SIMD_H_AHZ
+#define BLINK_RASTER_TOOLS_SIMD_H_AHZ
+
+#include <cstddef>
+
+#if !defined(BLINK_RASTER_TOOLS_NO_SIMD) && (defined(__x86_64__) \
+  || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define BLINK_RASTER_TOOLS_X86_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define BLINK_RASTER_TOOLS_TARGET_AVX2 __attribute__((target("avx2")))
+#define BLINK_RASTER_TOOLS_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define BLINK_RASTER_TOOLS_TARGET_AVX2
+#define BLINK_RASTER_TOOLS_TARGET_AVX512
+#endif
+
+namespace blink {
+  namespace raster_tools {
+    enum class simd_level { scalar, avx2, avx512 };
+
+    namespace detail
+    {
+      inline simd_level detect_simd_level()
+      {
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return simd_level::scalar;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave) return simd_level::scalar;
+        const unsigned long long xcr0 = _xgetbv(0);
+        if ((xcr0 & 0x6) != 0x6) return simd_level::scalar; // ymm state
+        __cpuid(info, 7);
+        const bool avx2 = (info[1] & (1 << 5)) != 0;
+        const bool avx512 = (info[1] & (1 << 16)) != 0
+          && (xcr0 & 0xe6) == 0xe6; // zmm state
+        if (avx512) return simd_level::avx512;
+        if (avx2) return simd_level::avx2;
+        return simd_level::scalar;
+#elif defined(BLINK_RASTER_TOOLS_X86_SIMD)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+        if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+        return simd_level::scalar;
+#else
+        return simd_level::scalar;
+#endif
+      }
+    }
+
+    // The instruction set used by the kernels, detected once
+    inline simd_level active_simd_level()
+    {
+      static const simd_level level = detail::detect_simd_level();
+      return level;
+    }
+
+    namespace detail
+    {
+      //////////////////////////////////////////////////////////////////////////
+      // dst[i] = max(dst[i], factor * src[i])
+      //
+      inline void max_product_scalar(double* dst, const double* src,
+        double factor, std::size_t n)
+      {
+        for (std::size_t i = 0; i < n; ++i) {
+          const double p = factor * src[i];
+          if (dst[i] < p) dst[i] = p;
+        }
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // dst[i] = src[i] if it is positive, 0 otherwise
+      //
+      inline void positive_part_scalar(double* dst, const double* src,
+        std::size_t n)
+      {
+        for (std::size_t i = 0; i < n; ++i) {
+          dst[i] = src[i] > 0 ? src[i] : 0;
+        }
+      }
+
+      //////////////////////////////////////////////////////////////////////////
+      // values[i] = table[values[i]] for values below table_size. The values
+      // must be non-negative integers, values that are too large are left
+      // as they are and counted in the result.
+      //
+      inline std::size_t lookup_scalar(double* values, std::size_t n,
+        const double* table, std::size_t table_size)
+      {
+        const double limit = static_cast<double>(table_size);
+        std::size_t misses = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+          if (values[i] < limit) {
+            values[i] = table[static_cast<std::size_t>(values[i])];
+          }
+          else {
+            ++misses;
+          }
+        }
+        return misses;
+      }
+
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD)
+      BLINK_RASTER_TOOLS_TARGET_AVX2
+      inline void max_product_avx2(double* dst, const double* src,
+        double factor, std::size_t n)
+      {
+        const __m256d f = _mm256_set1_pd(factor);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+          const __m256d p = _mm256_mul_pd(f, _mm256_loadu_pd(src + i));
+          // max_pd(a, b) is (a > b ? a : b), as in the scalar version
+          _mm256_storeu_pd(dst + i, _mm256_max_pd(p, _mm256_loadu_pd(dst + i)));
+        }
+        max_product_scalar(dst + i, src + i, factor, n - i);
+      }
+
+      BLINK_RASTER_TOOLS_TARGET_AVX2
+      inline void positive_part_avx2(double* dst, const double* src,
+        std::size_t n)
+      {
+        const __m256d zero = _mm256_setzero_pd();
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+          _mm256_storeu_pd(dst + i, _mm256_max_pd(_mm256_loadu_pd(src + i),
+            zero));
+        }
+        positive_part_scalar(dst + i, src + i, n - i);
+      }
+
+      BLINK_RASTER_TOOLS_TARGET_AVX2
+      inline std::size_t lookup_avx2(double* values, std::size_t n,
+        const double* table, std::size_t table_size)
+      {
+        const __m256d limit = _mm256_set1_pd(static_cast<double>(table_size));
+        std::size_t misses = 0;
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+          const __m256d v = _mm256_loadu_pd(values + i);
+          const __m256d in_table = _mm256_cmp_pd(v, limit, _CMP_LT_OQ);
+          if (_mm256_movemask_pd(in_table) == 0xf) {
+            const __m128i index = _mm256_cvttpd_epi32(v);
+            _mm256_storeu_pd(values + i, _mm256_mask_i32gather_pd(
+              _mm256_setzero_pd(), table, index, in_table, 8));
+          }
+          else {
+            misses += lookup_scalar(values + i, 4, table, table_size);
+          }
+        }
+        return misses + lookup_scalar(values + i, n - i, table, table_size);
+      }
+
+      BLINK_RASTER_TOOLS_TARGET_AVX512
+      inline void max_product_avx512(double* dst, const double* src,
+        double factor, std::size_t n)
+      {
+        const __m512d f = _mm512_set1_pd(factor);
+        const __mmask8 all = 0xff;
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+          const __m512d p = _mm512_mul_pd(f, _mm512_loadu_pd(src + i));
+          _mm512_storeu_pd(dst + i, _mm512_maskz_max_pd(all, p,
+            _mm512_loadu_pd(dst + i)));
+        }
+        max_product_scalar(dst + i, src + i, factor, n - i);
+      }
+
+      BLINK_RASTER_TOOLS_TARGET_AVX512
+      inline void positive_part_avx512(double* dst, const double* src,
+        std::size_t n)
+      {
+        const __m512d zero = _mm512_setzero_pd();
+        const __mmask8 all = 0xff;
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+          _mm512_storeu_pd(dst + i, _mm512_maskz_max_pd(all,
+            _mm512_loadu_pd(src + i), zero));
+        }
+        positive_part_scalar(dst + i, src + i, n - i);
+      }
+
+      BLINK_RASTER_TOOLS_TARGET_AVX512
+      inline std::size_t lookup_avx512(double* values, std::size_t n,
+        const double* table, std::size_t table_size)
+      {
+        const __m512d limit = _mm512_set1_pd(static_cast<double>(table_size));
+        const __mmask8 all = 0xff;
+        std::size_t misses = 0;
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+          const __m512d v = _mm512_loadu_pd(values + i);
+          if (_mm512_cmp_pd_mask(v, limit, _CMP_LT_OQ) == all) {
+            const __m256i index = _mm512_maskz_cvttpd_epi32(all, v);
+            _mm512_storeu_pd(values + i, _mm512_mask_i32gather_pd(
+              _mm512_setzero_pd(), all, index, table, 8));
+          }
+          else {
+            misses += lookup_scalar(values + i, 8, table, table_size);
+          }
+        }
+        return misses + lookup_scalar(values + i, n - i, table, table_size);
+      }
+#endif
+
+      inline void max_product(double* dst, const double* src, double factor,
+        std::size_t n)
+      {
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD)
+        switch (active_simd_level()) {
+        case simd_level::avx512: return max_product_avx512(dst, src, factor, n);
+        case simd_level::avx2: return max_product_avx2(dst, src, factor, n);
+        default: break;
+        }
+#endif
+        max_product_scalar(dst, src, factor, n);
+      }
+
+      inline void positive_part(double* dst, const double* src, std::size_t n)
+      {
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD)
+        switch (active_simd_level()) {
+        case simd_level::avx512: return positive_part_avx512(dst, src, n);
+        case simd_level::avx2: return positive_part_avx2(dst, src, n);
+        default: break;
+        }
+#endif
+        positive_part_scalar(dst, src, n);
+      }
+
+      inline std::size_t lookup(double* values, std::size_t n,
+        const double* table, std::size_t table_size)
+      {
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD)
+        // Gather indices are 32 bit
+        if (table_size <= (std::size_t(1) << 31)) {
+          switch (active_simd_level()) {
+          case simd_level::avx512:
+            return lookup_avx512(values, n, table, table_size);
+          case simd_level::avx2:
+            return lookup_avx2(values, n, table, table_size);
+          default: break;
+          }
+        }
+#endif
+        return lookup_scalar(values, n, table, table_size);
+      }
+    }
+  }
+}
+#endif
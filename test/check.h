@@ -0,0 +1,57 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Minimal checks for the test programs. Each test program reports the 
+// failed checks on standard error and returns the number of failures.
+
+#ifndef BLINK_RASTER_TOOLS_TEST_CHECK_H_AHZ
+#define BLINK_RASTER_TOOLS_TEST_CHECK_H_AHZ
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+namespace blink {
+  namespace raster_tools {
+    namespace test {
+
+      inline int& failures()
+      {
+        static int count = 0;
+        return count;
+      }
+
+      inline void check(bool condition, const std::string& what)
+      {
+        if (!condition) {
+          ++failures();
+          std::cerr << "FAILED: " << what << std::endl;
+        }
+      }
+
+      inline void check_close(double a, double b, double tolerance,
+        const std::string& what)
+      {
+        if (!(std::abs(a - b) <= tolerance)) {
+          ++failures();
+          std::cerr.precision(17);
+          std::cerr << "FAILED: " << what << ": " << a << " != " << b
+            << std::endl;
+        }
+      }
+
+      inline int report(const std::string& name)
+      {
+        std::cerr << name << ": " << failures() << " failures" << std::endl;
+        return failures();
+      }
+    }
+  }
+}
+#endif
@@ -0,0 +1,471 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of the distance transform: the scans of the row phase for
+// manhattan and chessboard distances against the stack of the lower
+// envelope, the serial transform, also on a map too wide for squared 
+// distances in int, and the nearest feature transforms against brute 
+// force, and the parallel, single-sweep, bounded and blocked transforms 
+// against the serial transform. Transforms in a reserved
+// workspace do not allocate.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/blocked_distance_transform.h>
+#include <blink/raster_tools/distance_transform.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::make_map;
+
+// Column distances of a row, as the column phase leaves them: distances
+// below rows or inf for columns without target
+std::vector<int> make_row(std::mt19937& rng, int cols, int rows, int inf)
+{
+  std::vector<int> g(cols);
+  for (auto&& i : g) {
+    i = rng() % 4 == 0 ? inf : static_cast<int>(rng() % rows);
+  }
+  return g;
+}
+
+// The scan of process_line against the generic stack version, selected
+// by naming its template arguments
+template<class Method>
+void test_row_scan(const std::string& name)
+{
+  using iterator = std::vector<int>::iterator;
+  std::mt19937 rng(1);
+  rt::distance_transform_workspace workspace;
+  const int rows = 25;
+  for (int cols = 0; cols < 60; ++cols) {
+    const int inf = rows + cols;
+    for (int repeat = 0; repeat < 20; ++repeat) {
+      std::vector<int> g = make_row(rng, cols, rows, inf);
+      if (repeat == 0) std::fill(g.begin(), g.end(), inf);
+      std::vector<int> g_stack = g;
+      std::vector<int> scan(cols);
+      std::vector<int> stack(cols);
+      rt::detail::process_line(g, workspace, scan.begin(), inf, Method{});
+      rt::detail::process_line<int, iterator, Method>(g_stack, workspace,
+        stack.begin(), inf, Method{});
+      check(scan == stack, name + " row scan, cols = "
+        + std::to_string(cols));
+    }
+  }
+}
+
+double brute_force_distance(int dr, int dc, const rt::euclidean_squared&)
+{
+  return static_cast<double>(dr) * dr + static_cast<double>(dc) * dc;
+}
+
+double brute_force_distance(int dr, int dc, const rt::euclidean_non_squared&)
+{
+  return std::sqrt(static_cast<double>(dr) * dr 
+    + static_cast<double>(dc) * dc);
+}
+
+double brute_force_distance(int dr, int dc, const rt::manhattan&)
+{
+  return std::abs(dr) + std::abs(dc);
+}
+
+double brute_force_distance(int dr, int dc, const rt::chessboard&)
+{
+  return std::max(std::abs(dr), std::abs(dc));
+}
+
+template<class Method>
+void test_brute_force(const std::string& name)
+{
+  const int rows = 23;
+  const int cols = 31;
+  const int target = 2;
+  // few targets, to have long distances and rows without target
+  auto map = make_map(rows, cols, 40, 2);
+  rt::memory_raster<double> out(rows, cols);
+  check(rt::distance_transform(map, out, target, Method{}),
+    name + " finds the target");
+
+  bool same = true;
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      double nearest = -1;
+      for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+          if (map.row(i)[j] != target) continue;
+          const double d = brute_force_distance(i - r, j - c, Method{});
+          if (nearest < 0 || d < nearest) nearest = d;
+        }
+      }
+      if (out.row(r)[c] != nearest) same = false;
+    }
+  }
+  check(same, name + " against brute force");
+}
+
+// A wide map with few targets, so that rows + cols is beyond 46340 and 
+// the squared distances to columns without target do not fit in int
+template<class Method>
+void test_wide(const std::string& name)
+{
+  const int rows = 3;
+  const int cols = 80000;
+  const int target = 1;
+  rt::memory_raster<int> map(rows, cols);
+  std::mt19937 rng(3);
+  std::vector<int> targets;
+  for (int k = 0; k < 5; ++k) {
+    const int index = static_cast<int>(rng() % map.size());
+    map.data()[index] = target;
+    targets.push_back(index);
+  }
+  rt::memory_raster<double> out(rows, cols);
+  rt::distance_transform(map, out, target, Method{});
+
+  bool same = true;
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      double nearest = -1;
+      for (int index : targets) {
+        const double d = brute_force_distance(index / cols - r, 
+          index % cols - c, Method{});
+        if (nearest < 0 || d < nearest) nearest = d;
+      }
+      if (out.row(r)[c] != nearest) same = false;
+    }
+  }
+  check(same, name + " against brute force, rows + cols > 46340");
+}
+
+// Brute force distance from cell (r, c) to the nearest cell for which 
+// is_target(row, col), -1 if there is none
+template<class Method, class IsTarget>
+double brute_force_nearest(int rows, int cols, int r, int c, 
+  IsTarget&& is_target)
+{
+  double nearest = -1;
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      if (!is_target(i, j)) continue;
+      const double d = brute_force_distance(i - r, j - c, Method{});
+      if (nearest < 0 || d < nearest) nearest = d;
+    }
+  }
+  return nearest;
+}
+
+// The distances are those of brute force, and the nearest target is a 
+// target at that distance, as ties are broken arbitrarily. Few categories
+// give many ties, a single category gives no target. Without target, 
+// nearest is -1 throughout.
+template<class Method>
+void test_nearest_feature(const std::string& name)
+{
+  const int sizes[][2] = { { 23, 31 }, { 1, 40 }, { 40, 1 } };
+  const int target = 2;
+  unsigned seed = 5;
+  for (auto&& size : sizes) {
+    const int rows = size[0];
+    const int cols = size[1];
+    const std::string what = name + " nearest feature, " 
+      + std::to_string(rows) + " x " + std::to_string(cols);
+    for (int nCats : { 3, 40, 1 }) {
+      auto map = make_map(rows, cols, nCats, seed++);
+      rt::memory_raster<double> out(rows, cols);
+      rt::memory_raster<int> nearest(rows, cols);
+      const bool found = rt::nearest_feature_transform(map, out, nearest, 
+        target, Method{});
+      const bool present = std::find(map.begin(), map.end(), target)
+        != map.end();
+      check(found == present, what + ": finds the target");
+
+      bool same = true;
+      for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+          const int index = nearest.row(r)[c];
+          if (!present) {
+            if (index != -1) same = false;
+            continue;
+          }
+          const double d = brute_force_nearest<Method>(rows, cols, r, c,
+            [&](int i, int j) { return map.row(i)[j] == target; });
+          if (out.row(r)[c] != d || index < 0 || index >= rows * cols
+            || map.row(index / cols)[index % cols] != target
+            || brute_force_distance(index / cols - r, index % cols - c,
+            Method{}) != d) {
+            same = false;
+          }
+        }
+      }
+      check(same, what + ", " + std::to_string(nCats) 
+        + " categories: against brute force");
+    }
+  }
+}
+
+// The distance is that of brute force to the nearest cell of another 
+// category or outside the range of categories. The label is the category 
+// of a cell at that distance, or -1 if that cell is outside the range. 
+// Cells outside the range are left unchanged, and if a category has no 
+// other category in the map, its cells get label -1. The blocks have cells
+// whose nearest other category is several rows away in the same column.
+template<class Method>
+void test_nearest_other_category(const std::string& name)
+{
+  const int rows = 23;
+  const int cols = 31;
+  const int nCats = 3;
+  const double unchanged = -7;
+  for (int variant = 0; variant < 4; ++variant) {
+    const std::string what = name + " nearest other category, " 
+      + (variant == 0 ? "categories" : variant == 1 ? "outside range" 
+      : variant == 2 ? "single category" : "blocks");
+    auto map = make_map(rows, cols, nCats + 1, 6); // nCats is outside
+    for (auto&& i : map) {
+      if (variant == 0 && i == nCats) i = 0;
+      if (variant == 2) i = 1;
+    }
+    if (variant == 1) map.row(0)[0] = -1;
+    if (variant == 3) {
+      for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+          map.row(r)[c] = (r / 7 + c / 11) % nCats;
+        }
+      }
+    }
+    rt::memory_raster<double> out(rows, cols);
+    rt::memory_raster<int> labels(rows, cols);
+    std::fill(out.begin(), out.end(), unchanged);
+    std::fill(labels.begin(), labels.end(), -9);
+    const bool all_found = rt::nearest_other_category(map, out, labels, nCats,
+      Method{});
+    check(all_found == (variant != 2), what + ": all found");
+
+    bool same = true;
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < cols; ++c) {
+        const int k = map.row(r)[c];
+        const double d_out = out.row(r)[c];
+        const int label = labels.row(r)[c];
+        if (k < 0 || k >= nCats) {
+          if (d_out != unchanged || label != -9) same = false;
+          continue;
+        }
+        const double d = brute_force_nearest<Method>(rows, cols, r, c,
+          [&](int i, int j) { return map.row(i)[j] != k; });
+        if (d < 0) {
+          if (label != -1) same = false;
+          continue;
+        }
+        bool label_at_d = false;
+        for (int i = 0; i < rows; ++i) {
+          for (int j = 0; j < cols; ++j) {
+            const int other = map.row(i)[j];
+            if (other == k 
+              || brute_force_distance(i - r, j - c, Method{}) != d) {
+              continue;
+            }
+            if (label == (other >= 0 && other < nCats ? other : -1)) {
+              label_at_d = true;
+            }
+          }
+        }
+        if (d_out != d || !label_at_d) same = false;
+      }
+    }
+    check(same, what + ": against brute force");
+  }
+}
+
+// The parallel transform at 1, 2 and all threads gives the same result as
+// the serial transform. The map is wide enough for several column strips.
+template<class Method>
+void test_parallel(const std::string& name)
+{
+  const int rows = 150;
+  const int cols = 300;
+  const int target = 1;
+  auto map = make_map(rows, cols, 50, 3);
+  rt::memory_raster<double> serial(rows, cols);
+  const bool found = rt::distance_transform(map, serial, target, Method{});
+  for (int threads : { 1, 2, 0 }) {
+    rt::memory_raster<double> parallel(rows, cols);
+    const std::string what = name + ", threads = " + std::to_string(threads);
+    check(rt::distance_transform(map, parallel, target, Method{},
+      rt::parallel_execution(threads)) == found, "parallel result " + what);
+    check(std::equal(serial.begin(), serial.end(), parallel.begin()),
+      "parallel distances " + what);
+  }
+}
+
+// The single-sweep transform for all categories gives, for each category,
+// the result of a separate transform, also for a category that does not
+// occur in the map
+template<class Method>
+void test_multi(const std::string& name)
+{
+  const int rows = 29;
+  const int cols = 41;
+  const int nCats = 6;
+  auto map = make_map(rows, cols, nCats - 1, 7);
+  std::vector<rt::memory_raster<double> > outs;
+  for (int k = 0; k < nCats; ++k) {
+    outs.emplace_back(rows, cols);
+  }
+  const std::vector<bool> found = rt::multi_distance_transform(map, outs, 
+    nCats, Method{});
+  for (int k = 0; k < nCats; ++k) {
+    const std::string what = name + ", category " + std::to_string(k);
+    rt::memory_raster<double> single(rows, cols);
+    check(found[k] == rt::distance_transform(map, single, k, Method{}),
+      "multi result " + what);
+    check(std::equal(single.begin(), single.end(), outs[k].begin()),
+      "multi distances " + what);
+  }
+}
+
+// The bounded transform gives the distances of the transform up to the 
+// radius, and the saturated value floor(radius) + 1, squared for 
+// euclidean_squared, beyond it. The bounded single-sweep transform gives
+// the same for each category.
+template<class Method>
+void test_bounded(const std::string& name)
+{
+  const int rows = 29;
+  const int cols = 41;
+  const int nCats = 6;
+  // few cells per category, to have distances beyond the radius
+  auto map = make_map(rows, cols, 60, 8);
+  for (double radius : { 0.0, 2.5, 4.0, 7.3, 100.0 }) {
+    const double cap = std::floor(radius) + 1;
+    const double saturated = std::is_same<Method, rt::euclidean_squared>::value
+      ? cap * cap : cap;
+    std::vector<rt::memory_raster<double> > outs;
+    for (int k = 0; k < nCats; ++k) {
+      outs.emplace_back(rows, cols);
+    }
+    const std::vector<bool> found = rt::bounded_multi_distance_transform(map,
+      outs, nCats, radius, Method{});
+    for (int k = 0; k < nCats; ++k) {
+      const std::string what = name + ", radius " + std::to_string(radius)
+        + ", category " + std::to_string(k);
+      rt::memory_raster<double> full(rows, cols);
+      rt::memory_raster<double> bounded(rows, cols);
+      const bool has_target = rt::distance_transform(map, full, k, Method{});
+      check(rt::bounded_distance_transform(map, bounded, k, radius, Method{})
+        == has_target, "bounded result " + what);
+      check(found[k] == has_target, "bounded multi result " + what);
+      if (!has_target) continue;
+      bool same = true;
+      for (auto f = full.begin(), b = bounded.begin(); f != full.end(); 
+        ++f, ++b) {
+        const double expected = *f <= rt::detail::radius_in_units(radius, 
+          Method{}) ? *f : saturated;
+        if (*b != expected) same = false;
+      }
+      check(same, "bounded distances " + what);
+      check(std::equal(bounded.begin(), bounded.end(), outs[k].begin()),
+        "bounded multi distances " + what);
+    }
+  }
+}
+
+// A workspace reserved for the size of the raster is not reallocated by 
+// transforms of that size, also not for a target that does not occur, 
+// which leaves all column distances at rows + cols
+template<class Method>
+void test_workspace(const std::string& name)
+{
+  const int rows = 37;
+  const int cols = 23;
+  auto map = make_map(rows, cols, 10, 9);
+  rt::memory_raster<double> out(rows, cols);
+  rt::distance_transform_workspace workspace(rows, cols);
+  const auto g = workspace.m_g.data();
+  const auto st = workspace.m_st.data();
+  const auto h = workspace.m_h.data();
+  const auto last = workspace.m_last.data();
+  for (int target : { 1, 10 }) {
+    rt::distance_transform(map, out, target, Method{}, workspace);
+  }
+  check(workspace.m_g.data() == g && workspace.m_st.data() == st
+    && workspace.m_h.data() == h && workspace.m_last.data() == last,
+    name + " transforms in a reserved workspace do not allocate");
+}
+
+// The blocked transform, in memory and out of core, gives the same result
+// as the serial transform, also for blocks that do not divide the raster
+// and for rasters of a single row or column.
+template<class Method>
+void test_blocked(const std::string& name)
+{
+  const int sizes[][2] = { { 37, 53 }, { 1, 40 }, { 40, 1 }, { 1, 1 } };
+  const int blocks[][2] = { { 8, 16 }, { 5, 7 }, { 1, 1 }, { 256, 256 } };
+  unsigned seed = 4;
+  for (auto&& size : sizes) {
+    const int rows = size[0];
+    const int cols = size[1];
+    const int target = 1;
+    auto map = make_map(rows, cols, 20, seed++);
+    rt::memory_raster<double> serial(rows, cols);
+    const bool found = rt::distance_transform(map, serial, target, Method{});
+    for (auto&& block : blocks) {
+      for (bool out_of_core : { false, true }) {
+        const std::string what = name + ", " + std::to_string(rows) + " x "
+          + std::to_string(cols) + " in blocks of " 
+          + std::to_string(block[0]) + " x " + std::to_string(block[1]) 
+          + (out_of_core ? ", out of core" : ", in memory");
+        rt::memory_raster<double> blocked(rows, cols);
+        const rt::blocked_execution exec(rt::block_layout(block[0], block[1]),
+          out_of_core);
+        check(rt::distance_transform(map, blocked, target, Method{}, exec)
+          == found, "blocked result " + what);
+        check(std::equal(serial.begin(), serial.end(), blocked.begin()),
+          "blocked distances " + what);
+      }
+    }
+  }
+}
+
+template<class Method>
+void test_method(const std::string& name)
+{
+  test_brute_force<Method>(name);
+  test_wide<Method>(name);
+  test_nearest_feature<Method>(name);
+  test_nearest_other_category<Method>(name);
+  test_parallel<Method>(name);
+  test_multi<Method>(name);
+  test_bounded<Method>(name);
+  test_workspace<Method>(name);
+  test_blocked<Method>(name);
+}
+
+int main()
+{
+  test_row_scan<rt::manhattan>("manhattan");
+  test_row_scan<rt::chessboard>("chessboard");
+  test_method<rt::euclidean_squared>("euclidean_squared");
+  test_method<rt::euclidean_non_squared>("euclidean");
+  test_method<rt::manhattan>("manhattan");
+  test_method<rt::chessboard>("chessboard");
+  return rt::test::report("distance_transform_test");
+}
@@ -0,0 +1,253 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of the distributions of similarity values: the flat distribution
+// against the map it replaces, through batches of additions, removals,
+// compaction and merges, and the error bound of the expected minimum of
+// histograms.
+
+#include "check.h"
+
+#include <blink/raster_tools/distribution.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+
+// Values on a grid of 1/64, so that values repeat
+double random_value(std::mt19937& rng)
+{
+  return static_cast<double>(rng() % 65) / 64;
+}
+
+// The compacted flat distribution holds the values of the map, with their
+// counts, from high to low value
+bool same_values(rt::flat_distribution flat, const rt::distribution& map)
+{
+  flat.compact();
+  if (flat.values().size() != map.size()) return false;
+  auto f = flat.values().begin();
+  for (auto&& i : map) {
+    if (f->first != i.first || f->second != i.second) return false;
+    ++f;
+  }
+  return true;
+}
+
+// Additions before and after compaction, and numbers of additions that
+// compact the pending values by themselves
+void test_add_compact()
+{
+  std::mt19937 rng(1);
+  for (int n : { 0, 1, 100, 5000, 20000 }) {
+    const std::string what = std::to_string(n) + " values";
+    rt::flat_distribution flat;
+    rt::distribution map;
+    check(flat.empty(), "empty before adding, " + what);
+    for (int i = 0; i < n; ++i) {
+      const double v = random_value(rng);
+      flat.add(v);
+      ++map[v];
+      if (i == n / 2) flat.compact();
+    }
+    check(flat.empty() == (n == 0), "empty after adding, " + what);
+    check(same_values(flat, map), "added values, " + what);
+  }
+}
+
+// Merging adds the counts of values in both distributions and keeps the
+// values in either one, whether they are compacted or still pending
+void test_merge()
+{
+  std::mt19937 rng(2);
+  for (int compacted = 0; compacted < 4; ++compacted) {
+    const std::string what = "compacted " + std::to_string(compacted);
+    rt::flat_distribution a;
+    rt::flat_distribution b;
+    rt::distribution map;
+    for (int i = 0; i < 3000; ++i) {
+      const double v = random_value(rng);
+      a.add(v);
+      ++map[v];
+    }
+    // b only has the upper half of the values
+    for (int i = 0; i < 2000; ++i) {
+      const double v = 0.5 + random_value(rng) / 2;
+      b.add(v);
+      ++map[v];
+    }
+    if (compacted & 1) a.compact();
+    if (compacted & 2) b.compact();
+    a.merge(b);
+    check(same_values(a, map), "merged values, " + what);
+
+    rt::flat_distribution empty;
+    empty.merge(a);
+    check(same_values(empty, map), "merged into empty, " + what);
+  }
+}
+
+// Removals before and after compaction, of values added in the same batch
+// and in an earlier batch. Values whose count reaches zero are dropped. 
+// 5000 removals compact the pending values by themselves.
+void test_remove()
+{
+  std::mt19937 rng(5);
+  for (int n : { 10, 1000, 10000 }) {
+    for (int compacted = 0; compacted < 2; ++compacted) {
+      const std::string what = std::to_string(n) + " values, compacted "
+        + std::to_string(compacted);
+      rt::flat_distribution flat;
+      rt::distribution map;
+      std::vector<double> added;
+      for (int i = 0; i < n; ++i) {
+        const double v = random_value(rng);
+        flat.add(v);
+        ++map[v];
+        added.push_back(v);
+      }
+      if (compacted) flat.compact();
+      // remove half of the values, and all observations of 0.5 and 1
+      std::shuffle(added.begin(), added.end(), rng);
+      for (std::size_t i = 0; i < added.size(); ++i) {
+        const double v = added[i];
+        if (2 * i >= added.size() && v != 0.5 && v != 1) continue;
+        flat.remove(v);
+        if (--map[v] == 0) map.erase(v);
+      }
+      check(map.count(0.5) == 0 && map.count(1) == 0, "removed all, " + what);
+      check(same_values(flat, map), "removed values, " + what);
+    }
+  }
+
+  // Removing all values leaves an empty list
+  rt::flat_distribution flat;
+  flat.add(0.25);
+  flat.add(0.25);
+  flat.compact();
+  flat.remove(0.25);
+  flat.add(0.75);
+  flat.remove(0.75);
+  flat.remove(0.25);
+  flat.compact();
+  check(flat.values().empty(), "all values removed");
+}
+
+// A histogram bin keeps its bounds while it holds values, and takes new
+// bounds once all its values have been removed
+void test_histogram_remove()
+{
+  rt::histogram_distribution hist(4);
+  hist.add(0.3);
+  hist.add(0.4);
+  hist.add(0.8);
+  hist.remove(0.4);
+  check(hist.lower_values().size() == 2 && hist.lower_values()[1].first == 0.3
+    && hist.upper_values()[1].first == 0.4 && hist.upper_values()[1].second
+    == 1, "bounds kept while the bin holds values");
+  hist.remove(0.3);
+  check(hist.lower_values().size() == 1, "empty bin is left out");
+  hist.add(0.45);
+  check(hist.lower_values().size() == 2 && hist.lower_values()[1].first 
+    == 0.45 && hist.upper_values()[1].first == 0.45, 
+    "bounds of an emptied bin are reset");
+}
+
+// The expected minimum of two flat distributions is that of the maps
+void test_expected_minimum()
+{
+  std::mt19937 rng(3);
+  rt::flat_distribution flatA;
+  rt::flat_distribution flatB;
+  rt::distribution mapA;
+  rt::distribution mapB;
+  for (int i = 0; i < 1000; ++i) {
+    const double a = random_value(rng);
+    const double b = random_value(rng) / 2;
+    flatA.add(a);
+    flatB.add(b);
+    ++mapA[a];
+    ++mapB[b];
+  }
+  flatA.compact();
+  flatB.compact();
+  check_close(rt::expected_minumum_of_two_distributions(flatA, flatB, 1000,
+    1000), rt::expected_minumum_of_two_distributions(mapA, mapB, 1000, 1000),
+    0, "expected minimum of flat distributions");
+}
+
+// The expected minimum of two histograms lies within its error of the 
+// exact expected minimum, and the error is at most half a bin width. With
+// a single value in each bin the error is 0 and the value exact.
+void test_histogram_expected_minimum()
+{
+  std::mt19937 rng(4);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (int bins : { 1, 2, 7, 64, 256 }) {
+    const std::string what = std::to_string(bins) + " bins";
+    rt::histogram_distribution histA(bins);
+    rt::histogram_distribution histB(bins);
+    rt::distribution mapA;
+    rt::distribution mapB;
+    for (int i = 0; i < 1000; ++i) {
+      const double a = uniform(rng);
+      const double b = uniform(rng) * uniform(rng);
+      histA.add(a);
+      histB.add(b);
+      ++mapA[a];
+      ++mapB[b];
+    }
+    const double exact = rt::expected_minumum_of_two_distributions(mapA, 
+      mapB, 1000, 1000);
+    double error = -1;
+    const double approximate = rt::expected_minumum_of_two_distributions(
+      histA, histB, 1000, 1000, error);
+    check(error >= 0 && error <= 0.5 / bins, "error of at most half a bin, "
+      + what);
+    check(std::abs(approximate - exact) <= error + 1e-12, 
+      "exact within the error, " + what);
+  }
+
+  // 0, 0.5 and 1 fall in different bins of four
+  rt::histogram_distribution histA(4);
+  rt::histogram_distribution histB(4);
+  rt::distribution mapA;
+  rt::distribution mapB;
+  const double values[] = { 0, 0.5, 1, 1, 0.5, 1 };
+  for (int i = 0; i < 6; ++i) {
+    histA.add(values[i]);
+    histB.add(values[5 - i] / 2);
+    ++mapA[values[i]];
+    ++mapB[values[5 - i] / 2];
+  }
+  double error = -1;
+  const double approximate = rt::expected_minumum_of_two_distributions(histA,
+    histB, 6, 6, error);
+  check(error == 0, "no error for single values in the bins");
+  check_close(approximate, rt::expected_minumum_of_two_distributions(mapA, 
+    mapB, 6, 6), 1e-15, "exact for single values in the bins");
+}
+
+int main()
+{
+  test_add_compact();
+  test_merge();
+  test_remove();
+  test_expected_minimum();
+  test_histogram_expected_minimum();
+  test_histogram_remove();
+  return rt::test::report("distribution_test");
+}
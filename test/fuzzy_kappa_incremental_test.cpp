@@ -0,0 +1,218 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of incremental_fuzzy_kappa: after every update the result is that
+// of fuzzy_kappa_2009 on the edited map, for updates that only recompute
+// the tiles around the changes and for updates that fall back to the whole
+// map.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_incremental.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_map;
+using rt::test::make_mask;
+using rt::test::make_matrix;
+using rt::test::make_sparse_map;
+
+// Applies the same changes to the incremental Fuzzy Kappa and to a copy of
+// the second map, and compares with fuzzy_kappa_2009 on that copy
+template<class DistanceDecay>
+class tester
+{
+public:
+  tester(int rows, int cols, int nCatsA, int nCatsB, DistanceDecay f)
+    : m_nCatsA(nCatsA), m_nCatsB(nCatsB), m_f(f)
+    , m_mapA(make_map(rows, cols, nCatsA, 1))
+    , m_mapB(make_sparse_map(rows, cols, nCatsB, 2))
+    , m_mask(make_mask(rows, cols))
+    , m_m(make_matrix(nCatsA, nCatsB))
+    , m_incremental(m_mapA, m_mapB, m_mask, nCatsA, nCatsB, m_m, f)
+  {
+  }
+
+  void update(const std::vector<rt::cell_change>& changes,
+    const std::string& what)
+  {
+    for (auto&& c : changes) {
+      m_mapB.row(c.row)[c.col] = c.category;
+    }
+    m_incremental.update(changes);
+
+    rt::memory_raster<double> comparison(m_mapA.size1(), m_mapA.size2());
+    double expected = 0;
+    const bool expected_result = rt::fuzzy_kappa_2009(m_mapA, m_mapB, m_mask,
+      m_nCatsA, m_nCatsB, m_m, m_f, comparison, rt::memory_raster_maker{},
+      expected);
+    double fk = 0;
+    const bool result = m_incremental.fuzzy_kappa(fk);
+    check(result == expected_result, what + ": result as fuzzy_kappa_2009");
+    check_close(fk, expected, 1e-12, what + ": as fuzzy_kappa_2009");
+  }
+
+  int rows() const { return static_cast<int>(m_mapA.size1()); }
+  int cols() const { return static_cast<int>(m_mapA.size2()); }
+  int nCatsB() const { return m_nCatsB; }
+  int category(int row, int col) const { return m_mapB.row(row)[col]; }
+
+private:
+  int m_nCatsA;
+  int m_nCatsB;
+  DistanceDecay m_f;
+  rt::memory_raster<int> m_mapA;
+  rt::memory_raster<int> m_mapB;
+  rt::memory_raster<int> m_mask;
+  rt::matrix<double> m_m;
+  rt::incremental_fuzzy_kappa<DistanceDecay> m_incremental;
+};
+
+template<class DistanceDecay>
+void test_updates(const std::string& name, int rows, int cols,
+  DistanceDecay f)
+{
+  const std::string size = name + ", " + std::to_string(rows) + " x " 
+    + std::to_string(cols);
+  tester<DistanceDecay> t(rows, cols, 5, 4, f);
+  std::mt19937 rng(3);
+  auto other = [&](int row, int col) {
+    return (t.category(row, col) + 1 + static_cast<int>(rng() % 3)) 
+      % t.nCatsB();
+  };
+
+  // Single cells, inside the map and near its edges and corners
+  const int cells[][2] = { { rows / 2, cols / 2 }, { 0, 0 }, 
+    { rows - 1, cols - 1 }, { 0, cols - 1 }, { rows - 1, 0 },
+    { 1, cols / 3 }, { rows / 3, cols - 2 } };
+  for (auto&& cell : cells) {
+    const rt::cell_change c = { cell[0], cell[1], other(cell[0], cell[1]) };
+    t.update({ c }, size + ", cell " + std::to_string(cell[0]) + ", " 
+      + std::to_string(cell[1]));
+  }
+
+  // A cell changed twice in one update, and a cell set to its own category
+  const int r = rows / 4;
+  const int c = cols / 4;
+  const rt::cell_change twice_first = { r, c, other(r, c) };
+  const rt::cell_change twice_second = { r, c, 
+    (twice_first.category + 1) % t.nCatsB() };
+  const rt::cell_change same = { r + 1, c, t.category(r + 1, c) };
+  t.update({ twice_first, same, twice_second }, size + ", changed twice");
+
+  // A burst all over the map, which recomputes the whole map
+  std::vector<rt::cell_change> burst;
+  for (int i = 0; i < rows * cols / 20; ++i) {
+    const int row = static_cast<int>(rng() % rows);
+    const int col = static_cast<int>(rng() % cols);
+    const rt::cell_change change = { row, col, other(row, col) };
+    burst.push_back(change);
+  }
+  t.update(burst, size + ", burst");
+
+  // Small updates after the burst
+  for (int i = 0; i < 5; ++i) {
+    const int row = static_cast<int>(rng() % rows);
+    const int col = static_cast<int>(rng() % cols);
+    const rt::cell_change change = { row, col, other(row, col) };
+    t.update({ change }, size + ", after burst " + std::to_string(i));
+  }
+}
+
+// Distance decay without a cutoff radius that counts its calls
+struct counting_decay
+{
+  double operator()(double d) const
+  {
+    ++*calls;
+    return d < 1 ? 1 : 0.5;
+  }
+
+  int* calls;
+};
+
+// The exception comes before the first map is prepared
+void test_no_cutoff()
+{
+  auto mapA = make_map(10, 10, 3, 1);
+  auto mapB = make_map(10, 10, 3, 2);
+  auto mask = make_mask(10, 10);
+  bool thrown = false;
+  try {
+    rt::incremental_fuzzy_kappa<rt::exponential_decay> incremental(mapA, mapB,
+      mask, 3, 3, make_matrix(3, 3), rt::exponential_decay(2));
+  }
+  catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  check(thrown, "no cutoff radius throws");
+
+  int calls = 0;
+  thrown = false;
+  try {
+    rt::incremental_fuzzy_kappa<counting_decay> incremental(mapA, mapB,
+      mask, 3, 3, make_matrix(3, 3), counting_decay{ &calls });
+  }
+  catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  check(thrown && calls == 0, "no cutoff radius throws before preparing");
+}
+
+// A change outside the map or the legend throws before any cell is
+// changed, also when it follows a valid change
+void test_invalid_changes()
+{
+  auto mapA = make_map(40, 30, 3, 1);
+  auto mapB = make_map(40, 30, 3, 2);
+  auto mask = make_mask(40, 30);
+  rt::incremental_fuzzy_kappa<rt::exponential_decay> incremental(mapA, mapB,
+    mask, 3, 3, make_matrix(3, 3), rt::exponential_decay(2, 0.01));
+  double before = 0;
+  incremental.fuzzy_kappa(before);
+
+  const rt::cell_change valid = { 5, 5, (mapB.row(5)[5] + 1) % 3 };
+  const rt::cell_change invalid[] = { { -1, 0, 0 }, { 40, 0, 0 },
+    { 0, -1, 0 }, { 0, 30, 0 }, { 0, 0, -1 }, { 0, 0, 3 } };
+  for (auto&& c : invalid) {
+    const std::string what = "change " + std::to_string(c.row) + ", "
+      + std::to_string(c.col) + " to " + std::to_string(c.category);
+    bool thrown = false;
+    try {
+      incremental.update({ valid, c });
+    }
+    catch (const std::out_of_range&) {
+      thrown = true;
+    }
+    double fk = 0;
+    incremental.fuzzy_kappa(fk);
+    check(thrown, what + ": throws");
+    check(fk == before, what + ": no cell changed");
+  }
+}
+
+int main()
+{
+  test_updates("exponential decay", 60, 53, rt::exponential_decay(2, 0.01));
+  test_updates("exponential decay", 211, 233, 
+    rt::exponential_decay(2, 0.01));
+  test_updates("one neighbour", 211, 233, rt::one_neighbour(0.5));
+  test_no_cutoff();
+  test_invalid_changes();
+  return rt::test::report("fuzzy_kappa_incremental_test");
+}
@@ -0,0 +1,222 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009_pairwise: every pair gives the value and 
+// comparison map of fuzzy_kappa_2009, with a budget that holds all maps 
+// and with budgets so small that the maps are processed in groups, in
+// which case each map is still prepared once.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_pairwise.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_map;
+using rt::test::maps;
+
+const int nCats = 4;
+
+// The two maps of the fixture and three more
+std::vector<rt::memory_raster<int> > all_maps(const maps& in)
+{
+  std::vector<rt::memory_raster<int> > all{ in.mapA, in.mapB };
+  for (unsigned seed = 3; seed <= 5; ++seed) {
+    all.push_back(make_map(in.rows, in.cols, nCats, seed));
+  }
+  return all;
+}
+
+// Budget for capacity maps and the scratch of preparing one
+template<class Distribution>
+std::size_t budget(const maps& in, int capacity, const Distribution& empty)
+{
+  const std::size_t cells = static_cast<std::size_t>(in.rows) * in.cols;
+  return capacity * rt::detail::pairwise_map_bytes(cells, nCats, empty)
+    + rt::detail::prepare_scratch_bytes(empty, cells, nCats);
+}
+
+// Records the comparison maps of the pairs, from the worker threads
+struct pair_recorder
+{
+  void operator()(int i, int j, const rt::memory_raster<double>& comparison)
+  {
+    std::lock_guard<std::mutex> lock(*mutex);
+    (*comparisons)[i * n + j].assign(comparison.begin(), comparison.end());
+  }
+
+  std::mutex* mutex;
+  std::vector<std::vector<double> >* comparisons;
+  int n;
+};
+
+// With budgets for all maps, for two maps in groups of one, and for four 
+// maps in groups of two that do not divide the five maps
+void test_groups()
+{
+  const maps in(31, 37, nCats, nCats);
+  const std::vector<rt::memory_raster<int> > all = all_maps(in);
+  const int n = static_cast<int>(all.size());
+  const rt::exponential_decay f(2);
+  rt::matrix<double> expected(n, std::vector<double>(n, 0));
+  std::vector<std::vector<double> > expected_maps(n * n);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      rt::memory_raster<double> comparison(in.rows, in.cols);
+      rt::fuzzy_kappa_2009(all[i], all[j], in.mask, nCats, nCats,
+        in.m, f, comparison, rt::memory_raster_maker{}, expected[i][j]);
+      expected_maps[i * n + j].assign(comparison.begin(), comparison.end());
+    }
+  }
+
+  const rt::flat_distribution empty;
+  for (int capacity : { n, 2, 4 }) {
+    for (int threads : { 1, 2 }) {
+      const std::string what = "budget for " + std::to_string(capacity)
+        + " maps, threads = " + std::to_string(threads);
+      rt::matrix<double> kappas;
+      rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m, f,
+        budget(in, capacity, empty), rt::parallel_execution(threads), kappas);
+      bool same = true;
+      for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+          if (kappas[i][j] != expected[i][j]) same = false;
+        }
+      }
+      check(same, what + ": as fuzzy_kappa_2009");
+
+      std::mutex mutex;
+      std::vector<std::vector<double> > comparisons(n * n);
+      rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m, f,
+        budget(in, capacity, empty) + threads * in.rows * in.cols
+        * sizeof(double), rt::parallel_execution(threads), 
+        pair_recorder{ &mutex, &comparisons, n }, kappas);
+      check(comparisons == expected_maps, 
+        what + ": comparison maps as fuzzy_kappa_2009");
+    }
+  }
+}
+
+// Histograms of 4 bins hold several values, which must survive the
+// unloading of a map with a budget for two maps
+void test_histograms()
+{
+  const maps in(31, 37, nCats, nCats);
+  const std::vector<rt::memory_raster<int> > all = all_maps(in);
+  const int n = static_cast<int>(all.size());
+  const rt::exponential_decay f(2, 0.01);
+  const rt::histogram_distributions histograms(4);
+  rt::matrix<double> kappas;
+  rt::matrix<double> errors;
+  rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m, f, histograms,
+    budget(in, 2, histograms.make()), rt::parallel_execution(2), kappas,
+    errors);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      const std::string pair = "histograms, pair " + std::to_string(i)
+        + ", " + std::to_string(j);
+      rt::memory_raster<double> comparison(in.rows, in.cols);
+      double fk = 0;
+      double error = 0;
+      rt::fuzzy_kappa_2009(all[i], all[j], in.mask, nCats, nCats, in.m, f,
+        comparison, rt::memory_raster_maker{}, histograms, fk, error);
+      check_close(kappas[i][j], fk, 1e-12, pair + ": as fuzzy_kappa_2009");
+      check_close(errors[i][j], error, 1e-12,
+        pair + ": error as fuzzy_kappa_2009");
+    }
+  }
+}
+
+// Decay that counts its calls, from the threads that prepare the maps
+struct counting_decay
+{
+  double operator()(double d) const
+  {
+    ++*calls;
+    return d < 1 ? 1 : 0.5;
+  }
+
+  std::atomic<long>* calls;
+};
+
+// Maps that are unloaded are read back, not prepared again: with a budget
+// for two maps there are as many calls to the decay as with all maps
+void test_prepared_once()
+{
+  const maps in(31, 37, nCats, nCats);
+  const std::vector<rt::memory_raster<int> > all = all_maps(in);
+  const int n = static_cast<int>(all.size());
+  const rt::flat_distribution empty;
+  std::atomic<long> all_calls(0);
+  rt::matrix<double> expected;
+  rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m,
+    counting_decay{ &all_calls }, budget(in, n, empty),
+    rt::parallel_execution(2), expected);
+  for (int capacity : { 2, 4 }) {
+    const std::string what = "budget for " + std::to_string(capacity)
+      + " maps";
+    std::atomic<long> calls(0);
+    rt::matrix<double> kappas;
+    rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m,
+      counting_decay{ &calls }, budget(in, capacity, empty),
+      rt::parallel_execution(2), kappas);
+    check(calls == all_calls, what + ": each map prepared once");
+    check(kappas == expected, what + ": as with all maps");
+  }
+}
+
+// Two maps and the scratch of one is the smallest budget
+void test_budget_boundary()
+{
+  const maps in(31, 37, nCats, nCats);
+  const std::vector<rt::memory_raster<int> > all = all_maps(in);
+  const int n = static_cast<int>(all.size());
+  const rt::flat_distribution empty;
+  rt::matrix<double> expected;
+  rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m,
+    rt::exponential_decay(2), budget(in, n, empty),
+    rt::parallel_execution(1), expected);
+  rt::matrix<double> kappas;
+  rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m,
+    rt::exponential_decay(2), budget(in, 2, empty),
+    rt::parallel_execution(1), kappas);
+  check(kappas == expected, "budget for two maps: as with all maps");
+
+  bool thrown = false;
+  try {
+    rt::fuzzy_kappa_2009_pairwise(all, in.mask, nCats, in.m,
+      rt::exponential_decay(2), budget(in, 2, empty) - 1,
+      rt::parallel_execution(1), kappas);
+  }
+  catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  check(thrown, "budget below two maps throws");
+}
+
+int main()
+{
+  test_groups();
+  test_histograms();
+  test_prepared_once();
+  test_budget_boundary();
+  return rt::test::report("fuzzy_kappa_pairwise_test");
+}
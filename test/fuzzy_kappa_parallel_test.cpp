@@ -0,0 +1,98 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009 in parallel: the result is the same for 1, 2
+// and more threads, and equal to the serial result up to the order in
+// which the similarities are added up. The distance transforms of the 
+// categories, which run concurrently, give the same layers as in serial.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <string>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::maps;
+
+// Numbers of threads to compare, 0 is one per core
+const int thread_counts[] = { 1, 2, 7, 0 };
+
+// Maps over several blocks of rows of the cell loop
+maps make_maps()
+{
+  return maps(75, 90, 5, 4);
+}
+
+void test_threads()
+{
+  const maps in = make_maps();
+  rt::memory_raster<double> serial_map(in.rows, in.cols);
+  double serial = 0;
+  rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+    in.m, rt::exponential_decay(2), serial_map, rt::memory_raster_maker{},
+    serial);
+
+  double first = 0;
+  for (int threads : thread_counts) {
+    const std::string what = "threads = " + std::to_string(threads);
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+      in.m, rt::exponential_decay(2), comparison, rt::memory_raster_maker{},
+      rt::parallel_execution(threads), fk);
+    if (threads == thread_counts[0]) first = fk;
+    check(fk == first, what + ": same for all numbers of threads");
+    check_close(fk, serial, 1e-12, what + ": as serial");
+    check(std::equal(serial_map.begin(), serial_map.end(),
+      comparison.begin()), what + ": comparison map as serial");
+  }
+}
+
+// The layers of the concurrent setup, for each precision and with and 
+// without a cutoff radius, show in the comparison map.
+template<class T, class DistanceDecay>
+void test_setup(const std::string& name, DistanceDecay f)
+{
+  const maps in = make_maps();
+  const rt::precision<T> prec;
+  rt::memory_raster<double> serial_map(in.rows, in.cols);
+  double serial = 0;
+  rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+    in.m, f, serial_map, rt::memory_raster_maker{}, prec, serial);
+
+  for (int threads : thread_counts) {
+    const std::string what = name + ", threads = " + std::to_string(threads);
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+      in.m, f, comparison, rt::memory_raster_maker{}, prec,
+      rt::parallel_execution(threads), fk);
+    check_close(fk, serial, 1e-12, what + ": as serial");
+    check(std::equal(serial_map.begin(), serial_map.end(),
+      comparison.begin()), what + ": comparison map as serial");
+  }
+}
+
+int main()
+{
+  test_threads();
+  test_setup<double>("double, cutoff", rt::exponential_decay(2, 0.01));
+  test_setup<float>("float", rt::exponential_decay(2));
+  test_setup<float>("float, one neighbour", rt::one_neighbour(0.5));
+  test_setup<rt::fixed16>("fixed16", rt::exponential_decay(2));
+  test_setup<rt::fixed16>("fixed16, cutoff", 
+    rt::exponential_decay(3, 0.05));
+  return rt::test::report("fuzzy_kappa_parallel_test");
+}
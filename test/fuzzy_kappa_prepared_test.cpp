@@ -0,0 +1,91 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of the prepared reference map: comparing it with a second map 
+// gives the value and comparison map of fuzzy_kappa_2009, for any number
+// of second maps in turn and in serial and parallel batches.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_prepared.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_map;
+using rt::test::maps;
+
+// Second maps for the reference map of the fixture, one of which lacks a
+// category and one of which is the reference map itself
+std::vector<rt::memory_raster<int> > second_maps(const maps& in)
+{
+  std::vector<rt::memory_raster<int> > mapsB{ in.mapB };
+  for (unsigned seed = 3; seed < 5; ++seed) {
+    mapsB.push_back(make_map(in.rows, in.cols, in.nCatsB, seed));
+  }
+  mapsB.push_back(make_map(in.rows, in.cols, in.nCatsB - 1, 5));
+  mapsB.push_back(in.mapA);
+  return mapsB;
+}
+
+template<class DistanceDecay>
+void test_second_maps(const std::string& name, DistanceDecay f)
+{
+  const maps in(48, 65, 4, 4);
+  const std::vector<rt::memory_raster<int> > mapsB = second_maps(in);
+  auto reference = rt::make_prepared_map(in.mapA, in.mask, in.nCatsA,
+    in.nCatsB, in.m, f);
+  std::vector<double> expected;
+  for (std::size_t k = 0; k < mapsB.size(); ++k) {
+    const std::string what = name + ", map " + std::to_string(k);
+    rt::memory_raster<double> expected_map(in.rows, in.cols);
+    double expected_fk = 0;
+    const bool expected_result = rt::fuzzy_kappa_2009(in.mapA, mapsB[k],
+      in.mask, in.nCatsA, in.nCatsB, in.m, f, expected_map,
+      rt::memory_raster_maker{}, expected_fk);
+    expected.push_back(expected_fk);
+
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    const bool result = rt::fuzzy_kappa_2009(reference, mapsB[k],
+      comparison, fk);
+    check(result == expected_result, what + ": result as fuzzy_kappa_2009");
+    check_close(fk, expected_fk, 1e-12, what + ": as fuzzy_kappa_2009");
+    check(std::equal(expected_map.begin(), expected_map.end(),
+      comparison.begin()), what + ": comparison map as fuzzy_kappa_2009");
+  }
+
+  // The prepared map is not changed by the comparisons
+  std::vector<double> batch(mapsB.size());
+  rt::fuzzy_kappa_2009_batch(reference, mapsB.rbegin(), mapsB.rend(),
+    batch.rbegin());
+  check(batch == expected, name + ": batch as fuzzy_kappa_2009");
+  for (int threads : { 1, 2, 0 }) {
+    std::vector<double> parallel(mapsB.size());
+    rt::fuzzy_kappa_2009_batch(reference, mapsB.begin(), mapsB.end(),
+      parallel.begin(), rt::parallel_execution(threads));
+    check(parallel == expected, name + ": parallel batch, threads = " 
+      + std::to_string(threads));
+  }
+}
+
+int main()
+{
+  test_second_maps("exponential decay", rt::exponential_decay(2));
+  test_second_maps("cutoff", rt::exponential_decay(3, 0.05));
+  test_second_maps("one neighbour", rt::one_neighbour(0.5));
+  return rt::test::report("fuzzy_kappa_prepared_test");
+}
@@ -0,0 +1,86 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009_streaming: the value and the comparison map are
+// those of fuzzy_kappa_2009 for bands of a single row, bands that do not
+// divide the rows and bands larger than the map.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_streaming.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_sparse_map;
+using rt::test::maps;
+
+// Sparse maps, so that a band depends on cells up to the cutoff radius
+// away, across the band edges
+maps make_maps()
+{
+  return maps(make_sparse_map(57, 43, 5, 1), make_sparse_map(57, 43, 4, 2),
+    5, 4);
+}
+
+// 1 row, bands that do not divide the 57 rows, exactly the rows, and more
+const int band_sizes[] = { 1, 2, 10, 57, 100 };
+
+template<class DistanceDecay>
+void test_band_edges(const std::string& name, DistanceDecay f)
+{
+  const maps in = make_maps();
+  rt::memory_raster<double> expected_map(in.rows, in.cols);
+  double expected = 0;
+  rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+    in.m, f, expected_map, rt::memory_raster_maker{}, expected);
+
+  for (int band_rows : band_sizes) {
+    const std::string what = name + ", bands of " + std::to_string(band_rows);
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    rt::fuzzy_kappa_2009_streaming(in.mapA, in.mapB, in.mask, in.nCatsA,
+      in.nCatsB, in.m, f, comparison, band_rows, fk);
+    check_close(fk, expected, 1e-12, what + ": as fuzzy_kappa_2009");
+    check(std::equal(expected_map.begin(), expected_map.end(),
+      comparison.begin()), what + ": comparison map as fuzzy_kappa_2009");
+  }
+}
+
+void test_no_cutoff()
+{
+  const maps in = make_maps();
+  rt::memory_raster<double> comparison(in.rows, in.cols);
+  double fk = 0;
+  bool thrown = false;
+  try {
+    rt::fuzzy_kappa_2009_streaming(in.mapA, in.mapB, in.mask, in.nCatsA,
+      in.nCatsB, in.m, rt::exponential_decay(2), comparison, 10, fk);
+  }
+  catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  check(thrown, "no cutoff radius throws");
+}
+
+int main()
+{
+  test_band_edges("exponential decay", rt::exponential_decay(2, 0.01));
+  test_band_edges("long cutoff", rt::exponential_decay(4, 0.01));
+  test_band_edges("one neighbour", rt::one_neighbour(0.5));
+  test_no_cutoff();
+  return rt::test::report("fuzzy_kappa_streaming_test");
+}
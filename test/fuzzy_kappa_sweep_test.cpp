@@ -0,0 +1,86 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009_sweep: the value and the comparison map for
+// each distance decay function are those of a separate call of 
+// fuzzy_kappa_2009, for a mix of functions with and without a cutoff 
+// radius.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_sweep.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_sparse_map;
+using rt::test::maps;
+
+bool same_map(const rt::memory_raster<double>& a, 
+  const rt::memory_raster<double>& b, double tolerance)
+{
+  return std::equal(a.begin(), a.end(), b.begin(), [=](double x, double y) {
+    return std::fabs(x - y) <= tolerance;
+  });
+}
+
+// Sparse maps, so that the cutoff radius matters, in which the top
+// category does not occur, and a mix of functions with and without a
+// cutoff radius
+void test_functions()
+{
+  const maps in(make_sparse_map(67, 81, 5, 1, 1),
+    make_sparse_map(67, 81, 6, 2, 1), 5, 6);
+  const std::vector<rt::exponential_decay> fs = {
+    rt::exponential_decay(2, 0.01), rt::exponential_decay(1),
+    rt::exponential_decay(4, 0.1), rt::exponential_decay(6),
+    rt::exponential_decay(0.5, 0.2) };
+  std::vector<rt::memory_raster<double> > comparisons;
+  for (std::size_t k = 0; k < fs.size(); ++k) {
+    comparisons.emplace_back(in.rows, in.cols);
+  }
+  std::vector<double> fuzzykappas;
+  const std::vector<bool> result = rt::fuzzy_kappa_2009_sweep(in.mapA, 
+    in.mapB, in.mask, in.nCatsA, in.nCatsB, in.m, fs, comparisons,
+    rt::memory_raster_maker{}, fuzzykappas);
+  check(result.size() == fs.size() && fuzzykappas.size() == fs.size(),
+    "a value per function");
+
+  std::vector<double> without_maps;
+  rt::fuzzy_kappa_2009_sweep(in.mapA, in.mapB, in.mask, in.nCatsA, in.nCatsB,
+    in.m, fs, rt::memory_raster_maker{}, without_maps);
+  check(without_maps == fuzzykappas, "same without comparison maps");
+
+  for (std::size_t k = 0; k < fs.size(); ++k) {
+    const std::string what = "function " + std::to_string(k);
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    const bool single_result = rt::fuzzy_kappa_2009(in.mapA, in.mapB,
+      in.mask, in.nCatsA, in.nCatsB, in.m, fs[k], comparison,
+      rt::memory_raster_maker{}, fk);
+    check(result[k] == single_result, what + ": result as single");
+    check_close(fuzzykappas[k], fk, 1e-12, what + ": as single");
+    check(same_map(comparison, comparisons[k], 1e-12), 
+      what + ": comparison map as single");
+  }
+}
+
+int main()
+{
+  test_functions();
+  return rt::test::report("fuzzy_kappa_sweep_test");
+}
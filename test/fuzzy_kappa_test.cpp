@@ -0,0 +1,308 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009 on maps with unequal legends and different 
+// category frequencies in map A and map B, the expected similarity of 
+// histogram distributions against that of exact distributions, and the 
+// sparse similarity matrix against the dense matrix.
+
+#include "check.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+
+// Random map where category k has relative frequency weights[k]
+rt::memory_raster<int> make_map(int rows, int cols, 
+  const std::vector<double>& weights, unsigned seed)
+{
+  rt::memory_raster<int> map(rows, cols);
+  std::mt19937 rng(seed);
+  std::discrete_distribution<int> category(weights.begin(), weights.end());
+  for (auto&& i : map) {
+    i = category(rng);
+  }
+  return map;
+}
+
+rt::memory_raster<int> make_mask(int rows, int cols)
+{
+  rt::memory_raster<int> mask(rows, cols);
+  for (auto&& i : mask) {
+    i = 1;
+  }
+  return mask;
+}
+
+template<class DistanceDecay>
+double fuzzy_kappa(rt::memory_raster<int>& mapA, rt::memory_raster<int>& mapB,
+  int nCatsA, int nCatsB, const rt::matrix<double>& m, DistanceDecay f)
+{
+  const int rows = static_cast<int>(mapA.size1());
+  const int cols = static_cast<int>(mapA.size2());
+  rt::memory_raster<int> mask = make_mask(rows, cols);
+  rt::memory_raster<double> comparison(rows, cols);
+  double fk = 0;
+  rt::fuzzy_kappa_2009(mapA, mapB, mask, nCatsA, nCatsB, m, f, comparison,
+    rt::memory_raster_maker{}, fk);
+  return fk;
+}
+
+// Without neighbourhood, and with the identity matrix, Fuzzy Kappa is 
+// Cohen's Kappa. The expected agreement is the sum over the categories of
+// the frequency in A times the frequency in B.
+void test_cohens_kappa()
+{
+  const int rows = 40;
+  const int cols = 50;
+  const int nCatsA = 3;
+  const int nCatsB = 2;
+  auto mapA = make_map(rows, cols, { 0.6, 0.3, 0.1 }, 1);
+  auto mapB = make_map(rows, cols, { 0.2, 0.8 }, 2);
+  rt::matrix<double> m(nCatsA, std::vector<double>(nCatsB, 0));
+  m[0][0] = 1;
+  m[1][1] = 1;
+
+  std::vector<double> countA(nCatsA, 0);
+  std::vector<double> countB(nCatsB, 0);
+  double agree = 0;
+  auto a = mapA.begin();
+  auto b = mapB.begin();
+  for (; a != mapA.end(); ++a, ++b) {
+    ++countA[*a];
+    ++countB[*b];
+    if (*a == *b) ++agree;
+  }
+  const double n = static_cast<double>(rows) * cols;
+  const double expected = (countA[0] * countB[0] + countA[1] * countB[1]) 
+    / (n * n);
+  const double kappa = (agree / n - expected) / (1 - expected);
+
+  check_close(fuzzy_kappa(mapA, mapB, nCatsA, nCatsB, m, 
+    rt::one_neighbour(0)), kappa, 1e-12, "Cohen's Kappa, nCatsA > nCatsB");
+
+  rt::matrix<double> transposed(nCatsB, std::vector<double>(nCatsA, 0));
+  transposed[0][0] = 1;
+  transposed[1][1] = 1;
+  check_close(fuzzy_kappa(mapB, mapA, nCatsB, nCatsA, transposed,
+    rt::one_neighbour(0)), kappa, 1e-12, "Cohen's Kappa, nCatsA < nCatsB");
+}
+
+// Swapping the maps and transposing the matrix gives the same Fuzzy Kappa
+void test_symmetry()
+{
+  const int rows = 30;
+  const int cols = 35;
+  const int nCatsA = 4;
+  const int nCatsB = 2;
+  auto mapA = make_map(rows, cols, { 0.5, 0.1, 0.3, 0.1 }, 3);
+  auto mapB = make_map(rows, cols, { 0.7, 0.3 }, 4);
+  rt::matrix<double> m(nCatsA, std::vector<double>(nCatsB, 0));
+  rt::matrix<double> transposed(nCatsB, std::vector<double>(nCatsA, 0));
+  const double values[4][2] = { { 1, 0.2 }, { 0, 1 }, { 0.5, 0 }, { 0, 0.4 } };
+  for (int i = 0; i < nCatsA; ++i) {
+    for (int j = 0; j < nCatsB; ++j) {
+      m[i][j] = values[i][j];
+      transposed[j][i] = values[i][j];
+    }
+  }
+  const double ab = fuzzy_kappa(mapA, mapB, nCatsA, nCatsB, m, 
+    rt::exponential_decay(2));
+  const double ba = fuzzy_kappa(mapB, mapA, nCatsB, nCatsA, transposed,
+    rt::exponential_decay(2));
+  check_close(ab, ba, 1e-12, "Fuzzy Kappa is symmetric");
+  check(ab > -1 && ab < 1, "Fuzzy Kappa is in range");
+}
+
+// Fuzzy Kappa is (mean - expected) / (1 - expected), so the expected
+// similarity follows from Fuzzy Kappa and the mean of the comparison map
+double expected_similarity(double fuzzykappa,
+  const rt::memory_raster<double>& comparison)
+{
+  double mean = 0;
+  for (auto&& i : comparison) {
+    mean += i;
+  }
+  mean /= static_cast<double>(comparison.size1() * comparison.size2());
+  return (mean - fuzzykappa) / (1 - fuzzykappa);
+}
+
+// The expected similarity of exact distributions and of histograms with
+// the given numbers of bins. Returns the largest error of the histograms.
+template<class DistanceDecay>
+double test_histograms(const rt::matrix<double>& m, DistanceDecay f,
+  std::initializer_list<int> bin_counts, const std::string& name)
+{
+  const int rows = 40;
+  const int cols = 50;
+  const int nCats = 3;
+  auto mapA = make_map(rows, cols, { 0.6, 0.3, 0.1 }, 5);
+  auto mapB = make_map(rows, cols, { 0.2, 0.5, 0.3 }, 6);
+  auto mask = make_mask(rows, cols);
+  rt::memory_raster<double> comparison(rows, cols);
+  double fk = 0;
+  rt::fuzzy_kappa_2009(mapA, mapB, mask, nCats, nCats, m, f, comparison,
+    rt::memory_raster_maker{}, fk);
+  const double exact = expected_similarity(fk, comparison);
+
+  double largest = 0;
+  for (int bins : bin_counts) {
+    const std::string what = name + ", " + std::to_string(bins) + " bins";
+    double fk_hist = 0;
+    double error = -1;
+    rt::fuzzy_kappa_2009(mapA, mapB, mask, nCats, nCats, m, f, comparison,
+      rt::memory_raster_maker{}, rt::histogram_distributions(bins), fk_hist,
+      error);
+    const double approximate = expected_similarity(fk_hist, comparison);
+    check(error >= 0 && error <= 0.5 / bins + 1e-15,
+      "error of at most half a bin, " + what);
+    check(std::abs(approximate - exact) <= error + 1e-12,
+      "exact expected similarity within the error, " + what);
+    largest = std::max(largest, error);
+  }
+  return largest;
+}
+
+// For many similarity values, the error bound holds for few and many bins
+// and is not trivially 0
+void test_histogram_error()
+{
+  const rt::matrix<double> m = { { 1, 0.25, 0.5 }, { 0, 1, 0.25 },
+    { 0.5, 0, 1 } };
+  const double error = test_histograms(m, rt::exponential_decay(2),
+    { 1, 4, 16, 64, 256 }, "exponential decay");
+  check(error > 0, "histograms have an error");
+}
+
+// With the identity matrix and one_neighbour(0.5), the similarities are 0,
+// 0.5 and 1, which fall in separate bins of four or more. The histograms
+// are then exact.
+void test_histogram_single_values()
+{
+  const rt::matrix<double> m = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+  const double error = test_histograms(m, rt::one_neighbour(0.5),
+    { 4, 16, 256 }, "single values in the bins");
+  check(error == 0, "no error for single values in the bins");
+}
+
+// The dense similarity of a cell: the maximum of m[catA][catB] * da[catA]
+// over catA, and 0 if none is positive. Likewise for map B.
+void dense_similarity(const rt::matrix<double>& m, 
+  const std::vector<double>& da, const std::vector<double>& db, 
+  std::vector<double>& simA, std::vector<double>& simB)
+{
+  const int nCatsA = static_cast<int>(da.size());
+  const int nCatsB = static_cast<int>(db.size());
+  simA.assign(nCatsB, 0);
+  simB.assign(nCatsA, 0);
+  for (int catA = 0; catA < nCatsA; ++catA) {
+    for (int catB = 0; catB < nCatsB; ++catB) {
+      simA[catB] = std::max(simA[catB], m[catA][catB] * da[catA]);
+      simB[catA] = std::max(simB[catA], m[catA][catB] * db[catB]);
+    }
+  }
+}
+
+// The sparse matrix gives the similarities of the dense matrix along a row
+// of cells, for the identity, through its fast path, and for matrices 
+// with zeros, negative entries, an almost diagonal matrix and unequal 
+// legends
+void test_sparse_matrix()
+{
+  const rt::matrix<double> identity = { { 1, 0, 0 }, { 0, 1, 0 }, 
+    { 0, 0, 1 } };
+  const rt::matrix<double> diagonal = { { 1, 0, 0 }, { 0, 1, 0 }, 
+    { 0, 0.5, 1 } };
+  const rt::matrix<double> mixed = { { 0.5, 0, -0.25 }, { 0, 1, 0.75 }, 
+    { 0.25, 0, 0 } };
+  const rt::matrix<double> unequal = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, 
+    { 0, 0, 1, 0 } };
+  const rt::matrix<double> zero = { { 0, 0 }, { 0, 0 } };
+  struct test_case
+  {
+    const rt::matrix<double>* m;
+    int nCatsA;
+    int nCatsB;
+    bool identity;
+    const char* name;
+  };
+  const test_case cases[] = { { &identity, 3, 3, true, "identity" },
+    { &diagonal, 3, 3, false, "almost diagonal" },
+    { &mixed, 3, 3, false, "mixed" },
+    { &unequal, 3, 4, false, "unequal legends" },
+    { &zero, 2, 2, false, "zero" } };
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  const int cols = 37;
+  for (auto&& c : cases) {
+    const rt::sparse_similarity_matrix sparse(*c.m, c.nCatsA, c.nCatsB);
+    check(sparse.m_identity == c.identity, 
+      std::string("identity detected, ") + c.name);
+
+    // A row of decayed distances per category, with zeros for categories
+    // out of reach
+    std::vector<std::vector<double> > rowsA(c.nCatsA, 
+      std::vector<double>(cols));
+    std::vector<std::vector<double> > rowsB(c.nCatsB, 
+      std::vector<double>(cols));
+    std::vector<const double*> da;
+    std::vector<const double*> db;
+    for (auto&& row : rowsA) {
+      for (auto&& d : row) d = rng() % 4 == 0 ? 0 : uniform(rng);
+      da.push_back(row.data());
+    }
+    for (auto&& row : rowsB) {
+      for (auto&& d : row) d = rng() % 4 == 0 ? 0 : uniform(rng);
+      db.push_back(row.data());
+    }
+    std::vector<double> sparseA(c.nCatsB * cols, -1);
+    std::vector<double> sparseB(c.nCatsA * cols, -1);
+    rt::detail::similarity_rows(sparse, da, db, cols, sparseA.data(),
+      sparseB.data());
+
+    bool same = true;
+    for (int col = 0; col < cols; ++col) {
+      std::vector<double> cellA(c.nCatsA);
+      std::vector<double> cellB(c.nCatsB);
+      for (int k = 0; k < c.nCatsA; ++k) cellA[k] = rowsA[k][col];
+      for (int k = 0; k < c.nCatsB; ++k) cellB[k] = rowsB[k][col];
+      std::vector<double> simA;
+      std::vector<double> simB;
+      dense_similarity(*c.m, cellA, cellB, simA, simB);
+      for (int k = 0; k < c.nCatsB; ++k) {
+        if (sparseA[k * cols + col] != simA[k]) same = false;
+      }
+      for (int k = 0; k < c.nCatsA; ++k) {
+        if (sparseB[k * cols + col] != simB[k]) same = false;
+      }
+    }
+    check(same, std::string("sparse against dense, ") + c.name);
+  }
+}
+
+int main()
+{
+  test_cohens_kappa();
+  test_symmetry();
+  test_histogram_error();
+  test_histogram_single_values();
+  test_sparse_matrix();
+  return rt::test::report("fuzzy_kappa_test");
+}
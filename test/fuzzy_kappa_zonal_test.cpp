@@ -0,0 +1,127 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of fuzzy_kappa_2009_zonal: the overall value is that of 
+// fuzzy_kappa_2009 with the zone map as mask, and the value of each zone is
+// that of fuzzy_kappa_2009 with a mask of that zone only.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/fuzzy_kappa_zonal.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::maps;
+
+// Zones 1..nZones in diagonal bands, with cells outside any zone scattered
+// over them
+rt::memory_raster<int> make_zones(int rows, int cols, int nZones)
+{
+  rt::memory_raster<int> zones(rows, cols);
+  std::mt19937 rng(3);
+  for (int r = 0; r < rows; ++r) {
+    auto row = zones.row(r);
+    for (int c = 0; c < cols; ++c) {
+      row[c] = rng() % 6 == 0 ? 0 : 1 + (r + c / 7) % nZones;
+    }
+  }
+  return zones;
+}
+
+rt::memory_raster<int> zone_mask(const rt::memory_raster<int>& zones,
+  int zone)
+{
+  rt::memory_raster<int> mask(zones.size1(), zones.size2());
+  std::transform(zones.begin(), zones.end(), mask.begin(),
+    [zone](int z) { return z == zone ? 1 : 0; });
+  return mask;
+}
+
+// A value per zone, with an empty last zone, and the overall value
+void test_zones()
+{
+  const maps in(60, 53, 5, 4);
+  const int nZones = 4;
+  auto zones = make_zones(in.rows, in.cols, nZones - 1); // last zone is empty
+  const rt::exponential_decay f(2);
+
+  rt::memory_raster<double> comparison(in.rows, in.cols);
+  std::vector<double> fuzzykappas;
+  const std::vector<bool> result = rt::fuzzy_kappa_2009_zonal(in.mapA,
+    in.mapB, zones, in.nCatsA, in.nCatsB, nZones, in.m, f, comparison,
+    rt::memory_raster_maker{}, fuzzykappas);
+  check(fuzzykappas.size() == nZones + 1 && result.size() == nZones + 1,
+    "a value per zone and overall");
+
+  rt::memory_raster<double> overall_map(in.rows, in.cols);
+  double overall = 0;
+  const bool overall_result = rt::fuzzy_kappa_2009(in.mapA, in.mapB, zones,
+    in.nCatsA, in.nCatsB, in.m, f, overall_map, rt::memory_raster_maker{},
+    overall);
+  check(result[0] == overall_result, "overall result as masked");
+  check_close(fuzzykappas[0], overall, 1e-12,
+    "overall as zone map as mask");
+  check(std::equal(overall_map.begin(), overall_map.end(), comparison.begin()),
+    "comparison map as zone map as mask");
+
+  for (int zone = 1; zone <= nZones; ++zone) {
+    const std::string what = "zone " + std::to_string(zone);
+    auto mask = zone_mask(zones, zone);
+    rt::memory_raster<double> zone_map(in.rows, in.cols);
+    double fk = 0;
+    const bool zone_result = rt::fuzzy_kappa_2009(in.mapA, in.mapB, mask,
+      in.nCatsA, in.nCatsB, in.m, f, zone_map, rt::memory_raster_maker{}, fk);
+    check(result[zone] == zone_result, what + ": result as masked");
+    check_close(fuzzykappas[zone], fk, 1e-12, what + ": as masked");
+  }
+  check(!result[nZones] && fuzzykappas[nZones] == 0, "empty zone");
+}
+
+// Values in the zone map outside 0..nZones are excluded
+void test_outside_zones()
+{
+  const maps in(41, 37, 3, 3);
+  const int nZones = 2;
+  auto zones = make_zones(in.rows, in.cols, nZones + 1); // zone 3 is outside
+
+  rt::memory_raster<double> comparison(in.rows, in.cols);
+  std::vector<double> fuzzykappas;
+  rt::fuzzy_kappa_2009_zonal(in.mapA, in.mapB, zones, in.nCatsA, in.nCatsB,
+    nZones, in.m, rt::exponential_decay(2), comparison,
+    rt::memory_raster_maker{}, fuzzykappas);
+
+  auto mask = zone_mask(zones, 1);
+  auto mask2 = zone_mask(zones, 2);
+  std::transform(mask.begin(), mask.end(), mask2.begin(), mask.begin(),
+    [](int a, int b) { return a + b; });
+  rt::memory_raster<double> masked_map(in.rows, in.cols);
+  double fk = 0;
+  rt::fuzzy_kappa_2009(in.mapA, in.mapB, mask, in.nCatsA, in.nCatsB, in.m,
+    rt::exponential_decay(2), masked_map, rt::memory_raster_maker{}, fk);
+  check_close(fuzzykappas[0], fk, 1e-12,
+    "outside zones: overall as mask of the zones");
+  check(std::equal(masked_map.begin(), masked_map.end(), comparison.begin()),
+    "outside zones: comparison map as mask of the zones");
+}
+
+int main()
+{
+  test_zones();
+  test_outside_zones();
+  return rt::test::report("fuzzy_kappa_zonal_test");
+}
@@ -0,0 +1,321 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of the IDRISI reader and writer: rasters of each data type read
+// back as written, also through upper case file names, and Fuzzy Kappa of
+// the mapped rasters is that of the rasters in memory. The header has the
+// range of the stored values and the reference system of a model. Invalid
+// values, a wrong data type and files that do not match their header are
+// errors.
+// The files are written to the working directory and removed afterwards.
+
+#include "check.h"
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/idrisi_raster.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+
+// More cells than the write buffer of 4096 cells
+const int rows = 67;
+const int cols = 71;
+
+void remove_raster(const std::string& stem)
+{
+  std::remove((stem + ".rst").c_str());
+  std::remove((stem + ".RST").c_str());
+  std::remove((stem + ".rdc").c_str());
+  std::remove((stem + ".RDC").c_str());
+}
+
+template<class T>
+rt::memory_raster<T> make_raster(T lowest, T highest, unsigned seed)
+{
+  rt::memory_raster<T> raster(rows, cols);
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> value(lowest, highest);
+  for (auto&& i : raster) {
+    i = static_cast<T>(value(rng));
+  }
+  raster.row(0)[0] = lowest;
+  raster.row(rows - 1)[cols - 1] = highest;
+  return raster;
+}
+
+template<class T>
+bool same_cells(const rt::memory_raster<T>& expected,
+  const rt::idrisi_raster<T>& raster)
+{
+  if (raster.size1() != expected.size1()
+    || raster.size2() != expected.size2()) {
+    return false;
+  }
+  for (int r = 0; r < rows; ++r) {
+    if (!std::equal(expected.row(r), expected.row(r) + cols, raster.row(r))) {
+      return false;
+    }
+  }
+  return std::equal(expected.begin(), expected.end(), raster.begin());
+}
+
+rt::memory_raster<std::uint8_t> make_map(int nCats, unsigned seed)
+{
+  rt::memory_raster<std::uint8_t> map(rows, cols);
+  std::mt19937 rng(seed);
+  for (auto&& i : map) {
+    i = static_cast<std::uint8_t>(rng() % nCats);
+  }
+  return map;
+}
+
+// The header line that starts with key
+std::string header_line(const std::string& path, const std::string& key)
+{
+  std::ifstream in(path.c_str());
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, key.size(), key) == 0) return line;
+  }
+  return "";
+}
+
+template<class T>
+void test_round_trip(const std::string& name, rt::idrisi_data_type type,
+  T lowest, T highest)
+{
+  const std::string stem = "idrisi_raster_test_" + name;
+  const auto expected = make_raster<T>(lowest, highest, 1);
+  rt::write_idrisi_raster<T>(expected, stem + ".rst");
+
+  const rt::idrisi_header header = rt::read_idrisi_header(stem + ".rst");
+  check(header.m_rows == rows && header.m_cols == cols
+    && header.m_data_type == type, name + ": header");
+  check(same_cells(expected, rt::open_idrisi_raster<T>(stem + ".rst")),
+    name + ": cells as written");
+  check(same_cells(expected, rt::open_idrisi_raster<T>(stem + ".rdc")),
+    name + ": opened through the header");
+  check(same_cells(expected, rt::open_idrisi_raster<T>(stem)),
+    name + ": opened without extension");
+
+  std::rename((stem + ".rdc").c_str(), (stem + ".RDC").c_str());
+  bool same = false;
+  try {
+    same = same_cells(expected, rt::open_idrisi_raster<T>(stem + ".rst"));
+  }
+  catch (const std::runtime_error&) {
+  }
+  check(same, name + ": opened through an upper case header");
+
+  std::rename((stem + ".rst").c_str(), (stem + ".RST").c_str());
+  same = false;
+  try {
+    same = same_cells(expected, rt::open_idrisi_raster<T>(stem + ".RST"))
+      && same_cells(expected, rt::open_idrisi_raster<T>(stem + ".RDC"));
+  }
+  catch (const std::runtime_error&) {
+  }
+  check(same, name + ": opened through an upper case data file");
+  remove_raster(stem);
+}
+
+void test_nodata()
+{
+  const std::string stem = "idrisi_raster_test_nodata";
+  rt::memory_raster<std::int16_t> raster(rows, cols);
+  std::fill(raster.begin(), raster.end(), 5);
+  raster.row(3)[4] = -9999;
+  raster.row(4)[3] = 7;
+  rt::write_idrisi_raster<std::int16_t>(raster, stem + ".rst", -9999);
+  check(header_line(stem + ".rdc", "min. value") == "min. value  : 5",
+    "nodata: left out of the minimum");
+  check(header_line(stem + ".rdc", "max. value") == "max. value  : 7",
+    "nodata: maximum");
+  check(header_line(stem + ".rdc", "flag value") == "flag value  : -9999",
+    "nodata: flag value");
+  check(same_cells(raster, rt::open_idrisi_raster<std::int16_t>(stem)),
+    "nodata: cells as written");
+  remove_raster(stem);
+}
+
+// The value range in the header is that of the stored values, with enough
+// digits to read back as stored
+void test_real_range()
+{
+  const std::string stem = "idrisi_raster_test_real_range";
+  rt::memory_raster<double> values(2, 3);
+  std::fill(values.begin(), values.end(), 0.1);
+  values.row(0)[1] = -1.0 / 3;
+  values.row(1)[2] = 123456.789;
+  rt::write_idrisi_raster<float>(values, stem);
+  const float stored_min = static_cast<float>(-1.0 / 3);
+  const float stored_max = static_cast<float>(123456.789);
+  const auto value = [&](const std::string& key) {
+    const std::string line = header_line(stem + ".rdc", key);
+    return static_cast<float>(std::stod(line.substr(line.find(':') + 1)));
+  };
+  check(value("min. value") == stored_min, "real range: minimum as stored");
+  check(value("max. value") == stored_max, "real range: maximum as stored");
+  check(value("display max") == stored_max, "real range: display maximum");
+  remove_raster(stem);
+}
+
+// A raster written with a model header keeps its reference system, and
+// the reference system of a header without one is the plane
+void test_model()
+{
+  const std::string stem = "idrisi_raster_test_model";
+  const std::string copy = "idrisi_raster_test_model_copy";
+  rt::memory_raster<std::uint8_t> raster(rows, cols);
+  rt::write_idrisi_raster<std::uint8_t>(raster, stem + ".rst");
+  const rt::idrisi_header plane = rt::read_idrisi_header(stem);
+  check(plane.m_ref_system == "plane" && plane.m_min_x == "0"
+    && plane.m_max_x == std::to_string(cols)
+    && plane.m_max_y == std::to_string(rows) && plane.m_resolution == "1",
+    "model: plane by default");
+
+  {
+    std::ofstream header((stem + ".rdc").c_str(), std::ios::trunc);
+    header << "file format : IDRISI Raster A.1\n"
+      << "data type   : byte\n"
+      << "file type   : binary\n"
+      << "columns     : " << cols << "\n"
+      << "rows        : " << rows << "\n"
+      << "ref. system : US27TM18\n"
+      << "ref. units  : m\n"
+      << "unit dist.  : 1.0000000\n"
+      << "min. X      : 289000.5\n"
+      << "max. X      : 296100.5\n"
+      << "min. Y      : 4783000.25\n"
+      << "max. Y      : 4789700.25\n"
+      << "pos'n error : unknown\n"
+      << "resolution  : 100.0000000\n";
+  }
+  const rt::idrisi_header model = rt::read_idrisi_header(stem);
+  rt::write_idrisi_raster<std::uint8_t>(raster, copy + ".rst", model);
+  const rt::idrisi_header written = rt::read_idrisi_header(copy);
+  check(written.m_ref_system == "US27TM18"
+    && written.m_unit_dist == "1.0000000"
+    && written.m_min_x == "289000.5" && written.m_max_x == "296100.5"
+    && written.m_min_y == "4783000.25" && written.m_max_y == "4789700.25"
+    && written.m_resolution == "100.0000000",
+    "model: reference system kept");
+  check(header_line(copy + ".rdc", "ref. system") == "ref. system : US27TM18",
+    "model: reference system as in the model");
+  remove_raster(stem);
+  remove_raster(copy);
+}
+
+// Fuzzy Kappa of the mapped rasters is that of the same rasters in memory
+void test_fuzzy_kappa()
+{
+  const std::string stemA = "idrisi_raster_test_a";
+  const std::string stemB = "idrisi_raster_test_b";
+  const std::string stemMask = "idrisi_raster_test_mask";
+  const auto mapA = make_map(5, 2);
+  const auto mapB = make_map(4, 3);
+  const auto mask = make_map(2, 4);
+  rt::write_idrisi_raster<std::uint8_t>(mapA, stemA + ".rst");
+  rt::write_idrisi_raster<std::uint8_t>(mapB, stemB + ".rst");
+  rt::write_idrisi_raster<std::uint8_t>(mask, stemMask + ".rst");
+
+  const rt::matrix<double> m = { { 1, 0, 0.5, 0 }, { 0, 1, 0, 0 },
+    { 0.5, 0, 1, 0.25 }, { 0, 0, 0, 1 }, { 0, 0.5, 0, 0 } };
+  rt::memory_raster<double> expected_map(rows, cols);
+  double expected = 0;
+  rt::fuzzy_kappa_2009(mapA, mapB, mask, 5, 4, m, rt::exponential_decay(2),
+    expected_map, rt::memory_raster_maker{}, expected);
+
+  auto fileA = rt::open_idrisi_raster<std::uint8_t>(stemA);
+  auto fileB = rt::open_idrisi_raster<std::uint8_t>(stemB);
+  auto fileMask = rt::open_idrisi_raster<std::uint8_t>(stemMask);
+  rt::memory_raster<double> comparison(rows, cols);
+  double fk = 0;
+  rt::fuzzy_kappa_2009(fileA, fileB, fileMask, 5, 4, m,
+    rt::exponential_decay(2), comparison, rt::memory_raster_maker{}, fk);
+  check(fk == expected, "fuzzy kappa: as in memory");
+  check(std::equal(expected_map.begin(), expected_map.end(),
+    comparison.begin()), "fuzzy kappa: comparison map as in memory");
+  remove_raster(stemA);
+  remove_raster(stemB);
+  remove_raster(stemMask);
+}
+
+template<class F>
+bool throws(F&& f)
+{
+  try {
+    f();
+  }
+  catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+void test_errors()
+{
+  const std::string stem = "idrisi_raster_test_errors";
+  rt::memory_raster<double> values(2, 3);
+  values.row(1)[2] = 300;
+  check(throws([&] { rt::write_idrisi_raster<std::uint8_t>(values, stem); }),
+    "errors: value out of range");
+  values.row(1)[2] = 2.5;
+  check(throws([&] { rt::write_idrisi_raster<std::int16_t>(values, stem); }),
+    "errors: value with a fraction");
+  rt::write_idrisi_raster<float>(values, stem);
+  check(rt::open_idrisi_raster<float>(stem).row(1)[2] == 2.5f,
+    "errors: fraction kept as real");
+  values.row(1)[2] = -1e39;
+  check(throws([&] { rt::write_idrisi_raster<float>(values, stem); }),
+    "errors: value out of range for real");
+  values.row(1)[2] = 2.5;
+  check(throws([&] { rt::write_idrisi_raster<float>(values, stem,
+    rt::plane_idrisi_header(3, 2, rt::idrisi_data_type::real)); }),
+    "errors: model of another size");
+  check(throws([&] { rt::open_idrisi_raster<std::int16_t>(stem); }),
+    "errors: wrong data type");
+
+  { // one cell short
+    std::ofstream data((stem + ".rst").c_str(),
+      std::ios::binary | std::ios::trunc);
+    const float cells[5] = {};
+    data.write(reinterpret_cast<const char*>(cells), sizeof(cells));
+  }
+  check(throws([&] { rt::open_idrisi_raster<float>(stem); }),
+    "errors: data does not match the header");
+  remove_raster(stem);
+  check(throws([&] { rt::open_idrisi_raster<float>(stem); }),
+    "errors: no header");
+}
+
+int main()
+{
+  test_round_trip<std::uint8_t>("byte", rt::idrisi_data_type::byte, 0, 255);
+  test_round_trip<std::int16_t>("integer", rt::idrisi_data_type::integer,
+    -32768, 32767);
+  test_round_trip<float>("real", rt::idrisi_data_type::real, -1e6f, 1e6f);
+  test_nodata();
+  test_real_range();
+  test_model();
+  test_fuzzy_kappa();
+  test_errors();
+  return rt::test::report("idrisi_raster_test");
+}
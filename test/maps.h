@@ -0,0 +1,111 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Random maps, masks and similarity matrices for the test programs. The 
+// same seed gives the same map, so that test programs can make copies.
+// The maps fixture holds a pair of maps with their mask and matrix.
+
+#ifndef BLINK_RASTER_TOOLS_TEST_MAPS_H_AHZ
+#define BLINK_RASTER_TOOLS_TEST_MAPS_H_AHZ
+
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace blink {
+  namespace raster_tools {
+    namespace test {
+
+      // Categories 0..nCats-1 drawn uniformly
+      inline memory_raster<int> make_map(int rows, int cols, int nCats, 
+        unsigned seed)
+      {
+        memory_raster<int> map(rows, cols);
+        std::mt19937 rng(seed);
+        for (auto&& i : map) {
+          i = static_cast<int>(rng() % nCats);
+        }
+        return map;
+      }
+
+      // Mostly category 0, so that the other categories are far apart and
+      // distances up to the cutoff radius matter. The top `unused`
+      // categories do not occur.
+      inline memory_raster<int> make_sparse_map(int rows, int cols,
+        int nCats, unsigned seed, int unused = 0)
+      {
+        memory_raster<int> map(rows, cols);
+        std::mt19937 rng(seed);
+        const int used = nCats - 1 - unused;
+        for (auto&& i : map) {
+          i = rng() % 30 == 0 ? 1 + static_cast<int>(rng() % used) : 0;
+        }
+        return map;
+      }
+
+      // Mask with holes: about one in eight cells is excluded
+      inline memory_raster<int> make_mask(int rows, int cols)
+      {
+        memory_raster<int> mask(rows, cols);
+        std::mt19937 rng(5);
+        for (auto&& i : mask) {
+          i = rng() % 8 == 0 ? 0 : 1;
+        }
+        return mask;
+      }
+
+      // Similarity 1 on the diagonal and 0, 0.25 or 0.5 elsewhere
+      inline matrix<double> make_matrix(int nCatsA, int nCatsB)
+      {
+        matrix<double> m(nCatsA, std::vector<double>(nCatsB, 0));
+        for (int i = 0; i < nCatsA; ++i) {
+          for (int j = 0; j < nCatsB; ++j) {
+            m[i][j] = i == j ? 1 : ((i + 2 * j) % 3) * 0.25;
+          }
+        }
+        return m;
+      }
+
+      // Two maps of the same size, with make_mask and make_matrix
+      struct maps
+      {
+        // Uniform maps of seeds 1 and 2
+        maps(int rows, int cols, int nCatsA, int nCatsB)
+          : maps(make_map(rows, cols, nCatsA, 1),
+            make_map(rows, cols, nCatsB, 2), nCatsA, nCatsB)
+        {
+        }
+
+        maps(memory_raster<int> a, memory_raster<int> b, int nCatsA,
+          int nCatsB)
+          : rows(static_cast<int>(a.size1()))
+          , cols(static_cast<int>(a.size2()))
+          , nCatsA(nCatsA), nCatsB(nCatsB)
+          , mapA(std::move(a)), mapB(std::move(b))
+          , mask(make_mask(rows, cols))
+          , m(make_matrix(nCatsA, nCatsB))
+        {
+        }
+
+        int rows;
+        int cols;
+        int nCatsA;
+        int nCatsB;
+        memory_raster<int> mapA;
+        memory_raster<int> mapB;
+        memory_raster<int> mask;
+        matrix<double> m;
+      };
+    }
+  }
+}
+#endif
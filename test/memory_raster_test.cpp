@@ -0,0 +1,121 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of the memory arena of memory_raster_maker: repeated rounds of
+// intermediate rasters reuse the blocks of the arena, also while a raster
+// from an earlier round is kept alive, and the kept raster is not
+// overwritten. Empty rasters do not hold on to blocks.
+
+#include "check.h"
+
+#include <blink/raster_tools/memory_raster.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+
+// Rasters of 1 MB in blocks that each hold eight of them
+const int rows = 512;
+const int cols = 512;
+const std::size_t block_size = std::size_t(1) << 23;
+
+// One round of eight rasters, filled and released together
+void round(std::shared_ptr<rt::memory_arena> arena, int value)
+{
+  std::vector<rt::memory_raster<int> > layers;
+  for (int i = 0; i < 8; ++i) {
+    layers.emplace_back(rows, cols, arena);
+    std::fill(layers.back().begin(), layers.back().end(), value);
+  }
+}
+
+void test_rounds()
+{
+  auto arena = std::make_shared<rt::memory_arena>(block_size);
+  round(arena, 1);
+  const std::size_t capacity = arena->capacity();
+  for (int i = 0; i < 20; ++i) {
+    round(arena, i);
+  }
+  check(arena->capacity() == capacity, "rounds reuse the blocks");
+}
+
+// A raster kept alive over all rounds only holds on to its own block
+void test_rounds_with_kept_raster()
+{
+  auto arena = std::make_shared<rt::memory_arena>(block_size);
+  rt::memory_raster<int> kept(rows, cols, arena);
+  std::fill(kept.begin(), kept.end(), -1);
+  round(arena, 1);
+  const std::size_t capacity = arena->capacity();
+  for (int i = 0; i < 20; ++i) {
+    round(arena, i);
+  }
+  check(arena->capacity() == capacity,
+    "rounds reuse the blocks while a raster is kept");
+  check(arena->capacity() <= 2 * block_size,
+    "rounds take at most one block besides that of the kept raster");
+  check(std::all_of(kept.begin(), kept.end(), [](int i) { return i == -1; }),
+    "the kept raster is not overwritten");
+}
+
+// Rasters of a round released in a different order than made, while the
+// first raster of each round stays alive until the next round
+void test_interleaved_rounds()
+{
+  auto arena = std::make_shared<rt::memory_arena>(block_size);
+  std::vector<rt::memory_raster<int> > kept;
+  std::size_t capacity = 0;
+  for (int i = 0; i < 20; ++i) {
+    std::vector<rt::memory_raster<int> > layers;
+    for (int j = 0; j < 8; ++j) {
+      layers.emplace_back(rows, cols, arena);
+      std::fill(layers.back().begin(), layers.back().end(), i);
+    }
+    kept.assign(1, layers.front());
+    std::reverse(layers.begin(), layers.end());
+    layers.clear();
+    if (i == 1) {
+      capacity = arena->capacity();
+    }
+    check(std::all_of(kept[0].begin(), kept[0].end(),
+      [i](int v) { return v == i; }),
+      "the kept raster of round " + std::to_string(i) + " is intact");
+  }
+  check(arena->capacity() == capacity,
+    "interleaved rounds reuse the blocks");
+}
+
+// An empty raster does not hold on to a block, also not to one that is 
+// exactly full
+void test_empty_raster()
+{
+  auto arena = std::make_shared<rt::memory_arena>(1024);
+  {
+    rt::memory_raster<double> full(8, 16, arena);
+    rt::memory_raster<double> empty(0, 16, arena);
+    check(empty.begin() == empty.end(), "the empty raster has no cells");
+  }
+  rt::memory_raster<double> again(8, 16, arena);
+  check(arena->capacity() == 1024, "the block is reused after an empty raster");
+}
+
+int main()
+{
+  test_rounds();
+  test_rounds_with_kept_raster();
+  test_interleaved_rounds();
+  test_empty_raster();
+  return rt::test::report("memory_raster_test");
+}
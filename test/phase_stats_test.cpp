@@ -0,0 +1,235 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests of phase_stats: a run with stats gives the result of a run without
+// and records its phases and progress, and a progress callback that cancels
+// the run mid-way makes the call return false, with the phases up to the
+// cancellation recorded and the later phases not entered.
+
+#include "check.h"
+#include "maps.h"
+
+#include <blink/raster_tools/distance_transform.h>
+#include <blink/raster_tools/fuzzy_kappa.h>
+#include <blink/raster_tools/memory_raster.h>
+#include <blink/raster_tools/phase_stats.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+using rt::test::check_close;
+using rt::test::make_map;
+using rt::test::maps;
+
+// Maps over several blocks of rows of the cell loop
+maps make_maps()
+{
+  return maps(75, 90, 5, 4);
+}
+
+// Progress callback that records the fractions it is called with and
+// cancels once the fraction exceeds cancel_after
+struct recorder
+{
+  explicit recorder(double cancel_after = 2) : cancel_after(cancel_after)
+  {
+  }
+
+  rt::phase_stats::progress_function callback()
+  {
+    return [this](double fraction) {
+      fractions.push_back(fraction);
+      return fraction <= cancel_after;
+    };
+  }
+
+  double cancel_after;
+  std::vector<double> fractions;
+};
+
+// Fuzzy Kappa with stats, serial or parallel
+bool run(const maps& in, rt::phase_stats& stats, int threads, double& fk,
+  rt::memory_raster<double>& comparison)
+{
+  if (threads == 0) {
+    return rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA,
+      in.nCatsB, in.m, rt::exponential_decay(2), comparison,
+      rt::memory_raster_maker{}, stats, fk);
+  }
+  return rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask, in.nCatsA,
+    in.nCatsB, in.m, rt::exponential_decay(2), comparison,
+    rt::memory_raster_maker{}, rt::parallel_execution(threads), stats, fk);
+}
+
+std::string execution_name(int threads)
+{
+  return threads == 0 ? "serial" : std::to_string(threads) + " threads";
+}
+
+// Without cancellation the result is that of a run without stats, all
+// phases are recorded and the progress reaches 1
+void test_fuzzy_kappa_stats()
+{
+  const maps in = make_maps();
+  rt::memory_raster<double> plain_map(in.rows, in.cols);
+  double plain = 0;
+  const bool plain_result = rt::fuzzy_kappa_2009(in.mapA, in.mapB, in.mask,
+    in.nCatsA, in.nCatsB, in.m, rt::exponential_decay(2), plain_map,
+    rt::memory_raster_maker{}, plain);
+  const std::size_t cells = static_cast<std::size_t>(in.rows) * in.cols;
+
+  for (int threads : { 0, 1, 2 }) {
+    const std::string what = "fuzzy kappa, " + execution_name(threads);
+    recorder progress;
+    rt::phase_stats stats(progress.callback());
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 0;
+    check(run(in, stats, threads, fk, comparison) == plain_result,
+      what + ": result as without stats");
+    check_close(fk, plain, 1e-12, what + ": value as without stats");
+    check(!stats.cancelled(), what + ": not cancelled");
+    check(stats[rt::phase::allocation].m_calls == 1
+      && stats[rt::phase::allocation].m_bytes > 0,
+      what + ": allocation recorded");
+    check(stats[rt::phase::distance_transform].m_calls > 0
+      && stats[rt::phase::distance_transform].m_cells > 0,
+      what + ": distance transforms recorded");
+    check(stats[rt::phase::cell_loop].m_calls == 1
+      && stats[rt::phase::cell_loop].m_cells == cells,
+      what + ": cell loop recorded");
+    check(stats[rt::phase::compact_distributions].m_calls == 1
+      && stats[rt::phase::expected_similarity].m_calls == 1,
+      what + ": expected similarity recorded");
+    check(stats.distribution_entries() > 0,
+      what + ": distribution entries recorded");
+    check(!progress.fractions.empty() && progress.fractions.back() == 1.0,
+      what + ": progress reaches 1");
+    if (threads == 0) {
+      check(std::is_sorted(progress.fractions.begin(),
+        progress.fractions.end()), what + ": progress does not go back");
+    }
+  }
+}
+
+// Cancelled during the distance transforms: the cell loop is not entered
+void test_fuzzy_kappa_cancel_distances()
+{
+  const maps in = make_maps();
+  for (int threads : { 0, 1, 2 }) {
+    const std::string what = "fuzzy kappa cancelled in the distances, "
+      + execution_name(threads);
+    recorder progress(0);
+    rt::phase_stats stats(progress.callback());
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 1;
+    check(!run(in, stats, threads, fk, comparison), what + ": returns false");
+    check(fk == 0, what + ": Fuzzy Kappa is 0");
+    check(stats.cancelled(), what + ": stats cancelled");
+    check(stats[rt::phase::allocation].m_calls == 1,
+      what + ": allocation recorded");
+    check(stats[rt::phase::distance_transform].m_calls > 0,
+      what + ": distance transform recorded");
+    check(stats[rt::phase::cell_loop].m_calls == 0
+      && stats[rt::phase::expected_similarity].m_calls == 0,
+      what + ": later phases not entered");
+  }
+}
+
+// Cancelled during the cell loop, which is the second half of the progress:
+// the loop is recorded without cells and the expected similarity is not
+// computed
+void test_fuzzy_kappa_cancel_cell_loop()
+{
+  const maps in = make_maps();
+  for (int threads : { 0, 1, 2 }) {
+    const std::string what = "fuzzy kappa cancelled in the cell loop, "
+      + execution_name(threads);
+    recorder progress(0.6);
+    rt::phase_stats stats(progress.callback());
+    rt::memory_raster<double> comparison(in.rows, in.cols);
+    double fk = 1;
+    check(!run(in, stats, threads, fk, comparison), what + ": returns false");
+    check(fk == 0, what + ": Fuzzy Kappa is 0");
+    check(stats.cancelled(), what + ": stats cancelled");
+    check(stats[rt::phase::distance_transform].m_calls > 0,
+      what + ": distance transform recorded");
+    check(stats[rt::phase::cell_loop].m_calls == 1
+      && stats[rt::phase::cell_loop].m_cells == 0,
+      what + ": cell loop recorded without cells");
+    check(stats[rt::phase::compact_distributions].m_calls == 0
+      && stats[rt::phase::expected_similarity].m_calls == 0,
+      what + ": later phases not entered");
+  }
+}
+
+// The distance transform with stats gives the serial distances and
+// records both phases. Cancelled in the column phase, it returns false
+// without entering the row phase. Progress counts columns, then rows, so
+// with more columns than rows it is cancelled in the row phase after 0.9.
+void test_distance_transform()
+{
+  const int rows = 60;
+  const int cols = 300;
+  const int target = 1;
+  const std::size_t cells = static_cast<std::size_t>(rows) * cols;
+  auto map = make_map(rows, cols, 20, 3);
+  rt::memory_raster<double> serial(rows, cols);
+  check(rt::distance_transform(map, serial, target, rt::euclidean_squared{}),
+    "distance transform finds the target");
+
+  for (int threads : { 0, 1, 2 }) {
+    const std::string what = "distance transform, "
+      + execution_name(threads);
+    for (double cancel_after : { 2.0, 0.0, 0.9 }) {
+      const bool cancel = cancel_after < 1;
+      const bool in_rows = cancel_after > 0.5;
+      recorder progress(cancel_after);
+      rt::phase_stats stats(progress.callback());
+      rt::memory_raster<double> out(rows, cols);
+      const bool found = threads == 0
+        ? rt::distance_transform(map, out, target, rt::euclidean_squared{},
+          rt::serial_execution{}, stats)
+        : rt::distance_transform(map, out, target, rt::euclidean_squared{},
+          rt::parallel_execution(threads), stats);
+      check(stats[rt::phase::column_phase].m_calls == 1
+        && stats[rt::phase::column_phase].m_cells == cells,
+        what + ": column phase recorded");
+      if (cancel) {
+        check(!found, what + ", cancelled: returns false");
+        check(stats.cancelled(), what + ", cancelled: stats cancelled");
+        check(stats[rt::phase::row_phase].m_calls == (in_rows ? 1 : 0),
+          what + (in_rows ? ", cancelled in the row phase: row phase recorded"
+            : ", cancelled in the column phase: row phase not entered"));
+      }
+      else {
+        check(found, what + ": returns true");
+        check(!stats.cancelled(), what + ": not cancelled");
+        check(stats[rt::phase::row_phase].m_calls == 1
+          && stats[rt::phase::row_phase].m_cells == cells,
+          what + ": row phase recorded");
+        check(std::equal(serial.begin(), serial.end(), out.begin()),
+          what + ": distances as without stats");
+        check(!progress.fractions.empty()
+          && progress.fractions.back() == 1.0, what + ": progress reaches 1");
+      }
+    }
+  }
+}
+
+int main()
+{
+  test_fuzzy_kappa_stats();
+  test_fuzzy_kappa_cancel_distances();
+  test_fuzzy_kappa_cancel_cell_loop();
+  test_distance_transform();
+  return rt::test::report("phase_stats_test");
+}
@@ -0,0 +1,118 @@
+//
+//=======================================================================
+// Copyright 2016
+// Author: Alex Hagen-Zanker
+// University of Surrey
+//
+// Distributed under the MIT Licence (http://opensource.org/licenses/MIT)
+//=======================================================================
+//
+// Tests that the AVX2 and AVX-512 kernels give the same bits as the scalar
+// kernels, for the instruction sets that the processor supports.
+
+#include "check.h"
+
+#include <blink/raster_tools/simd.h>
+
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rt = blink::raster_tools;
+using rt::test::check;
+
+bool same_bits(const std::vector<double>& a, const std::vector<double>& b)
+{
+  return a.size() == b.size() && (a.empty()
+    || std::memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0);
+}
+
+// Values of both signs, with zeros, NaN and infinity mixed in
+std::vector<double> make_values(std::mt19937& rng, std::size_t n)
+{
+  std::uniform_real_distribution<double> uniform(-2, 2);
+  std::vector<double> values(n);
+  for (auto&& i : values) {
+    switch (rng() % 16) {
+    case 0: i = 0; break;
+    case 1: i = -0.0; break;
+    case 2: i = std::numeric_limits<double>::quiet_NaN(); break;
+    case 3: i = std::numeric_limits<double>::infinity(); break;
+    default: i = uniform(rng);
+    }
+  }
+  return values;
+}
+
+// Table indices, some beyond the table
+std::vector<double> make_indices(std::mt19937& rng, std::size_t n,
+  std::size_t table_size)
+{
+  std::vector<double> values(n);
+  for (auto&& i : values) {
+    i = static_cast<double>(rng() % (table_size + table_size / 8 + 1));
+  }
+  return values;
+}
+
+struct kernels
+{
+  std::string name;
+  void(*max_product)(double*, const double*, double, std::size_t);
+  void(*positive_part)(double*, const double*, std::size_t);
+  std::size_t(*lookup)(double*, std::size_t, const double*, std::size_t);
+};
+
+void test_kernels(const kernels& k)
+{
+  std::mt19937 rng(1);
+  for (std::size_t n = 0; n < 40; ++n) {
+    const std::string what = k.name + ", n = " + std::to_string(n);
+    const std::vector<double> src = make_values(rng, n);
+    const std::vector<double> dst = make_values(rng, n);
+    for (double factor : { 0.5, 0.0, -1.0 }) {
+      std::vector<double> expected = dst;
+      std::vector<double> result = dst;
+      rt::detail::max_product_scalar(expected.data(), src.data(), factor, n);
+      k.max_product(result.data(), src.data(), factor, n);
+      check(same_bits(expected, result), "max_product " + what);
+    }
+
+    std::vector<double> expected(n);
+    std::vector<double> result(n);
+    rt::detail::positive_part_scalar(expected.data(), src.data(), n);
+    k.positive_part(result.data(), src.data(), n);
+    check(same_bits(expected, result), "positive_part " + what);
+
+    const std::vector<double> table = make_values(rng, 17);
+    expected = make_indices(rng, n, table.size());
+    result = expected;
+    const std::size_t misses = rt::detail::lookup_scalar(expected.data(), n,
+      table.data(), table.size());
+    check(k.lookup(result.data(), n, table.data(), table.size()) == misses,
+      "lookup misses " + what);
+    check(same_bits(expected, result), "lookup " + what);
+  }
+}
+
+int main()
+{
+  test_kernels({ "scalar", rt::detail::max_product_scalar,
+    rt::detail::positive_part_scalar, rt::detail::lookup_scalar });
+  test_kernels({ "dispatch", rt::detail::max_product,
+    rt::detail::positive_part, rt::detail::lookup });
+#if defined(BLINK_RASTER_TOOLS_X86_SIMD)
+  const rt::simd_level level = rt::active_simd_level();
+  if (level == rt::simd_level::avx2 || level == rt::simd_level::avx512) {
+    test_kernels({ "avx2", rt::detail::max_product_avx2,
+      rt::detail::positive_part_avx2, rt::detail::lookup_avx2 });
+  }
+  if (level == rt::simd_level::avx512) {
+    test_kernels({ "avx512", rt::detail::max_product_avx512,
+      rt::detail::positive_part_avx512, rt::detail::lookup_avx512 });
+  }
+#endif
+  return rt::test::report("simd_test");
+}